@@ -23,11 +23,12 @@ include_directories(${SUBMODULESS_PATH}/Simple-FFT/include)
 # Add GLFW to linking
 set(ALL_LIBRARIES ${ALL_LIBRARIES} glfw)
 
-# Include directories of python
-include_directories(${PYTHON_INCLUDE_DIRS})
-
-# Link against python
-link_libraries(${PYTHON_LIBRARIES})
+# Include directories of python and link against it, only needed by the mdtraj loader
+if(USE_MDTRAJ)
+    include_directories(${PYTHON_INCLUDE_DIRS})
+    link_libraries(${PYTHON_LIBRARIES})
+    add_definitions(-DUSE_MDTRAJ)
+endif()
 
 # Link against system libraries
 if("${CMAKE_SYSTEM}" MATCHES "Linux")
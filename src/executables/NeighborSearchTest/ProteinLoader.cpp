@@ -7,6 +7,7 @@
 ProteinLoader::ProteinLoader()
 {
     m_currentProteinIdx = 0;
+    m_numberOfResidues = 0;
 }
 
 ProteinLoader::~ProteinLoader()
@@ -47,6 +48,25 @@ std::vector<SimpleAtom> ProteinLoader::getAllAtoms()
     return m_allAtoms;
 }
 
+std::vector<uint> ProteinLoader::getAllResidues()
+{
+    std::vector<uint> residues;
+    for (int i = 0; i < getNumberOfProteins(); i++) {
+        SimpleProtein* protein = getProteinAt(i);
+        residues.insert(std::end(residues), std::begin(protein->residues), std::end(protein->residues));
+    }
+    return residues;
+}
+
+std::vector<uint> ProteinLoader::getAllProteinIndices()
+{
+    std::vector<uint> proteinIndices;
+    for (int i = 0; i < getNumberOfProteins(); i++) {
+        proteinIndices.insert(std::end(proteinIndices), getProteinAt(i)->atoms.size(), (uint)i);
+    }
+    return proteinIndices;
+}
+
 int ProteinLoader::getNumberOfAllAtoms()
 {
     return m_allAtoms.size();
@@ -110,98 +130,49 @@ void ProteinLoader::loadPDB(std::string filePath, SimpleProtein &protein, glm::v
     std::vector<std::string> elementNames;
     std::vector<glm::vec3> positions;
     std::vector<float> radii;
+    std::vector<uint> residues;
 
 
     /*
-     * init mdtraj wrapper and load pdb file as pyobject
+     * parse the pdb file
      */
-    MdTrajWrapper mdTrajWrapper;
-    PyObject* pdbFile = mdTrajWrapper.loadFilePDB(filePath);
+    PdbParser pdbParser;
+    PdbStructure structure;
+    if (!pdbParser.parse(filePath, structure)) {
+        return;
+    }
 
 
     /*
-     * Atom positions
+     * Atom positions of the first model
      */
-    PyObject* xyz_py = mdTrajWrapper.getXYZ(pdbFile);
-    PyObject* topo = mdTrajWrapper.getTopology(pdbFile);
-    Py_DECREF(pdbFile);
-    PyArrayObject* xyz_pyarray = reinterpret_cast<PyArrayObject*>(xyz_py);
-
-    //get number of frames, atoms and components
-    long long numAtom{ PyArray_SHAPE(xyz_pyarray)[1] };
-    long long numComponents{ PyArray_SHAPE(xyz_pyarray)[2] };
-    int numAtoms = (int)numAtom;
-
-    // cast the 3D numpy array to a 1D c array
-    float* xyz_carray;
-    xyz_carray = reinterpret_cast<float*>(PyArray_DATA(xyz_pyarray));
-
-    float positionX;
-    float positionY;
-    float positionZ;
-
-    std::vector<glm::vec3> frameHolder;
-    for (int a = 0; a < numAtoms; a++)
-    {
-        int id = a * numComponents;
-        positionX = xyz_carray[id] * 10;
-        positionY = xyz_carray[id + 1] * 10;
-        positionZ = xyz_carray[id + 2] * 10;
-        glm::vec3 position(positionX, positionY, positionZ);
+    const glm::vec3* pPositions = structure.positions.getFrame(0);
+    for (int i = 0; i < structure.getNumberOfAtoms(); i++) {
+        const glm::vec3& position = pPositions[i];
         positions.push_back(position);
 
         /*
          * get min and max
          */
-        minPosition.x = (positionX < minPosition.x) ? positionX : minPosition.x;
-        minPosition.y = (positionY < minPosition.y) ? positionY : minPosition.y;
-        minPosition.z = (positionZ < minPosition.z) ? positionZ : minPosition.z;
-
-        maxPosition.x = (positionX > maxPosition.x) ? positionX : maxPosition.x;
-        maxPosition.y = (positionY > maxPosition.y) ? positionY : maxPosition.y;
-        maxPosition.z = (positionZ > maxPosition.z) ? positionZ : maxPosition.z;
+        minPosition = glm::min(minPosition, position);
+        maxPosition = glm::max(maxPosition, position);
     }
-    Py_DECREF(xyz_py);
 
 
     /*
      * Atom properties
      */
-    PyObject* atom_py = PyObject_GetAttrString(topo, "atoms");
-    PyObject* atom_iterator_py = PyObject_GetIter(atom_py);
-    Py_DECREF(atom_py);
-
-    PyObject* atom;
-    PyObject* name_py;
-    PyObject* element_py;
-    PyObject* element_name_py;
-    PyObject* atom_radius_py;
-
-    atom = PyIter_Next(atom_iterator_py);
-    while ((atom != NULL)) {
-        name_py = PyObject_GetAttrString(atom, "name");
-        element_py = PyObject_GetAttrString(atom, "element");
-        element_name_py = PyObject_GetAttrString(element_py, "name");
-        atom_radius_py = PyObject_GetAttrString(element_py, "radius");
-
-        names.push_back(PyUnicode_AsUTF8(name_py));
-        elementNames.push_back(PyUnicode_AsUTF8(element_name_py));
-        double radius = PyFloat_AsDouble(atom_radius_py) * 10;
-        radii.push_back(radius);
+    for (int i = 0; i < structure.getNumberOfAtoms(); i++) {
+        names.push_back(structure.atomNames.at(i));
+        elementNames.push_back(structure.elementNames.at(i));
+        radii.push_back(structure.radii.at(i));
+        residues.push_back(m_numberOfResidues + (uint)structure.atomResidues.at(i));
 
         /*
          * find the atom with the biggest radius
          */
-        maxRadius = std::max((float)radius, maxRadius);
-
-        Py_DECREF(name_py);
-        Py_DECREF(element_py);
-        Py_DECREF(element_name_py);
-        Py_DECREF(atom_radius_py);
-
-        atom = PyIter_Next(atom_iterator_py);
+        maxRadius = std::max(structure.radii.at(i), maxRadius);
     }
-    Py_DECREF(atom_iterator_py);
 
 
     /*
@@ -234,6 +205,7 @@ void ProteinLoader::loadPDB(std::string filePath, SimpleProtein &protein, glm::v
              * add atom to both protein and all atoms
              */
             protein.atoms.push_back(atom);
+            protein.residues.push_back(residues.at(i));
             m_allAtoms.push_back(atom);
         }
     } else {
@@ -242,9 +214,13 @@ void ProteinLoader::loadPDB(std::string filePath, SimpleProtein &protein, glm::v
 
 
     /*
-     * increment protein idx
+     * increment protein idx, residues of the next
+     * protein start after the ones of this protein
      */
     m_currentProteinIdx++;
+    for (uint residue : residues) {
+        m_numberOfResidues = std::max(m_numberOfResidues, residue + 1);
+    }
 }
 
 void ProteinLoader::getBoundingBoxAroundProteins(glm::vec3& min, glm::vec3& max)
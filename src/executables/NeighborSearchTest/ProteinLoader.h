@@ -12,7 +12,7 @@
 #include <limits>
 
 // framework includes
-#include "Molecule/MDtrajLoader/MdTraj/MdTrajWrapper.h"
+#include "Molecule/MDtrajLoader/Pdb/PdbParser.h"
 #include "Utils/Logger.h"
 
 // project specific includes
@@ -32,6 +32,8 @@ public:
     std::vector<SimpleProtein*> getProteins();
     SimpleProtein* getProteinAt(int i);
     std::vector<SimpleAtom> getAllAtoms();
+    std::vector<uint> getAllResidues();
+    std::vector<uint> getAllProteinIndices();
     void updateAtoms();
     int getNumberOfAllAtoms();
     void getBoundingBoxAroundProteins(glm::vec3& min, glm::vec3& max);
@@ -47,6 +49,7 @@ private:
     std::vector<SimpleProtein*> m_proteins;
     std::vector<SimpleAtom> m_allAtoms;
     float m_currentProteinIdx;
+    uint m_numberOfResidues;
 };
 
 
@@ -23,6 +23,7 @@ public:
     //_____________________________________//
     std::string name;
     std::vector<SimpleAtom> atoms;
+    std::vector<uint> residues; // residue of every atom, unique over all proteins
     glm::vec3 bbMin;
     glm::vec3 bbMax;
 
@@ -20,6 +20,7 @@
 #include "ProteinLoader.h"
 #include "Utils/OrbitCamera.h"
 #include "NeighborSearch/NeighborhoodSearch.h"
+#include "NeighborSearch/ContactMap.h"
 
 
 
@@ -86,12 +87,20 @@ float               m_searchRadius;
 glm::ivec3          m_gridRes;
 static bool         m_findOnlySelectedAtomsNeighbors = false;
 bool                m_updateNeighborhoodSearch = false;
+bool                m_periodicBoundaries = false;
+bool                m_tuneResolution = false;
+bool                m_pairwiseCutoff = false;
+float               m_probeRadius = 1.4f;
+int                 m_gridType = (int)NeighborhoodSearch::GridType::Automatic;
+bool                m_recordContacts = false;
+std::unique_ptr<ContactMap> mp_contactMap;
 ShaderProgram       m_extractElementPositionsShader;
 ShaderProgram       m_findSelectedAtomsNeighborsShader;
 ShaderProgram       m_colorAtomsInRadiusShader;
 GLuint m_atomsSSBO;
 GLuint* m_positionsSSBO;
 GLuint* m_searchResultsSSBO;
+GLuint* m_radiiSSBO;
 
 
 // time
@@ -136,6 +145,8 @@ void colorAtomsInRadius(Neighborhood& neighborhood);
 void fillPickingTexture(ShaderProgram pickingProgram);
 void updateGUI();
 
+bool testHashedGridWithSkin();
+
 
 
 
@@ -263,6 +274,17 @@ void setupBuffers()
      */
     m_searchResultsSSBO = new GLuint;
     GPUHandler::initSSBO<int>(m_searchResultsSSBO, m_proteinLoader.getNumberOfAllAtoms());
+
+    /*
+     * init radii ssbo for pairwise cutoffs
+     */
+    std::vector<float> radii;
+    for (auto const& rAtom : m_proteinLoader.getAllAtoms()) {
+        radii.push_back(rAtom.radius);
+    }
+    m_radiiSSBO = new GLuint;
+    GPUHandler::initSSBO<float>(m_radiiSSBO, m_proteinLoader.getNumberOfAllAtoms());
+    GPUHandler::copyDataToSSBO<float>(m_radiiSSBO, radii.data(), m_proteinLoader.getNumberOfAllAtoms());
 }
 
 
@@ -545,7 +567,23 @@ void run()
             glm::fvec3 min, max;
             m_proteinLoader.getCenteredBoundingBoxAroundProteins(min, max);
 
-            m_search.update(m_proteinLoader.getNumberOfAllAtoms(), min, max, m_gridRes, m_searchRadius);
+            glm::vec3 periodicBox = m_periodicBoundaries ? (max - min) : glm::vec3(0.f);
+            m_search.update(m_proteinLoader.getNumberOfAllAtoms(), min, max, m_gridRes, m_searchRadius, periodicBox);
+
+            setupLinesBuffer();
+        }
+
+        /*
+         * time several resolutions and keep the fastest
+         */
+        if (m_tuneResolution) {
+            m_tuneResolution = false;
+
+            glm::fvec3 min, max;
+            m_proteinLoader.getCenteredBoundingBoxAroundProteins(min, max);
+
+            glm::vec3 periodicBox = m_periodicBoundaries ? (max - min) : glm::vec3(0.f);
+            m_gridRes = m_search.tuneResolution(m_positionsSSBO, min, max, m_searchRadius, 3, periodicBox);
 
             setupLinesBuffer();
         }
@@ -564,6 +602,15 @@ void run()
         findNeighbors(neighborhood);
         m_applicationTimer.stop();
 
+        /*
+         * accumulate the residue contacts between the proteins
+         */
+        if (m_recordContacts) {
+            NeighborList neighborList;
+            m_search.buildNeighborList(neighborList);
+            mp_contactMap->addFrame(neighborList, m_proteinLoader.getNumberOfAllAtoms(), std::thread::hardware_concurrency());
+        }
+
         /*
          * draw proteins as impostor
          */
@@ -799,7 +846,7 @@ void findNeighbors(Neighborhood& neighborhood)
 void findSelectedAtomsNeighbors(Neighborhood& neighborhood, int selectedAtomIdx)
 {
     // reset search results
-    GPUHandler::fillSSBO<int>(m_searchResultsSSBO, m_proteinLoader.getNumberOfAllAtoms(), 0);
+    GPUHandler::clearSSBO<int>(m_searchResultsSSBO, m_proteinLoader.getNumberOfAllAtoms(), 0);
 
     int numBlocks = ceil((float)m_proteinLoader.getNumberOfAllAtoms() / BLOCK_SIZE);
 
@@ -811,6 +858,7 @@ void findSelectedAtomsNeighbors(Neighborhood& neighborhood, int selectedAtomIdx)
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, *neighborhood.dp_grid);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, *neighborhood.dp_particleOriginalIndex);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, *m_searchResultsSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, *neighborhood.dp_searchCellOffsets);
 
     m_findSelectedAtomsNeighborsShader.use();
     m_findSelectedAtomsNeighborsShader.update("selectedAtomUndx", selectedAtomIdx);
@@ -818,7 +866,16 @@ void findSelectedAtomsNeighbors(Neighborhood& neighborhood, int selectedAtomIdx)
     m_findSelectedAtomsNeighborsShader.update("radius2",          neighborhood.searchRadius * neighborhood.searchRadius);
     m_findSelectedAtomsNeighborsShader.update("gridAdjCnt",       neighborhood.numberOfSearchCells);
     m_findSelectedAtomsNeighborsShader.update("searchCellOff",    neighborhood.startCellOffset);
-    glUniform1iv(glGetUniformLocation(m_findSelectedAtomsNeighborsShader.getProgramHandle(),"gridAdj"), 216, neighborhood.p_searchCellOffsets);
+    m_findSelectedAtomsNeighborsShader.update("cellOrder",        neighborhood.cellOrder);
+    m_findSelectedAtomsNeighborsShader.update("searchCellMin",    neighborhood.searchCellMin);
+    m_findSelectedAtomsNeighborsShader.update("searchCellMax",    neighborhood.searchCellMax);
+    m_findSelectedAtomsNeighborsShader.update("periodicBox",      neighborhood.periodicBox);
+    m_findSelectedAtomsNeighborsShader.update("gridRes",          neighborhood.gridResolution);
+    m_findSelectedAtomsNeighborsShader.update("numberOfGridCells", neighborhood.numberOfGridCells);
+    m_findSelectedAtomsNeighborsShader.update("gridMin",          neighborhood.gridMin);
+    m_findSelectedAtomsNeighborsShader.update("gridDelta",        neighborhood.gridDelta);
+    m_findSelectedAtomsNeighborsShader.update("pairwiseCutoff",   neighborhood.pairwiseCutoff);
+    m_findSelectedAtomsNeighborsShader.update("probeRadius",      neighborhood.probeRadius);
     glDispatchCompute(numBlocks, 1, 1);
     glMemoryBarrier (GL_ALL_BARRIER_BITS);
 }
@@ -835,13 +892,23 @@ void colorAtomsInRadius(Neighborhood& neighborhood)
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, *neighborhood.dp_grid);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, *neighborhood.dp_particleOriginalIndex);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, *m_searchResultsSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, *neighborhood.dp_searchCellOffsets);
 
     m_colorAtomsInRadiusShader.use();
     m_colorAtomsInRadiusShader.update("pnum",             m_proteinLoader.getNumberOfAllAtoms());
     m_colorAtomsInRadiusShader.update("radius2",          neighborhood.searchRadius * neighborhood.searchRadius);
     m_colorAtomsInRadiusShader.update("gridAdjCnt",       neighborhood.numberOfSearchCells);
     m_colorAtomsInRadiusShader.update("searchCellOff",    neighborhood.startCellOffset);
-    glUniform1iv(glGetUniformLocation(m_colorAtomsInRadiusShader.getProgramHandle(),"gridAdj"), 216, neighborhood.p_searchCellOffsets);
+    m_colorAtomsInRadiusShader.update("cellOrder",        neighborhood.cellOrder);
+    m_colorAtomsInRadiusShader.update("searchCellMin",    neighborhood.searchCellMin);
+    m_colorAtomsInRadiusShader.update("searchCellMax",    neighborhood.searchCellMax);
+    m_colorAtomsInRadiusShader.update("periodicBox",      neighborhood.periodicBox);
+    m_colorAtomsInRadiusShader.update("gridRes",          neighborhood.gridResolution);
+    m_colorAtomsInRadiusShader.update("numberOfGridCells", neighborhood.numberOfGridCells);
+    m_colorAtomsInRadiusShader.update("gridMin",          neighborhood.gridMin);
+    m_colorAtomsInRadiusShader.update("gridDelta",        neighborhood.gridDelta);
+    m_colorAtomsInRadiusShader.update("pairwiseCutoff",   neighborhood.pairwiseCutoff);
+    m_colorAtomsInRadiusShader.update("probeRadius",      neighborhood.probeRadius);
     glDispatchCompute(numBlocks, 1, 1);
     glMemoryBarrier (GL_ALL_BARRIER_BITS);
 }
@@ -936,6 +1003,7 @@ void updateGUI()
             std::string gridCellNumText = "#Gridcells: " + std::to_string(m_search.getTotalGridNum());
             std::string cellSizeText = "Cellsize: " + std::to_string(m_search.getCellSize());
             std::string gridSearchText = "Gridsearch: " + std::to_string(m_search.getGridSearch());
+            std::string coveredRadiusText = "Covered search radius: " + std::to_string(m_search.getMaxSearchRadius());
 
             ImGui::Text(gridSizeText.c_str());
             ImGui::Text(gridResText.c_str());
@@ -943,6 +1011,7 @@ void updateGUI()
             ImGui::Text(gridMaxText.c_str());
             ImGui::Text(gridCellNumText.c_str());
             ImGui::Text(gridSearchText.c_str());
+            ImGui::Text(coveredRadiusText.c_str());
             ImGui::Text(cellSizeText.c_str());
             ImGui::Separator();
             ImGui::Checkbox("Show grid", &m_drawGrid);
@@ -994,7 +1063,7 @@ void updateGUI()
             ImGui::SliderInt("Grid resolution x", &m_gridRes.x, 1, 20);
             ImGui::SliderInt("Grid resolution y", &m_gridRes.y, 1, 20);
             ImGui::SliderInt("Grid resolution z", &m_gridRes.z, 1, 20);
-            ImGui::SliderFloat("Search radius", &m_searchRadius, 0, m_search.getMaxSearchRadius());
+            ImGui::SliderFloat("Search radius", &m_searchRadius, 0, glm::length(m_search.getGridSize()));
             if (oldSearchRadius != m_searchRadius ||
                     m_gridRes.x != oldGridRes.x   ||
                     m_gridRes.y != oldGridRes.y   ||
@@ -1006,6 +1075,79 @@ void updateGUI()
             ImGui::Text(setupTimeText.c_str());
             ImGui::Text(searchTimeText.c_str());
             ImGui::Checkbox("Find only neighbors of selected atom", &m_findOnlySelectedAtomsNeighbors);
+            float skin = m_search.getSkin();
+            if (ImGui::SliderFloat("Verlet skin", &skin, 0, m_search.getCellSize())) {
+                m_search.setSkin(skin);
+                m_search.resetRebuildStatistics();
+                m_updateNeighborhoodSearch = true;
+            }
+            std::string rebuildText = "Rebuilds: " + std::to_string(m_search.getRebuildCount()) + " of "
+                                      + std::to_string(m_search.getRunCount()) + " runs ("
+                                      + std::to_string(100.f * m_search.getRebuildRate()) + " %)";
+            ImGui::Text(rebuildText.c_str());
+            if (ImGui::Checkbox("Periodic boundaries", &m_periodicBoundaries)) {
+                m_updateNeighborhoodSearch = true;
+            }
+            bool mortonOrder = (m_search.getCellOrder() == NeighborhoodSearch::CellOrder::Morton);
+            if (ImGui::Checkbox("Morton cell order", &mortonOrder)) {
+                m_search.setCellOrder(mortonOrder ? NeighborhoodSearch::CellOrder::Morton : NeighborhoodSearch::CellOrder::Linear);
+                m_updateNeighborhoodSearch = true;
+            }
+            if (ImGui::Combo("Grid type", &m_gridType, "Dense\0Hashed\0Automatic\0")) {
+                m_search.setGridType((NeighborhoodSearch::GridType)m_gridType);
+                m_updateNeighborhoodSearch = true;
+            }
+            bool oldPairwiseCutoff = m_pairwiseCutoff;
+            float oldProbeRadius = m_probeRadius;
+            ImGui::Checkbox("Per-atom cutoffs", &m_pairwiseCutoff);
+            if (m_pairwiseCutoff) {
+                ImGui::SliderFloat("Probe radius", &m_probeRadius, 0, 5);
+            }
+            if (m_pairwiseCutoff != oldPairwiseCutoff || m_probeRadius != oldProbeRadius) {
+                if (m_pairwiseCutoff) {
+                    m_search.setElementRadii(m_radiiSSBO, m_probeRadius);
+                } else {
+                    m_search.clearElementRadii();
+                }
+                m_updateNeighborhoodSearch = true;
+            }
+            bool deterministic = m_search.getDeterministic();
+            if (ImGui::Checkbox("Deterministic build", &deterministic)) {
+                m_search.setDeterministic(deterministic);
+            }
+            if (ImGui::Button("Tune grid resolution")) {
+                m_tuneResolution = true;
+            }
+            bool profiling = m_search.getProfiling();
+            if (ImGui::Checkbox("Profile build stages", &profiling)) {
+                m_search.setProfiling(profiling);
+                m_search.resetStageTimings();
+            }
+            if (profiling) {
+                StageTimings timings = m_search.getStageTimings();
+                std::string stagesText = "Insert " + std::to_string(timings.insert) + " ms, scan " + std::to_string(timings.scan)
+                                         + " ms, sort " + std::to_string(timings.sort) + " ms";
+                ImGui::Text(stagesText.c_str());
+            }
+            std::string gridCellsText = std::string(m_search.getGridType() == NeighborhoodSearch::GridType::Hashed ? "Hashed" : "Dense")
+                                        + " grid with " + std::to_string(m_search.getNumberOfGridCells()) + " cells";
+            ImGui::Text(gridCellsText.c_str());
+            ImGui::Separator();
+            bool halfStencil = (m_search.getStencil() == NeighborhoodSearch::Stencil::Half);
+            if (ImGui::Checkbox("Half stencil neighbor list", &halfStencil)) {
+                m_search.setStencil(halfStencil ? NeighborhoodSearch::Stencil::Half : NeighborhoodSearch::Stencil::Full);
+            }
+            if (ImGui::Checkbox("Record residue contacts", &m_recordContacts) && m_recordContacts) {
+                mp_contactMap = std::unique_ptr<ContactMap>(new ContactMap(m_proteinLoader.getAllResidues(), m_proteinLoader.getAllProteinIndices()));
+            }
+            if (mp_contactMap) {
+                std::string contactsText = std::to_string(mp_contactMap->getNumberOfResiduePairs()) + " residue pairs in contact over "
+                                           + std::to_string(mp_contactMap->getNumberOfFrames()) + " frames";
+                ImGui::Text(contactsText.c_str());
+                if (ImGui::Button("Export residue contacts")) {
+                    mp_contactMap->writeToFile("residueContacts.txt");
+                }
+            }
 
             ImGui::EndMenu();
         }
@@ -1032,9 +1174,89 @@ void updateGUI()
 
 
 
-int main()
+/*
+ * TESTS
+ */
+bool testHashedGridWithSkin()
+{
+    /*
+     * jittered lattice on the cpu backend, afterwards every atom moves by just
+     * under half the skin. Many atoms cross a cell boundary while the structure
+     * of the first run is kept, the kept structure still has to find every pair
+     */
+    float searchRadius = 1.f;
+    float skin = 0.5f;
+    int atomsPerAxis = 12;
+    std::vector<glm::vec3> positions;
+    for (int x = 0; x < atomsPerAxis; x++) {
+        for (int y = 0; y < atomsPerAxis; y++) {
+            for (int z = 0; z < atomsPerAxis; z++) {
+                float jitter = 0.2f * sinf((float)(x * 131 + y * 71 + z * 37));
+                positions.push_back(0.7f * glm::vec3(x, y, z) + glm::vec3(jitter, -jitter, 0.5f * jitter));
+            }
+        }
+    }
+    int numberOfAtoms = (int)positions.size();
+
+    NeighborhoodSearch search;
+    search.setGridType(NeighborhoodSearch::GridType::Hashed);
+    search.setSkin(skin);
+    search.init(numberOfAtoms, glm::vec3(0.f), glm::vec3(0.7f * atomsPerAxis), glm::ivec3(0), searchRadius, NeighborhoodSearch::Backend::CPU);
+    NeighborhoodCPU neighborhood;
+    search.run(positions, neighborhood);
+
+    for (glm::vec3& position : positions) {
+        position.x += 0.49f * skin;
+    }
+    search.run(positions, neighborhood);
+    if (search.getRebuildCount() != 1) {
+        Logger::instance().print("Test hashed grid with skin: structure has been rebuilt", Logger::Mode::ERROR);
+        return false;
+    }
+
+    // compare with all pairs
+    NeighborListCPU neighborList;
+    search.buildNeighborList(positions, neighborList);
+    int visitedPairs = 0;
+    search.forEachPair(positions, [&](int, uint, uint, float) { visitedPairs++; });
+    int missingNeighbors = 0;
+    int numberOfPairs = 0;
+    for (int i = 0; i < numberOfAtoms; i++) {
+        int numberOfNeighbors = 0;
+        for (int j = 0; j < numberOfAtoms; j++) {
+            if (j == i || glm::length(positions[i] - positions[j]) >= searchRadius) continue;
+            numberOfNeighbors++;
+            if (!std::count(neighborList.p_neighborIndices + neighborList.p_neighborOffsets[i],
+                            neighborList.p_neighborIndices + neighborList.p_neighborOffsets[i+1], (uint)j)) {
+                missingNeighbors++;
+            }
+        }
+        numberOfPairs += numberOfNeighbors;
+    }
+    numberOfPairs /= 2;
+    if (missingNeighbors > 0 || neighborList.numberOfNeighbors != 2 * numberOfPairs || visitedPairs != numberOfPairs) {
+        Logger::instance().print("Test hashed grid with skin: " + std::to_string(missingNeighbors) + " neighbors missing, "
+                                 + std::to_string(visitedPairs) + " of " + std::to_string(numberOfPairs) + " pairs visited", Logger::Mode::ERROR);
+        return false;
+    }
+    Logger::instance().print("Test hashed grid with skin: passed");
+    return true;
+}
+
+
+
+int main(int argc, char* argv[])
 {
     Logger::instance().changeTab("     ");
+
+    /*
+     * tests of the cpu backend are run instead of the visualization when
+     * asked for with --test, they do not need a context
+     */
+    if (argc > 1 && std::string(argv[1]) == "--test") {
+        return testHashedGridWithSkin() ? 0 : 1;
+    }
+
     Logger::instance().print("Start Neighborhood search"); Logger::instance().tabIn();
 
     /*
@@ -1063,7 +1285,6 @@ int main()
     m_gridRes = glm::vec3(10, 10, 10);
     m_searchRadius = 20.f;
     initNeighborhoodSearch(m_gridRes, m_searchRadius);
-    m_searchRadius = m_search.getMaxSearchRadius() - 0.01f;
     m_updateNeighborhoodSearch = true;
 
     /*
@@ -51,10 +51,11 @@ void Path::update(
     for(int frame = 0; frame < pGPUProtein->getFrameCount(); frame++)
     {
         // Go over analysed atoms and accumulate position in frame
+        auto positions = pGPUProtein->getFrame(frame);
         glm::vec3 accPosition(0,0,0);
         for(int atomIndex : atomIndices)
         {
-            accPosition += pGPUProtein->getTrajectory()->at(frame).at(atomIndex);
+            accPosition += positions.at(atomIndex);
         }
 
         // Calculate average
@@ -5,7 +5,10 @@
 #include "SurfaceDynamicsVisualization.h"
 #include "Utils/OrbitCamera.h"
 #include "ShaderTools/Renderer.h"
-#include "Molecule/MDtrajLoader/MdTraj/MdTrajWrapper.h"
+#include "Molecule/MDtrajLoader/Pdb/PdbParser.h"
+#include "Molecule/MDtrajLoader/Xtc/XtcReader.h"
+#include "Molecule/MDtrajLoader/Trajectory/TrajectoryCache.h"
+#include "Molecule/MDtrajLoader/Trajectory/FrameProvider.h"
 #include "Molecule/MDtrajLoader/Data/Protein.h"
 #include "SimpleLoader.h"
 #include "imgui/imgui.h"
@@ -14,6 +17,8 @@
 #include <glm/gtx/component_wise.hpp>
 #include <sstream>
 #include <iomanip>
+#include <fstream>
+#include <thread>
 
 // stb_image wants those defines
 #define STB_IMAGE_IMPLEMENTATION
@@ -22,6 +27,138 @@
 // Namespace for text-csv
 namespace csv = ::text::csv;
 
+// ### Molecule loading ###
+
+// Frames of the trajectory are kept in a window of that size and read ahead by that count while going through them
+const size_t frameWindowBytes = 1024 * 1024 * 1024;
+const int framePrefetchCount = 16;
+
+// Trajectories whose frames would take more than that in the cache are not cached, writing it would stall the first load
+const size_t frameCacheBytes = (size_t)4 * 1024 * 1024 * 1024;
+
+// Molecule is read natively, the pdb positions stay the first frame like with mdtraj
+PdbStructure parseMolecule(std::string filepathPDB)
+{
+    PdbParser parser;
+    PdbStructure structure;
+    if(!parser.parse(filepathPDB, structure))
+    {
+        Logger::instance().print("Could not load molecule " + filepathPDB, Logger::Mode::ERROR);
+        std::exit(1);
+    }
+    structure.positions.setNumberOfFrames(1);
+    return structure;
+}
+
+// Protein named after the pdb file
+std::unique_ptr<Protein> createProtein(std::string filepathPDB, PdbStructure& rStructure)
+{
+    PdbParser parser;
+    std::string filename = filepathPDB.substr(filepathPDB.find_last_of("\\/") + 1);
+    return std::unique_ptr<Protein>(parser.createProtein(rStructure, filename.substr(0, filename.find_last_of("."))).release());
+}
+
+// Frames of the molecule followed by those of the trajectory, which are decoded when queried. A trajectory that
+// does not fit the molecule is rejected and only the frames of the molecule are returned
+std::shared_ptr<FrameProvider> openFrames(const PdbStructure& rStructure, std::unique_ptr<MappedTrajectory> upTrajectory, std::unique_ptr<XtcReader> upReader, bool& rRejected)
+{
+    int atomCount = rStructure.getNumberOfAtoms();
+    int trajectoryAtomCount = upTrajectory ? upTrajectory->getNumberOfAtoms() : (upReader ? upReader->getNumberOfAtoms() : atomCount);
+    rRejected = trajectoryAtomCount != atomCount;
+    if(rRejected)
+    {
+        Logger::instance().print("Trajectory has " + std::to_string(trajectoryAtomCount) + " atoms but molecule "
+            + std::to_string(atomCount) + ", only the pdb file is loaded", Logger::Mode::WARNING);
+        upTrajectory.reset();
+        upReader.reset();
+    }
+    int windowSize = (int)std::max((size_t)1, frameWindowBytes / (std::max(1, atomCount) * sizeof(glm::vec3)));
+    if(upReader)
+    {
+        return std::make_shared<WindowedFrameProvider>(rStructure.positions, std::move(upReader), windowSize, framePrefetchCount);
+    }
+    return std::make_shared<WindowedFrameProvider>(rStructure.positions, std::move(upTrajectory), windowSize, framePrefetchCount);
+}
+
+// Frames of dcd and trr files are read from the mapped file, those of xtc files are decoded by a reader.
+// The trajectory is rejected when it can not be opened or does not fit the molecule
+std::shared_ptr<FrameProvider> openTrajectory(const PdbStructure& rStructure, std::string filepathXTC, bool& rRejected)
+{
+    std::unique_ptr<MappedTrajectory> upTrajectory;
+    std::unique_ptr<XtcReader> upReader;
+    if(MappedTrajectory::isSupported(filepathXTC))
+    {
+        upTrajectory = MappedTrajectory::openFile(filepathXTC);
+    }
+    else if(!filepathXTC.empty())
+    {
+        upReader = std::unique_ptr<XtcReader>(new XtcReader);
+        if(!upReader->open(filepathXTC)) { upReader.reset(); }
+    }
+    bool opened = filepathXTC.empty() || upTrajectory || upReader;
+    if(!opened)
+    {
+        Logger::instance().print("Could not open trajectory " + filepathXTC + ", only the pdb file is loaded", Logger::Mode::WARNING);
+    }
+    std::shared_ptr<FrameProvider> spFrames = openFrames(rStructure, std::move(upTrajectory), std::move(upReader), rRejected);
+    rRejected = rRejected || !opened;
+    return spFrames;
+}
+
+// Fills rStructure with the topology and returns the frames. Those come from the binary cache next to the input,
+// which is written from the trajectory when missing or outdated. If the trajectory was rejected, is too large for
+// the cache or the cache can not be written, they come from the trajectory
+std::shared_ptr<FrameProvider> loadFrames(std::string filepathPDB, std::string filepathXTC, PdbStructure& rStructure)
+{
+    std::string cachePath = TrajectoryCache::getCachePath(filepathPDB, filepathXTC);
+    std::unique_ptr<TrajectoryCache> upCache(new TrajectoryCache);
+    if(upCache->open(cachePath) && upCache->matches(filepathPDB, filepathXTC))
+    {
+        Logger::instance().print("Using cache " + cachePath);
+    }
+    else
+    {
+        upCache->close();
+        rStructure = parseMolecule(filepathPDB);
+        bool rejected = false;
+        std::shared_ptr<FrameProvider> spFrames = openTrajectory(rStructure, filepathXTC, rejected);
+        if(rejected)
+        {
+            return spFrames;
+        }
+        size_t cacheBytes = (size_t)spFrames->getNumberOfFrames() * spFrames->getNumberOfAtoms() * sizeof(glm::vec3);
+        std::string cacheMegabytes = std::to_string(cacheBytes / (1024 * 1024)) + " MB";
+        if(cacheBytes > frameCacheBytes)
+        {
+            Logger::instance().print("Trajectory would take " + cacheMegabytes + " in the cache, it is read without cache", Logger::Mode::WARNING);
+            return spFrames;
+        }
+        Logger::instance().print("Writing cache " + cachePath + " of " + cacheMegabytes);
+        if(!TrajectoryCache::write(cachePath, filepathPDB, filepathXTC, rStructure, spFrames.get()) || !upCache->open(cachePath))
+        {
+            return spFrames;
+        }
+    }
+    rStructure = upCache->getStructure();
+    bool rejected = false;
+    return openFrames(rStructure, std::unique_ptr<MappedTrajectory>(upCache.release()), std::unique_ptr<XtcReader>(), rejected);
+}
+
+// Protein with all frames of the trajectory, which are written into its trajectory one after another
+std::unique_ptr<Protein> loadMolecule(std::string filepathPDB, std::string filepathXTC)
+{
+    PdbStructure structure;
+    std::shared_ptr<FrameProvider> spFrames = loadFrames(filepathPDB, filepathXTC, structure);
+    int frameCount = spFrames->getNumberOfFrames();
+    structure.positions.setNumberOfFrames(frameCount);
+    for(int i = 1; i < frameCount; i++)
+    {
+        auto positions = spFrames->getFrame(i);
+        std::copy(positions.begin(), positions.end(), structure.positions.getFrame(i));
+    }
+    return createProtein(filepathPDB, structure);
+}
+
 // ### Class implementation ###
 
 SurfaceDynamicsVisualization::SurfaceDynamicsVisualization(std::string filepathPDB, std::string filepathXTC)
@@ -114,12 +251,12 @@ SurfaceDynamicsVisualization::SurfaceDynamicsVisualization(std::string filepathP
 
     // Loading molecule
     Logger::instance().print("Import molecule..");
-    MdTrajWrapper mdwrap;
-    std::vector<std::string> paths;
-    paths.push_back(mPDBFilepath);
-    if(!mXTCFilepath.empty()) { paths.push_back(mXTCFilepath); }
-    std::unique_ptr<Protein> upProtein = std::move(mdwrap.load(paths));
-    mupGPUProtein = std::unique_ptr<GPUProtein>(new GPUProtein(upProtein.get()));
+    PdbStructure structure;
+    std::shared_ptr<FrameProvider> spFrames = loadFrames(mPDBFilepath, mXTCFilepath, structure);
+
+    // Frames go from the provider into the GPU protein when needed, not through the atoms of the protein
+    std::unique_ptr<Protein> upProtein = createProtein(mPDBFilepath, structure);
+    mupGPUProtein = std::unique_ptr<GPUProtein>(new GPUProtein(upProtein.get(), spFrames));
     Logger::instance().print("..done");
 
     // # Prepare framebuffers for rendering
@@ -537,11 +674,11 @@ void SurfaceDynamicsVisualization::renderLoop()
                 outlineProgram.use();
                 outlineProgram.update("view", mupCamera->getViewMatrix());
                 outlineProgram.update("projection", mupCamera->getProjectionMatrix());
-                outlineProgram.update("frame", mFrame);
+                outlineProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
                 outlineProgram.update("atomCount", mupGPUProtein->getAtomCount());
                 outlineProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
                 outlineProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-                outlineProgram.update("frameCount", mupGPUProtein->getFrameCount());
+                outlineProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
                 outlineProgram.update("outlineColor", mOutlineColor);
                 outlineProgram.update("localFrame", mFrame - mComputedStartFrame);
                 outlineProgram.update("ascensionChangeRadiusMultiplier", mAscensionChangeRadiusMultiplier);
@@ -583,11 +720,11 @@ void SurfaceDynamicsVisualization::renderLoop()
                 surfaceMarksProgram.update("view", mupCamera->getViewMatrix());
                 surfaceMarksProgram.update("projection", mupCamera->getProjectionMatrix());
                 surfaceMarksProgram.update("clippingPlane", mClippingPlane);
-                surfaceMarksProgram.update("frame", mFrame);
+                surfaceMarksProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
                 surfaceMarksProgram.update("atomCount", mupGPUProtein->getAtomCount());
                 surfaceMarksProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
                 surfaceMarksProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-                surfaceMarksProgram.update("frameCount", mupGPUProtein->getFrameCount());
+                surfaceMarksProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
                 surfaceMarksProgram.update("color", glm::vec4(mSurfaceAtomColor, 1.f));
                 glDrawArrays(GL_POINTS, 0, mGPUSurfaces.at(mFrame - mComputedStartFrame)->getCountOfSurfaceAtoms(mLayer));
             }
@@ -737,11 +874,11 @@ void SurfaceDynamicsVisualization::renderLoop()
                 hullProgram.update("lightDir", mLightDirection);
                 hullProgram.update("selectedIndex", selectedAtom);
                 hullProgram.update("clippingPlane", mClippingPlane);
-                hullProgram.update("frame", mFrame);
+                hullProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
                 hullProgram.update("atomCount", mupGPUProtein->getAtomCount());
                 hullProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
                 hullProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-                hullProgram.update("frameCount", mupGPUProtein->getFrameCount());
+                hullProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
                 hullProgram.update("depthDarkeningStart", mDepthDarkeningStart);
                 hullProgram.update("depthDarkeningEnd", mDepthDarkeningEnd);
                 hullProgram.update("selectionColor", mSelectionColor);
@@ -782,11 +919,11 @@ void SurfaceDynamicsVisualization::renderLoop()
                 ascensionProgram.update("lightDir", mLightDirection);
                 ascensionProgram.update("selectedIndex", selectedAtom);
                 ascensionProgram.update("clippingPlane", mClippingPlane);
-                ascensionProgram.update("frame", mFrame);
+                ascensionProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
                 ascensionProgram.update("atomCount", mupGPUProtein->getAtomCount());
                 ascensionProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
                 ascensionProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-                ascensionProgram.update("frameCount", mupGPUProtein->getFrameCount());
+                ascensionProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
                 ascensionProgram.update("depthDarkeningStart", mDepthDarkeningStart);
                 ascensionProgram.update("depthDarkeningEnd", mDepthDarkeningEnd);
                 ascensionProgram.update("localFrame", mFrame - mComputedStartFrame);
@@ -815,11 +952,11 @@ void SurfaceDynamicsVisualization::renderLoop()
                 coloringProgram.update("lightDir", mLightDirection);
                 coloringProgram.update("selectedIndex", selectedAtom);
                 coloringProgram.update("clippingPlane", mClippingPlane);
-                coloringProgram.update("frame", mFrame);
+                coloringProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
                 coloringProgram.update("atomCount", mupGPUProtein->getAtomCount());
                 coloringProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
                 coloringProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-                coloringProgram.update("frameCount", mupGPUProtein->getFrameCount());
+                coloringProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
                 coloringProgram.update("depthDarkeningStart", mDepthDarkeningStart);
                 coloringProgram.update("depthDarkeningEnd", mDepthDarkeningEnd);
                 coloringProgram.update("selectionColor", mSelectionColor);
@@ -861,11 +998,11 @@ void SurfaceDynamicsVisualization::renderLoop()
                 coloringProgram.update("lightDir", mLightDirection);
                 coloringProgram.update("selectedIndex", selectedAtom);
                 coloringProgram.update("clippingPlane", mClippingPlane);
-                coloringProgram.update("frame", mFrame);
+                coloringProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
                 coloringProgram.update("atomCount", mupGPUProtein->getAtomCount());
                 coloringProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
                 coloringProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-                coloringProgram.update("frameCount", mupGPUProtein->getFrameCount());
+                coloringProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
                 coloringProgram.update("depthDarkeningStart", mDepthDarkeningStart);
                 coloringProgram.update("depthDarkeningEnd", mDepthDarkeningEnd);
                 coloringProgram.update("selectionColor", mSelectionColor);
@@ -907,11 +1044,11 @@ void SurfaceDynamicsVisualization::renderLoop()
                 analysisProgram.update("lightDir", mLightDirection);
                 analysisProgram.update("selectedIndex", selectedAtom);
                 analysisProgram.update("clippingPlane", mClippingPlane);
-                analysisProgram.update("frame", mFrame);
+                analysisProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
                 analysisProgram.update("atomCount", mupGPUProtein->getAtomCount());
                 analysisProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
                 analysisProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-                analysisProgram.update("frameCount", mupGPUProtein->getFrameCount());
+                analysisProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
                 analysisProgram.update("depthDarkeningStart", mDepthDarkeningStart);
                 analysisProgram.update("depthDarkeningEnd", mDepthDarkeningEnd);
                 analysisProgram.update("groupAtomCount", (int)mupOutlineAtomIndices->getSize());
@@ -940,11 +1077,11 @@ void SurfaceDynamicsVisualization::renderLoop()
                     hullProgram.update("lightDir", mLightDirection);
                     hullProgram.update("selectedIndex", selectedAtom);
                     hullProgram.update("clippingPlane", mClippingPlane);
-                    hullProgram.update("frame", mFrame);
+                    hullProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
                     hullProgram.update("atomCount", mupGPUProtein->getAtomCount());
                     hullProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
                     hullProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-                    hullProgram.update("frameCount", mupGPUProtein->getFrameCount());
+                    hullProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
                     hullProgram.update("depthDarkeningStart", mDepthDarkeningStart);
                     hullProgram.update("depthDarkeningEnd", mDepthDarkeningEnd);
                     hullProgram.update("selectionColor", mSelectionColor);
@@ -987,11 +1124,11 @@ void SurfaceDynamicsVisualization::renderLoop()
                 residueRSPPeelProgram.update("lightDir", mLightDirection);
                 residueRSPPeelProgram.update("selectedIndex", selectedAtom);
                 residueRSPPeelProgram.update("clippingPlane", mClippingPlane);
-                residueRSPPeelProgram.update("frame", mFrame);
+                residueRSPPeelProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
                 residueRSPPeelProgram.update("atomCount", mupGPUProtein->getAtomCount());
                 residueRSPPeelProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
                 residueRSPPeelProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-                residueRSPPeelProgram.update("frameCount", mupGPUProtein->getFrameCount());
+                residueRSPPeelProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
                 residueRSPPeelProgram.update("depthDarkeningStart", mDepthDarkeningStart);
                 residueRSPPeelProgram.update("depthDarkeningEnd", mDepthDarkeningEnd);
                 residueRSPPeelProgram.update("selectionColor", mSelectionColor);
@@ -1050,11 +1187,11 @@ void SurfaceDynamicsVisualization::renderLoop()
             fallbackProgram.update("lightDir", mLightDirection);
             fallbackProgram.update("selectedIndex", selectedAtom);
             fallbackProgram.update("clippingPlane", mClippingPlane);
-            fallbackProgram.update("frame", mFrame);
+            fallbackProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
             fallbackProgram.update("atomCount", mupGPUProtein->getAtomCount());
             fallbackProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
             fallbackProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-            fallbackProgram.update("frameCount", mupGPUProtein->getFrameCount());
+            fallbackProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
             fallbackProgram.update("depthDarkeningStart", mDepthDarkeningStart);
             fallbackProgram.update("depthDarkeningEnd", mDepthDarkeningEnd);
             fallbackProgram.update("color", mFallbackAtomColor);
@@ -1101,11 +1238,11 @@ void SurfaceDynamicsVisualization::renderLoop()
             selectionProgram.update("probeRadius", mRenderWithProbeRadius ? mComputedProbeRadius : 0.f);
             selectionProgram.update("lightDir", mLightDirection);
             selectionProgram.update("clippingPlane", mClippingPlane);
-            selectionProgram.update("frame", mFrame);
+            selectionProgram.update("frame", mupGPUProtein->makeResident(mFrame, mSmoothAnimationRadius));
             selectionProgram.update("atomCount", mupGPUProtein->getAtomCount());
             selectionProgram.update("smoothAnimationRadius", mSmoothAnimationRadius);
             selectionProgram.update("smoothAnimationMaxDeviation", mSmoothAnimationMaxDeviation);
-            selectionProgram.update("frameCount", mupGPUProtein->getFrameCount());
+            selectionProgram.update("frameCount", mupGPUProtein->getResidentFrameCount());
             selectionProgram.update("depthDarkeningStart", mDepthDarkeningStart);
             selectionProgram.update("depthDarkeningEnd", mDepthDarkeningEnd);
             selectionProgram.update("color", mSelectionColor);
@@ -1503,6 +1640,13 @@ void SurfaceDynamicsVisualization::renderGUI()
         {
             ImGui::SliderInt("Atom Sample Count", &mHullSampleCount, 0, 1000);
             if(ImGui::IsItemHovered() && mShowTooltips) { ImGui::SetTooltip("Count of samples per atom used for analysis purposes, not surface extraction."); }
+            ImGui::Checkbox("Adaptive##hullsamples", &mAdaptiveHullSampling);
+            if(ImGui::IsItemHovered() && mShowTooltips) { ImGui::SetTooltip("Distribute samples to partially buried atoms. Atom sample count is then the average."); }
+            if(mAdaptiveHullSampling)
+            {
+                ImGui::SliderInt("Pilot Sample Count", &mHullPilotSampleCount, 1, mHullSampleCount > 1 ? mHullSampleCount : 1);
+                if(ImGui::IsItemHovered() && mShowTooltips) { ImGui::SetTooltip("Count of samples per atom used to estimate variance of exposed fraction."); }
+            }
 
             // Recomputation of hull samples only when there are frames with surface extracted
             if(mComputedStartFrame >= 0)
@@ -1605,10 +1749,11 @@ void SurfaceDynamicsVisualization::renderGUI()
                 if(ImGui::Button("Center Analysis Group", ImVec2(208, 22)))
                 {
                     // Average centers of atoms in analysis group
+                    auto positions = mupGPUProtein->getFrame(mFrame);
                     glm::vec3 avgCenter(0,0,0);
                     for(GLuint atomIndex : mAnalyseGroup)
                     {
-                        avgCenter += mupGPUProtein->getTrajectory()->at(mFrame).at(atomIndex);
+                        avgCenter += positions.at(atomIndex);
                     }
 
                     // Applied for next frame
@@ -1941,7 +2086,8 @@ void SurfaceDynamicsVisualization::renderGUI()
                     mSurfaceValidationSeed,
                     mSurfaceValidationAtomSampleCount,
                     mValidationInformation,
-                    std::vector<GLuint>());
+                    std::vector<GLuint>(),
+                    mCPUThreads);
             }
         }
         else
@@ -2743,17 +2889,37 @@ void SurfaceDynamicsVisualization::computeLayers(bool useGPU)
 void SurfaceDynamicsVisualization::computeHullSamples()
 {
     // Compute hull samples
-    mupHullSamples->compute(
-        mupGPUProtein.get(),
-        &mGPUSurfaces,
-        mComputationStartFrame,
-        mComputationProbeRadius,
-        mHullSampleCount,
-        0,
-        [this](float progress) // [0,1]
-        {
-            this->setProgressDisplay("Hull Samples", progress);
-        });
+    if(mAdaptiveHullSampling)
+    {
+        // Average count of samples per atom defines budget
+        mupHullSamples->computeAdaptive(
+            mupGPUProtein.get(),
+            &mGPUSurfaces,
+            mComputationStartFrame,
+            mComputationProbeRadius,
+            mHullSampleCount * mupGPUProtein->getAtomCount(),
+            mHullPilotSampleCount,
+            mHullMaxSampleCount,
+            0,
+            [this](float progress) // [0,1]
+            {
+                this->setProgressDisplay("Hull Samples", progress);
+            });
+    }
+    else
+    {
+        mupHullSamples->compute(
+            mupGPUProtein.get(),
+            &mGPUSurfaces,
+            mComputationStartFrame,
+            mComputationProbeRadius,
+            mHullSampleCount,
+            0,
+            [this](float progress) // [0,1]
+            {
+                this->setProgressDisplay("Hull Samples", progress);
+            });
+    }
 
     // Update analysis which depends on hull samples
     updateGlobalAnalysis();
@@ -2916,7 +3082,7 @@ float SurfaceDynamicsVisualization::approximateSurfaceArea(std::vector<GLuint> i
         const float radius = mupGPUProtein->getRadii()->at(index);
         const float extendedRadius = radius + mComputedProbeRadius;
         const float atomSurface = 4.f * glm::pi<float>() * extendedRadius * extendedRadius;
-        surface += atomSurface * ((float)mupHullSamples->getSurfaceSampleCount(frame, index) / (float)mupHullSamples->getSampleCount());
+        surface += atomSurface * ((float)mupHullSamples->getSurfaceSampleCount(frame, index) / (float)glm::max(mupHullSamples->getSampleCountOfAtom(index), 1));
     }
 
     return surface;
@@ -2925,12 +3091,7 @@ float SurfaceDynamicsVisualization::approximateSurfaceArea(std::vector<GLuint> i
 void SurfaceDynamicsVisualization::updateGlobalAnalysis()
 {
     // Surface amount of molecule
-    auto sampleCounts = mupHullSamples->getSurfaceSampleCount();
-    mAnalysisSurfaceAmount = std::vector<float>(sampleCounts.size(), -1);
-    for(int i = 0; i < sampleCounts.size(); i++)
-    {
-        mAnalysisSurfaceAmount.at(i) = (float)sampleCounts.at(i) / (float)mupHullSamples->getProteinSampleCount();
-    }
+    mAnalysisSurfaceAmount = mupHullSamples->getSurfaceAmount();
 
     // Surface area of molecule
     mAnalysisSurfaceArea = std::vector<float>(mGPUSurfaces.size(), -1);
@@ -2984,16 +3145,18 @@ void SurfaceDynamicsVisualization::updateGroupAnalysis()
         // Relative frame
         int relativeFrame = frame - mComputedStartFrame;
 
-        // Accumulate sample count
-        float surfaceSampleCount = 0;
+        // Accumulate exposed fraction of atoms (count of samples may differ per atom)
+        float surfaceAmount = 0;
         for(GLuint atomIndex : mAnalyseGroup)
         {
             // Surface amount for group in that frame for that atom
-            surfaceSampleCount += (float)mupHullSamples->getSurfaceSampleCount(frame, atomIndex);
+            surfaceAmount +=
+                (float)mupHullSamples->getSurfaceSampleCount(frame, atomIndex)
+                / (float)glm::max(mupHullSamples->getSampleCountOfAtom(atomIndex), 1);
         }
 
         // Save surface amount of group for that frame
-        mAnalysisGroupSurfaceAmount.at(relativeFrame) = surfaceSampleCount / (float)mupHullSamples->getSampleCount(mAnalyseGroup.size());
+        mAnalysisGroupSurfaceAmount.at(relativeFrame) = surfaceAmount / (float)mAnalyseGroup.size();
 
         // Save surface area
         mAnalysisGroupSurfaceArea.at(relativeFrame) = approximateSurfaceArea(std::vector<GLuint>(mAnalyseGroup.begin(), mAnalyseGroup.end()), frame);
@@ -3211,24 +3374,134 @@ void SurfaceDynamicsVisualization::resetPath(std::string& rPath, std::string app
     rPath = path;
 }
 
+// ### Headless validation ###
+
+int validateHeadless(
+    std::string filepathPDB,
+    std::string filepathXTC,
+    std::string filepathReport,
+    float probeRadius,
+    int samplesPerAtomCount,
+    unsigned int sampleSeed,
+    int threadCount)
+{
+    // Loading molecule without OpenGL
+    Logger::instance().print("Import molecule..");
+    std::unique_ptr<Protein> upProtein = loadMolecule(filepathPDB, filepathXTC);
+    std::shared_ptr<const Trajectory> spTrajectory = upProtein->getTrajectory();
+    int frameCount = spTrajectory->getNumberOfFrames();
+    std::vector<float> radii = upProtein->getRadii();
+    Logger::instance().print("..done");
+
+    // Validate all frames and layers
+    Logger::instance().print("Validate " + std::to_string(frameCount) + " frames..");
+    std::vector<SurfaceValidation::LayerResult> results = SurfaceValidation::validateTrajectory(
+        *spTrajectory,
+        radii,
+        0,
+        frameCount - 1,
+        probeRadius,
+        sampleSeed,
+        samplesPerAtomCount,
+        threadCount);
+    Logger::instance().print("..done");
+
+    // Write report
+    std::string report = SurfaceValidation::createReport(results);
+    if(filepathReport.empty() || filepathReport == "-")
+    {
+        std::cout << report;
+    }
+    else
+    {
+        std::ofstream file(filepathReport);
+        file << report;
+        Logger::instance().print("Report written to: " + filepathReport);
+    }
+
+    // Exit code indicates whether surface extraction has failed
+    bool failed = SurfaceValidation::failed(results);
+    Logger::instance().print(failed ? "Validation failed!" : "Validation passed.", failed ? Logger::Mode::ERROR : Logger::Mode::LOG);
+    return failed ? 1 : 0;
+}
+
 // ### Main function ###
+
+void printValidationUsage()
+{
+    Logger::instance().print("Add --validate <report.csv> [--probe <radius>] [--samples <count>] [--seed <seed>] [--threads <count>] for headless validation");
+}
+
 int main(int argc, char* argv[])
 {
     if(argc < 2)
     {
         Logger::instance().print("Please give PDB and optional XTC file as argument");
+        printValidationUsage();
     }
     else
     {
         // Extract files to load
         std::string filepathPDB = argv[1];
         std::string filepathXTC;
-        if(argc >= 3)
+        int argIndex = 2;
+        if(argc >= 3 && std::string(argv[2]).find("--") != 0)
         {
             filepathXTC = argv[2];
+            argIndex = 3;
         }
 
-        // Create application and enter loop
+        // Extract options for headless validation
+        bool validation = false;
+        std::string filepathReport;
+        float probeRadius = 1.4f;
+        int samplesPerAtomCount = 20;
+        unsigned int sampleSeed = 0;
+        int threadCount = glm::max((int)std::thread::hardware_concurrency(), 1);
+        for(; argIndex < argc; argIndex++)
+        {
+            std::string option = argv[argIndex];
+            std::string value = (argIndex + 1 < argc) ? argv[argIndex + 1] : "";
+
+            // Options with value must not take the next option as value
+            bool valueOption = option == "--validate" || option == "--probe" || option == "--samples" || option == "--seed" || option == "--threads";
+            if(valueOption && (value.empty() || value.find("--") == 0))
+            {
+                Logger::instance().print("Missing value for option " + option, Logger::Mode::ERROR);
+                printValidationUsage();
+                return 1;
+            }
+            try
+            {
+                if(option == "--validate") { validation = true; filepathReport = value; argIndex++; }
+                else if(option == "--probe") { probeRadius = std::stof(value); argIndex++; }
+                else if(option == "--samples") { samplesPerAtomCount = std::stoi(value); argIndex++; }
+                else if(option == "--seed") { sampleSeed = (unsigned int)std::stoul(value); argIndex++; }
+                else if(option == "--threads") { threadCount = std::stoi(value); argIndex++; }
+                else { Logger::instance().print("Unknown option: " + option, Logger::Mode::WARNING); }
+            }
+            catch(const std::exception&)
+            {
+                // Conversion of value failed or value is out of range
+                Logger::instance().print("Invalid value for option " + option + ": " + value, Logger::Mode::ERROR);
+                printValidationUsage();
+                return 1;
+            }
+        }
+
+        // Atoms are only validated with at least one sample each
+        if(samplesPerAtomCount < 1)
+        {
+            Logger::instance().print("Count of samples must be at least one", Logger::Mode::ERROR);
+            printValidationUsage();
+            return 1;
+        }
+
+        // Validate without window or create application and enter loop
+        if(validation)
+        {
+            return validateHeadless(filepathPDB, filepathXTC, filepathReport, probeRadius, samplesPerAtomCount, sampleSeed, threadCount);
+        }
         SurfaceDynamicsVisualization detection(filepathPDB, filepathXTC);
         detection.renderLoop();
     }
@@ -154,6 +154,7 @@ private:
     const bool mFrameLogging = false;
     const std::string mNoComputedFrameMessage = "Frame was not computed.";
     const GLuint mKBufferLayerCount = 32; // remember to adapt value in shaders as well
+    const int mHullMaxSampleCount = 4000; // maximum sample count per atom for adaptive sampling
 
     // Colors for rendering layers (outer to inner, repeating if too many)
     const std::vector<glm::vec3> mLayerColors =
@@ -207,7 +208,9 @@ private:
     int mPathSmoothRadius = 0; // radius of frames which are used for smoothing the path
     Rendering mRendering = HULL;
     Background mBackground = WHITE;
-    int mHullSampleCount = 250; // sample count per atom
+    int mHullSampleCount = 250; // sample count per atom (average when adaptive)
+    bool mAdaptiveHullSampling = false;
+    int mHullPilotSampleCount = 32; // sample count per atom of pilot run for adaptive sampling
     bool mRenderHullSamples = false;
     bool mRenderOutline = true;
     bool mShowTooltips = true;
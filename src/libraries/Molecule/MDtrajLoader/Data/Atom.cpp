@@ -2,10 +2,9 @@
 
 #include "Atom.h"
 
-Atom::Atom(std::string name, std::string element, int index, glm::vec3 position, std::string aminoDistinctAcid, std::string amino, Protein* parent) :
-name_(name), element_(element), index_(index), aminoDistinctAcid_(aminoDistinctAcid), amino_(amino), pParent_(parent)
+Atom::Atom(std::string name, std::string element, int index, Trajectory* pTrajectory, int position, std::string aminoDistinctAcid, std::string amino, Protein* parent) :
+name_(name), element_(element), index_(index), aminoDistinctAcid_(aminoDistinctAcid), amino_(amino), pTrajectory_(pTrajectory), position_(position), pParent_(parent)
 {
-    positions_.push_back(position);
 }
 
 Atom::~Atom()
@@ -34,39 +33,35 @@ std::string Atom::getDistinctResidue() {
 }
 
 glm::vec3 Atom::getPosition() const{
-    return positions_.at(0);
+    return pTrajectory_->getPosition(0, position_);
 }
 
 glm::vec3 Atom::getPositionAtFrame(int i) {
-    return positions_.at(i);
+    return pTrajectory_->getPosition(i, position_);
 }
 
 float Atom::getX() {
-    return positions_.at(0).x;
+    return pTrajectory_->getPosition(0, position_).x;
 }
 
 float Atom::getY() {
-    return positions_.at(0).y;
+    return pTrajectory_->getPosition(0, position_).y;
 }
 
 float Atom::getZ() {
-    return positions_.at(0).z;
+    return pTrajectory_->getPosition(0, position_).z;
 }
 
 float Atom::getXAtFrame(int i) {
-    return positions_.at(i).x;
+    return pTrajectory_->getPosition(i, position_).x;
 }
 
 float Atom::getYAtFrame(int i) {
-    return positions_.at(i).y;
+    return pTrajectory_->getPosition(i, position_).y;
 }
 
 float Atom::getZAtFrame(int i) {
-    return positions_.at(i).z;
-}
-
-void Atom::setNextPosition(glm::vec3 pos) {
-    positions_.push_back(pos);
+    return pTrajectory_->getPosition(i, position_).z;
 }
 
 void Atom::addBondPartner(Atom* partner)
@@ -81,32 +76,32 @@ std::vector<Atom*> Atom::getBondPartners()
 
 int Atom::getCountOfFrames() const
 {
-    return positions_.size();
+    return pTrajectory_->getNumberOfFrames();
 }
 
 void Atom::setX(float x)
 {
-    positions_.at(0).x = x;
+    pTrajectory_->getFrame(0)[position_].x = x;
 }
 
 void Atom::setY(float y)
 {
-    positions_.at(0).y = y;
+    pTrajectory_->getFrame(0)[position_].y = y;
 }
 
 void Atom::setZ(float z)
 {
-    positions_.at(0).z = z;
+    pTrajectory_->getFrame(0)[position_].z = z;
 }
 
 void Atom::setXYZ(glm::vec3 xyz)
 {
-    positions_.at(0) = xyz;
+    pTrajectory_->setPosition(0, position_, xyz);
 }
 
 void Atom::setXYZat(int frame, glm::vec3 xyz)
 {
-    positions_.at(frame) = xyz;
+    pTrajectory_->setPosition(frame, position_, xyz);
 }
 
 Protein* Atom::getProteinParent() {
@@ -5,12 +5,17 @@
 #include <vector>
 #include <string>
 #include <glm/ext.hpp>
+#include "Trajectory.h"
 
 class Protein;
 class Atom
 {
 public:
-    Atom(std::string name, std::string element, int index, glm::vec3 position, std::string aminoDistinctAcid, std::string amino, Protein* parent);
+    /**
+    @brief positions of the atom are not copied but viewed in the trajectory of its protein
+    @param [in] trajectory of the protein, position is the index of the atom in its frames
+    */
+    Atom(std::string name, std::string element, int index, Trajectory* pTrajectory, int position, std::string aminoDistinctAcid, std::string amino, Protein* parent);
     ~Atom();
 
     /**
@@ -104,8 +109,6 @@ public:
     void setXYZ(glm::vec3 xyz);
     void setXYZat(int frame, glm::vec3 xyz);
 
-    void setNextPosition(glm::vec3 pos);
-
     //void setActor(AAtom_Actor* a);
 
     void addBondPartner(Atom*);
@@ -125,7 +128,8 @@ private:
     std::string amino_; //the amino where it belongs to e.g. MET
     std::string aminoDistinctAcid_; // the disting amino where it belongs to e.g. MET1
 
-    std::vector<glm::vec3> positions_; //every position per frame, [0] is pdb and [1] starts first frame
+    Trajectory* pTrajectory_; //every position per frame, [0] is pdb and [1] starts first frame
+    int position_; //index of the atom in every frame of the trajectory
 
     std::vector<Atom*> bonds_; //all bonded partners
     //AAtom_Actor* pActor_;
@@ -17,6 +17,24 @@ AtomLUT::radiiMap AtomLUT::vdW_radii_picometer = {
     {"xenon",216 }, {"zinc",139 }
 };
 
+AtomLUT::nameMap AtomLUT::element_names = {
+    {"AL", "aluminium"}, {"SB", "antimony"}, {"AR", "argon"}, {"AS", "arsenic"},
+    {"AT", "astatine"}, {"BA", "barium"}, {"BE", "beryllium"}, {"BI", "bismuth"},
+    {"B", "boron"}, {"BR", "bromine"}, {"CD", "cadmium"}, {"CS", "caesium"},
+    {"CA", "calcium"}, {"C", "carbon"}, {"CL", "chlorine"}, {"CU", "copper"},
+    {"F", "fluorine"}, {"FR", "francium"}, {"GA", "gallium"}, {"GE", "germanium"},
+    {"AU", "gold"}, {"HE", "helium"}, {"H", "hydrogen"}, {"IN", "indium"},
+    {"I", "iodine"}, {"KR", "krypton"}, {"PB", "lead"}, {"MG", "magnesium"},
+    {"HG", "mercury"}, {"NE", "neon"}, {"NI", "nickel"}, {"N", "nitrogen"},
+    {"O", "oxygen"}, {"PD", "palladium"}, {"P", "phosphorus"}, {"PT", "platinum"},
+    {"PO", "polonium"}, {"K", "potassium"}, {"RA", "radium"}, {"RN", "radon"},
+    {"RB", "rubidium"}, {"SC", "scandium"}, {"SE", "selenium"}, {"SI", "silicon"},
+    {"AG", "silver"}, {"NA", "sodium"}, {"SR", "strontium"}, {"S", "sulfur"},
+    {"TE", "tellurium"}, {"TL", "thallium"}, {"SN", "tin"}, {"U", "uranium"},
+    {"XE", "xenon"}, {"ZN", "zinc"}, {"TI", "titanium"}, {"FE", "iron"},
+    {"MN", "manganese"}, {"CO", "cobalt"}, {"LI", "lithium"}, {"D", "hydrogen"}
+};
+
 AtomLUT::colorMap AtomLUT::cpk_colorcode = {
     {"hydrogen", AtomLUT::color{1.f, 1.f, 1.f}}, {"carbon", AtomLUT::color{200.f/255.f, 200.f/255.f, 200.f/255.f}},
     {"nitrogen", AtomLUT::color{143.f/255.f, 143.f/255.f, 1.f}}, {"oxygen", AtomLUT::color{240.f/255.f, 0.f, 0.f}},
@@ -2,6 +2,7 @@
 #define ATOMLUT_H
 
 #include <map>
+#include <string>
 
 /**
  * @brief The AtomLUT class
@@ -19,7 +20,9 @@ public:
 
     typedef std::map< std::string, int> radiiMap;
     typedef std::map< std::string, color> colorMap;
+    typedef std::map< std::string, std::string> nameMap;
     static radiiMap vdW_radii_picometer;
+    static nameMap element_names; // upper case element symbol to the element names used above
     static colorMap cpk_colorcode;
     static colorMap amino_colorcode;
 
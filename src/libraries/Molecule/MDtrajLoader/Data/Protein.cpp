@@ -5,10 +5,11 @@
 
 Protein::Protein(std::vector<std::string> &names,
                  std::vector<std::string> &elementNames, std::vector<std::string> &residueNames,
-                 std::vector<int> &indices, std::vector<std::string> &bonds, std::vector<std::vector<glm::vec3>> &positions,
+                 std::vector<int> &indices, std::vector<std::string> &bonds, std::shared_ptr<Trajectory> spTrajectory,
                  std::string name, int numAtoms, std::vector<std::string> &distinctResidueNames, std::vector<float> &radii)
 {
     radii_ = radii;
+    trajectory_ = spTrajectory;
     std::string old = distinctResidueNames.at(0);
     std::string newer = distinctResidueNames.at(0);
     std::vector<Atom*> atomVector;
@@ -32,7 +33,7 @@ Protein::Protein(std::vector<std::string> &names,
         distinctResidueNames.at(i);
         std::string tmpstr = distinctResidueNames.at(i);
         std::string amino = tmpstr.substr(0, 3);
-        Atom* a = new Atom(names.at(i), elementNames.at(i), indices.at(i), positions[0][i], distinctResidueNames.at(i), amino, this);
+        Atom* a = new Atom(names.at(i), elementNames.at(i), indices.at(i), trajectory_.get(), i, distinctResidueNames.at(i), amino, this);
 
         Protein::atoms_.push_back(a);
         newer = distinctResidueNames.at(i);
@@ -53,13 +54,6 @@ Protein::Protein(std::vector<std::string> &names,
         aminoAcids.insert(residueNames.at(i));
     }
 
-    // positions per frame
-    for (int i = 0; i < positions[0].size(); i++) {
-        for (int j = 1; j < positions.size();j++) {
-            atoms_[i]->setNextPosition(positions[j][i]);
-        }
-    }
-
     diffAminos_.assign(aminoAcids.begin(), aminoAcids.end());
 
     //setBonds(bonds); //slow
@@ -141,6 +135,11 @@ std::vector<float> Protein::getRadii() const
     return radii_;
 }
 
+std::shared_ptr<Trajectory> Protein::getTrajectory() const
+{
+    return trajectory_;
+}
+
 float Protein::getRadiusAt(int i)
 {
     return radii_.at(i);
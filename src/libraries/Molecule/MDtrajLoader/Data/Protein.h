@@ -8,6 +8,7 @@
 #include <string>
 #include <limits>
 #include <set>
+#include <memory>
 #include <glm/ext.hpp>
 
 /**
@@ -20,7 +21,7 @@ class Protein
 public:
     Protein(std::vector<std::string> &names,
         std::vector<std::string> &elementNames, std::vector<std::string> &residueNames,
-        std::vector<int> &indices, std::vector<std::string> &bonds, std::vector<std::vector<glm::vec3> > &positions,
+        std::vector<int> &indices, std::vector<std::string> &bonds, std::shared_ptr<Trajectory> spTrajectory,
         std::string name, int numAtoms, std::vector<std::string> &distinctResidue, std::vector<float> &radii);
 	~Protein();
 
@@ -52,6 +53,12 @@ public:
     std::vector<float> getRadii() const;
     float getRadiusAt(int i);
 
+    /**
+    @brief positions of all atoms in all frames, shared with the atoms instead of copied
+    @param [out] shared_ptr<Trajectory> trajectory of the Protein
+    */
+    std::shared_ptr<Trajectory> getTrajectory() const;
+
     struct SimpleAtom
     {
         glm::vec3 position;
@@ -106,6 +113,7 @@ protected:
 
     std::vector<Atom*> atoms_; //list of all atoms
     std::vector<float> radii_; // list of all atom radii
+    std::shared_ptr<Trajectory> trajectory_; // positions of all atoms, viewed by the atoms
 
 private:
 
@@ -0,0 +1,128 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#include "Trajectory.h"
+
+#include <stdexcept>
+#include <string>
+
+//-----------------------------------------------------//
+//                      FRAME                          //
+//-----------------------------------------------------//
+TrajectoryFrame::TrajectoryFrame()
+    : m_pPositions(0x0), m_numberOfAtoms(0)
+{
+
+}
+
+TrajectoryFrame::TrajectoryFrame(const glm::vec3* pPositions, int numberOfAtoms, std::shared_ptr<const void> spOwner)
+    : m_spOwner(spOwner), m_pPositions(pPositions), m_numberOfAtoms(pPositions ? numberOfAtoms : 0)
+{
+
+}
+
+TrajectoryFrame::operator bool() const
+{
+    return m_pPositions != 0x0;
+}
+
+int TrajectoryFrame::size() const
+{
+    return m_numberOfAtoms;
+}
+
+const glm::vec3* TrajectoryFrame::data() const
+{
+    return m_pPositions;
+}
+
+const glm::vec3* TrajectoryFrame::begin() const
+{
+    return m_pPositions;
+}
+
+const glm::vec3* TrajectoryFrame::end() const
+{
+    return m_pPositions + m_numberOfAtoms;
+}
+
+const glm::vec3& TrajectoryFrame::operator[](int atom) const
+{
+    return m_pPositions[atom];
+}
+
+const glm::vec3& TrajectoryFrame::at(int atom) const
+{
+    if (atom < 0 || atom >= m_numberOfAtoms) {
+        throw std::out_of_range("atom " + std::to_string(atom) + " is not in frame of " + std::to_string(m_numberOfAtoms) + " atoms");
+    }
+    return m_pPositions[atom];
+}
+
+
+
+//-----------------------------------------------------//
+//                   TRAJECTORY                        //
+//-----------------------------------------------------//
+Trajectory::Trajectory()
+    : m_numberOfAtoms(0)
+{
+
+}
+
+Trajectory::Trajectory(int numberOfAtoms, int numberOfFrames)
+    : m_numberOfAtoms(numberOfAtoms), m_positions((size_t)numberOfAtoms * numberOfFrames)
+{
+
+}
+
+int Trajectory::getNumberOfAtoms() const
+{
+    return m_numberOfAtoms;
+}
+
+int Trajectory::getNumberOfFrames() const
+{
+    return m_numberOfAtoms > 0 ? (int)(m_positions.size() / m_numberOfAtoms) : 0;
+}
+
+void Trajectory::setNumberOfFrames(int numberOfFrames)
+{
+    m_positions.resize((size_t)m_numberOfAtoms * numberOfFrames);
+}
+
+void Trajectory::addFrame(const glm::vec3* pPositions)
+{
+    m_positions.insert(m_positions.end(), pPositions, pPositions + m_numberOfAtoms);
+}
+
+glm::vec3* Trajectory::getFrame(int frame)
+{
+    return m_positions.data() + (size_t)frame * m_numberOfAtoms;
+}
+
+const glm::vec3* Trajectory::getFrame(int frame) const
+{
+    return m_positions.data() + (size_t)frame * m_numberOfAtoms;
+}
+
+glm::vec3 Trajectory::getPosition(int frame, int atom) const
+{
+    return m_positions.at((size_t)frame * m_numberOfAtoms + atom);
+}
+
+void Trajectory::setPosition(int frame, int atom, glm::vec3 position)
+{
+    m_positions.at((size_t)frame * m_numberOfAtoms + atom) = position;
+}
+
+const float* Trajectory::getData() const
+{
+    return (const float*)m_positions.data();
+}
+
+const std::vector<glm::vec3>& Trajectory::getPositions() const
+{
+    return m_positions;
+}
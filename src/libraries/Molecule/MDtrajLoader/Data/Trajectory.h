@@ -0,0 +1,79 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#ifndef OPENGL_FRAMEWORK_TRAJECTORY_H
+#define OPENGL_FRAMEWORK_TRAJECTORY_H
+
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "positions are expected to be packed floats");
+
+/*
+ * Positions of one frame, viewed in the buffer they are stored in. The view
+ * shares the ownership of that buffer if it got an owner, else the buffer has
+ * to outlive it.
+ */
+class TrajectoryFrame
+{
+public:
+    TrajectoryFrame();
+    TrajectoryFrame(const glm::vec3* pPositions, int numberOfAtoms, std::shared_ptr<const void> spOwner = std::shared_ptr<const void>());
+
+    explicit operator bool() const;
+
+    int size() const;
+    const glm::vec3* data() const;
+    const glm::vec3* begin() const;
+    const glm::vec3* end() const;
+    const glm::vec3& operator[](int atom) const;
+    const glm::vec3& at(int atom) const; // throws std::out_of_range like std::vector
+
+private:
+    std::shared_ptr<const void> m_spOwner;
+    const glm::vec3* m_pPositions;
+    int m_numberOfAtoms;
+};
+
+/*
+ * Positions of all atoms in all frames in a single contiguous buffer, frame
+ * after frame. Frame 0 holds the positions of the pdb file. A frame is a plain
+ * array of x, y and z floats in Angstrom, so it can be uploaded or processed as
+ * it is. Protein, its atoms and GPUProtein share one trajectory instead of
+ * copying the positions.
+ */
+class Trajectory
+{
+public:
+    Trajectory();
+    Trajectory(int numberOfAtoms, int numberOfFrames);
+
+    int getNumberOfAtoms() const;
+    int getNumberOfFrames() const;
+
+    /*
+     * added frames are zero, existing ones are kept
+     */
+    void setNumberOfFrames(int numberOfFrames);
+    void addFrame(const glm::vec3* pPositions);
+
+    glm::vec3* getFrame(int frame);
+    const glm::vec3* getFrame(int frame) const;
+    glm::vec3 getPosition(int frame, int atom) const;
+    void setPosition(int frame, int atom, glm::vec3 position);
+
+    /*
+     * all frames as numberOfFrames * numberOfAtoms * 3 floats
+     */
+    const float* getData() const;
+    const std::vector<glm::vec3>& getPositions() const;
+
+private:
+    int m_numberOfAtoms;
+    std::vector<glm::vec3> m_positions;
+};
+
+
+#endif //OPENGL_FRAMEWORK_TRAJECTORY_H
@@ -2,6 +2,8 @@
 //#include "PharmaCV.h"
 #include "MdTrajWrapper.h"
 
+#ifdef USE_MDTRAJ
+
 MdTrajWrapper::MdTrajWrapper()
 {
     wchar_t* inputName = L"" PYTHON_BINARY;
@@ -32,14 +34,14 @@ std::auto_ptr<Protein> MdTrajWrapper::load(std::vector<std::string> paths)
     std::vector<std::string> residueNames;
     std::vector<std::string> elementNames;
     std::vector<std::string> distinctResidueNames;
-    std::vector<std::vector<glm::vec3>> positions;
+    std::shared_ptr<Trajectory> spPositions = std::make_shared<Trajectory>();
     std::vector<float> radii;
     int numAtoms;
     std::string pathTmp = paths[0].substr(paths[0].find_last_of("\\/")+1);
     std::string proteinName = pathTmp.substr(0, pathTmp.size()-4);
     getAllAtomProperties(paths, names,
                          elementNames, residueNames,
-                         indices, bonds, distinctResidueNames, positions, radii, numAtoms);
+                         indices, bonds, distinctResidueNames, *spPositions, radii, numAtoms);
 
     //	pDq->spawnProtein(names, elementNames, residueNames,
     //		indices, bonds, positions, proteinName, numAtoms, distinctResidueNames);
@@ -47,7 +49,7 @@ std::auto_ptr<Protein> MdTrajWrapper::load(std::vector<std::string> paths)
 
     std::auto_ptr<Protein> prot(  new Protein(names,
         elementNames, residueNames,
-        indices, bonds, positions, proteinName, numAtoms, distinctResidueNames, radii));
+        indices, bonds, spPositions, proteinName, numAtoms, distinctResidueNames, radii));
    // proteins_.push_back(prot);
     return prot;
 }
@@ -117,7 +119,7 @@ PyObject *MdTrajWrapper::getTopology(PyObject *file)
 
 void MdTrajWrapper::getAllAtomProperties(std::vector<std::string> &paths, std::vector<std::string> &names,
                                          std::vector<std::string> &elementNames, std::vector<std::string> &residueNames,
-                                         std::vector<int> &indices, std::vector<std::string> &bonds, std::vector<std::string> &distinctResidue, std::vector<std::vector<glm::vec3>> &positions, std::vector<float> &radii, int &numAtoms)
+                                         std::vector<int> &indices, std::vector<std::string> &bonds, std::vector<std::string> &distinctResidue, Trajectory &positions, std::vector<float> &radii, int &numAtoms)
 {
     if (paths.size() > 2) {
         return;
@@ -167,18 +169,17 @@ void MdTrajWrapper::getAllAtomProperties(std::vector<std::string> &paths, std::v
     float positionY;
     float positionZ;
 
-    std::vector<glm::vec3> frameHolder;
+    // the positions are written straight into the frame of the trajectory
+    positions = Trajectory(numAtoms, 1);
+    glm::vec3* frameHolder = positions.getFrame(0);
     for (int a = 0; a < numAtoms; a++)
     {
         int id = a * numComponents;
         positionX = xyz_carray[id] * 10;
         positionY = xyz_carray[id + 1] * 10;
         positionZ = xyz_carray[id + 2] * 10;
-        glm::vec3 posi(positionX, positionY, positionZ);
-        frameHolder.push_back(posi);
+        frameHolder[a] = glm::vec3(positionX, positionY, positionZ);
     }
-    positions.push_back(frameHolder);
-    frameHolder.clear();
 
     Py_DECREF(xyz_py);
     PyObject* atom;
@@ -293,18 +294,17 @@ void MdTrajWrapper::getAllAtomProperties(std::vector<std::string> &paths, std::v
             numAtoms = (int)numAtom;
 
             //--------------------------read the atoms for each frame
+            positions.setNumberOfFrames(numFrames + 1);
             int c = 0;
             for (int b = 1; b < numFrames + 1; b++) {
-                for (c; c < numAtoms*b; c++) {
+                frameHolder = positions.getFrame(b);
+                for (int a = 0; a < numAtoms; a++, c++) {
                     int id = c * numComponents;
                     positionX = xyz_carray[id] * 10;
                     positionY = xyz_carray[id + 1] * 10;
                     positionZ = xyz_carray[id + 2] * 10;
-                    glm::vec3 posi(positionX, positionY, positionZ);
-                    frameHolder.push_back(posi);
+                    frameHolder[a] = glm::vec3(positionX, positionY, positionZ);
                 }
-                positions.push_back(frameHolder);
-                frameHolder.clear();
             }
 
             Py_DECREF(xyz);
@@ -325,3 +325,5 @@ public string FullPath ()
     return Path.GetFullPath(Path.Combine(ModulePath, "../../"));
 }
 */
+
+#endif // USE_MDTRAJ
@@ -2,6 +2,9 @@
 
 #pragma once
 
+// only built with the CMake option USE_MDTRAJ, otherwise PdbParser and XtcReader read the files
+#ifdef USE_MDTRAJ
+
 #include <string>
 #include <iostream>
 #include <vector>
@@ -33,7 +36,7 @@ public:
 	void getAllAtomProperties(std::vector<std::string> &paths, std::vector<std::string> &names, std::vector<std::string> &elementNames
 		, std::vector<std::string> &residueNames, std::vector<int> &indices
         , std::vector<std::string> &bonds, std::vector<std::string> &distinctResidueNames,
-                              std::vector<std::vector<glm::vec3>> &positions, std::vector<float> &radii, int &numAtoms);
+                              Trajectory &positions, std::vector<float> &radii, int &numAtoms);
 
 
 private:
@@ -41,3 +44,5 @@ private:
 	PyObject* function_loadPDB;
 	PyObject* function_loadXTC;
 };
+
+#endif // USE_MDTRAJ
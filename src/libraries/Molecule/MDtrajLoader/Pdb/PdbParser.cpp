@@ -0,0 +1,302 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#include "PdbParser.h"
+#include "Molecule/MDtrajLoader/Data/AtomLUT.h"
+#include "Utils/Logger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <unordered_map>
+
+/*
+ * radius of elements the lookup table has no van der Waals radius for, carbon
+ */
+#define PDB_DEFAULT_RADIUS 1.7f
+
+namespace {
+    /*
+     * columns are counted from one and include the last column, as in the
+     * pdb format description. Lines may be shorter than the field
+     */
+    std::string field(const char* pLine, int length, int first, int last)
+    {
+        int begin = first - 1;
+        int end = std::min(last, length);
+        while (begin < end && std::isspace((unsigned char)pLine[begin])) begin++;
+        while (end > begin && std::isspace((unsigned char)pLine[end-1])) end--;
+        return (begin < end) ? std::string(pLine + begin, end - begin) : std::string();
+    }
+
+    bool floatField(const char* pLine, int length, int first, int last, float& rValue)
+    {
+        char buffer[32];
+        int size = std::min(last, length) - (first - 1);
+        if (size <= 0 || size >= (int)sizeof(buffer)) return false;
+        std::memcpy(buffer, pLine + first - 1, size);
+        buffer[size] = '\0';
+        char* pEnd;
+        rValue = std::strtof(buffer, &pEnd);
+        return pEnd != buffer;
+    }
+
+    bool intField(const char* pLine, int length, int first, int last, int& rValue)
+    {
+        char buffer[32];
+        int size = std::min(last, length) - (first - 1);
+        if (size <= 0 || size >= (int)sizeof(buffer)) return false;
+        std::memcpy(buffer, pLine + first - 1, size);
+        buffer[size] = '\0';
+        char* pEnd;
+        rValue = (int)std::strtol(buffer, &pEnd, 10);
+        return pEnd != buffer;
+    }
+
+    bool isRecord(const char* pLine, int length, const char* pRecord)
+    {
+        int size = (int)std::strlen(pRecord);
+        return length >= size && std::strncmp(pLine, pRecord, size) == 0;
+    }
+
+    /*
+     * the element symbol is right aligned in columns 77-78. Without it the
+     * symbol is taken from the name, whose first column only holds a letter
+     * for two letter elements, e.g. "FE  " but " CA " for an alpha carbon
+     */
+    std::string elementSymbol(const char* pLine, int length)
+    {
+        std::string symbol = field(pLine, length, 77, 78);
+        if (symbol.empty() && length >= 14) {
+            if (std::isalpha((unsigned char)pLine[12])) {
+                symbol = std::string(pLine + 12, 2);
+                std::string upper = symbol;
+                std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+                if (AtomLUT::element_names.find(upper) == AtomLUT::element_names.end()) symbol = symbol.substr(0, 1);
+            } else {
+                symbol = std::string(pLine + 13, 1);
+            }
+        }
+        std::transform(symbol.begin(), symbol.end(), symbol.begin(), ::toupper);
+        return symbol;
+    }
+}
+
+
+
+//-----------------------------------------------------//
+//                    STRUCTURE                        //
+//-----------------------------------------------------//
+int PdbStructure::getNumberOfAtoms() const
+{
+    return (int)atomNames.size();
+}
+
+int PdbStructure::getNumberOfFrames() const
+{
+    return positions.getNumberOfFrames();
+}
+
+std::string PdbStructure::getDistinctResidueName(int atom) const
+{
+    int residue = atomResidues.at(atom);
+    return residueNames.at(residue) + std::to_string(residueNumbers.at(residue));
+}
+
+
+
+//-----------------------------------------------------//
+//                     PARSING                         //
+//-----------------------------------------------------//
+bool PdbParser::parse(std::string filePath, PdbStructure& rStructure)
+{
+    rStructure = PdbStructure();
+
+    // read the whole file at once, lines are parsed in place
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        Logger::instance().print("Could not open " + filePath, Logger::Mode::ERROR);
+        return false;
+    }
+    std::streamsize fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+    std::vector<char> content((size_t)std::max<std::streamsize>(0, fileSize));
+    if (fileSize > 0 && !file.read(content.data(), fileSize)) {
+        Logger::instance().print("Could not read " + filePath, Logger::Mode::ERROR);
+        return false;
+    }
+
+    std::unordered_map<int, int> serialToAtom;
+    std::vector<std::pair<int, int>> conectSerials;
+    std::set<std::string> unknownElements;
+
+    /*
+     * state of the current model, a new residue starts whenever chain,
+     * sequence number, insertion code or name change
+     */
+    bool modelOpen = false;
+    std::string residueKey;
+    std::vector<std::string> residueAtomNames; // to keep only the first alternate location
+
+    /*
+     * positions of the current model, appended as frame once the model is
+     * complete. Models have to match the first one, incomplete ones are dropped
+     */
+    std::vector<glm::vec3> modelPositions;
+    int numberOfModels = 0;
+    int numberOfDroppedModels = 0;
+    auto closeModel = [&]() {
+        if (modelPositions.empty()) return;
+        if (numberOfModels++ == 0) rStructure.positions = Trajectory((int)modelPositions.size(), 0);
+        if ((int)modelPositions.size() == rStructure.positions.getNumberOfAtoms()) {
+            rStructure.positions.addFrame(modelPositions.data());
+        } else {
+            numberOfDroppedModels++;
+        }
+        modelPositions.clear();
+    };
+
+    const char* pContent = content.data();
+    const char* pEnd = pContent + content.size();
+    while (pContent < pEnd) {
+        const char* pLineEnd = (const char*)std::memchr(pContent, '\n', pEnd - pContent);
+        if (!pLineEnd) pLineEnd = pEnd;
+        const char* pLine = pContent;
+        int length = (int)(pLineEnd - pLine);
+        if (length > 0 && pLine[length-1] == '\r') length--;
+        pContent = pLineEnd + 1;
+
+        if (isRecord(pLine, length, "MODEL")) {
+            // the first model may come without a MODEL record
+            closeModel();
+            modelOpen = true;
+            residueKey.clear();
+            residueAtomNames.clear();
+        } else if (isRecord(pLine, length, "ENDMDL")) {
+            modelOpen = false;
+        } else if (isRecord(pLine, length, "ATOM  ") || isRecord(pLine, length, "HETATM")) {
+            if (!modelOpen) {
+                // files without MODEL records, or atoms after an ENDMDL without a new MODEL
+                closeModel();
+                modelOpen = true;
+                residueKey.clear();
+                residueAtomNames.clear();
+            }
+            bool firstModel = numberOfModels == 0;
+
+            std::string name = field(pLine, length, 13, 16);
+            std::string key = std::string(pLine + std::min(length, 17), pLine + std::min(length, 27));
+            if (key != residueKey) {
+                residueKey = key;
+                residueAtomNames.clear();
+                if (firstModel) {
+                    int number = 0;
+                    intField(pLine, length, 23, 26, number);
+                    rStructure.residueNames.push_back(field(pLine, length, 18, 20));
+                    rStructure.residueNumbers.push_back(number);
+                }
+            }
+
+            char altLoc = (length >= 17) ? pLine[16] : ' ';
+            if (altLoc != ' ' && std::find(residueAtomNames.begin(), residueAtomNames.end(), name) != residueAtomNames.end()) continue;
+            residueAtomNames.push_back(name);
+
+            glm::vec3 position;
+            if (!floatField(pLine, length, 31, 38, position.x) || !floatField(pLine, length, 39, 46, position.y) || !floatField(pLine, length, 47, 54, position.z)) {
+                Logger::instance().print("Skipping atom " + name + " without coordinates in " + filePath, Logger::Mode::WARNING);
+                continue;
+            }
+            modelPositions.push_back(position);
+            if (!firstModel) continue;
+
+            // topology from the first model only
+            int atom = (int)rStructure.atomNames.size();
+            int serial;
+            if (intField(pLine, length, 7, 11, serial)) serialToAtom[serial] = atom;
+
+            std::string symbol = elementSymbol(pLine, length);
+            auto elementName = AtomLUT::element_names.find(symbol);
+            std::string element = (elementName != AtomLUT::element_names.end()) ? elementName->second : symbol;
+            std::transform(element.begin(), element.end(), element.begin(), ::tolower);
+            auto radius = AtomLUT::vdW_radii_picometer.find(element);
+            if (radius == AtomLUT::vdW_radii_picometer.end()) unknownElements.insert(element);
+
+            rStructure.atomNames.push_back(name);
+            rStructure.elementNames.push_back(element);
+            rStructure.radii.push_back((radius != AtomLUT::vdW_radii_picometer.end()) ? (float)radius->second / 100.f : PDB_DEFAULT_RADIUS);
+            rStructure.atomResidues.push_back((int)rStructure.residueNames.size() - 1);
+        } else if (isRecord(pLine, length, "CONECT")) {
+            int serial;
+            if (!intField(pLine, length, 7, 11, serial)) continue;
+            for (int column = 12; column <= 27; column += 5) {
+                int bonded;
+                if (intField(pLine, length, column, column + 4, bonded)) conectSerials.push_back(std::make_pair(serial, bonded));
+            }
+        }
+    }
+    closeModel();
+
+    if (rStructure.atomNames.empty()) {
+        Logger::instance().print("No atoms found in " + filePath, Logger::Mode::ERROR);
+        rStructure = PdbStructure();
+        return false;
+    }
+    for (const std::string& rElement : unknownElements) {
+        Logger::instance().print("No radius for element " + rElement + ", using " + std::to_string(PDB_DEFAULT_RADIUS), Logger::Mode::WARNING);
+    }
+
+    if (numberOfDroppedModels > 0) {
+        Logger::instance().print("Dropping " + std::to_string(numberOfDroppedModels) + " models of " + filePath + " that do not match the first one", Logger::Mode::WARNING);
+    }
+
+    // bonds are usually listed from both atoms, keep every bond once
+    for (auto& rSerials : conectSerials) {
+        auto first = serialToAtom.find(rSerials.first);
+        auto second = serialToAtom.find(rSerials.second);
+        if (first == serialToAtom.end() || second == serialToAtom.end() || first->second == second->second) continue;
+        rStructure.bonds.push_back(std::make_pair(std::min(first->second, second->second), std::max(first->second, second->second)));
+    }
+    std::sort(rStructure.bonds.begin(), rStructure.bonds.end());
+    rStructure.bonds.erase(std::unique(rStructure.bonds.begin(), rStructure.bonds.end()), rStructure.bonds.end());
+
+    return true;
+}
+
+
+
+std::auto_ptr<Protein> PdbParser::load(std::string filePath)
+{
+    PdbStructure structure;
+    if (!parse(filePath, structure)) return std::auto_ptr<Protein>();
+
+    std::string pathTmp = filePath.substr(filePath.find_last_of("\\/")+1);
+    return createProtein(structure, pathTmp.substr(0, pathTmp.find_last_of(".")));
+}
+
+
+
+std::auto_ptr<Protein> PdbParser::createProtein(PdbStructure& rStructure, std::string proteinName)
+{
+    // the atom indices, residue strings and bonds are written the way mdtraj prints them
+    int numberOfAtoms = rStructure.getNumberOfAtoms();
+    std::vector<int> indices(numberOfAtoms);
+    std::vector<std::string> distinctResidueNames(numberOfAtoms);
+    for (int i = 0; i < numberOfAtoms; i++) {
+        indices[i] = i + 1;
+        distinctResidueNames[i] = rStructure.getDistinctResidueName(i);
+    }
+    std::vector<std::string> bonds;
+    bonds.reserve(rStructure.bonds.size());
+    for (auto& rBond : rStructure.bonds) {
+        bonds.push_back("(" + distinctResidueNames[rBond.first] + "-" + rStructure.atomNames[rBond.first] + ", "
+                        + distinctResidueNames[rBond.second] + "-" + rStructure.atomNames[rBond.second] + ")");
+    }
+
+    return std::auto_ptr<Protein>(new Protein(rStructure.atomNames,
+        rStructure.elementNames, rStructure.residueNames,
+        indices, bonds, std::make_shared<Trajectory>(std::move(rStructure.positions)), proteinName, numberOfAtoms, distinctResidueNames, rStructure.radii));
+}
@@ -0,0 +1,62 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#ifndef OPENGL_FRAMEWORK_PDBPARSER_H
+#define OPENGL_FRAMEWORK_PDBPARSER_H
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Molecule/MDtrajLoader/Data/Protein.h"
+#include "Molecule/MDtrajLoader/Data/Trajectory.h"
+
+/*
+ * Everything read from a pdb file. Atoms are indexed in file order, the topology
+ * is taken from the first model and every further MODEL adds a frame of positions.
+ * Positions and radii are in Angstrom.
+ */
+struct PdbStructure {
+    std::vector<std::string> atomNames;         // e.g. CA
+    std::vector<std::string> elementNames;      // element names of the AtomLUT, e.g. carbon
+    std::vector<float>       radii;             // van der Waals radius from the AtomLUT
+    std::vector<int>         atomResidues;      // residue of every atom
+    std::vector<std::string> residueNames;      // name of every residue, e.g. ALA
+    std::vector<int>         residueNumbers;    // sequence number of every residue as written in the file
+    std::vector<std::pair<int, int>> bonds;     // atom pairs of the CONECT records, every bond once, lower index first
+    Trajectory               positions;         // one frame per model
+
+    int getNumberOfAtoms() const;
+    int getNumberOfFrames() const;
+    std::string getDistinctResidueName(int atom) const; // residue name and number, e.g. ALA1
+};
+
+/*
+ * Native reader for pdb files, no python needed. Only the fixed columns of
+ * ATOM, HETATM, MODEL, ENDMDL and CONECT records are read, the file is read
+ * with a single allocation and parsed in place. Like mdtraj the first of
+ * several alternate locations is kept. Elements come from columns 77-78 or,
+ * if those are empty, from the atom name.
+ */
+class PdbParser
+{
+public:
+    bool parse(std::string filePath, PdbStructure& rStructure);
+
+    /*
+     * same protein as MdTrajWrapper::load creates for a single pdb file
+     */
+    std::auto_ptr<Protein> load(std::string filePath);
+
+    /*
+     * protein of a parsed structure, e.g. after frames of a trajectory have been
+     * appended to its positions. Those are moved into the protein, not copied
+     */
+    std::auto_ptr<Protein> createProtein(PdbStructure& rStructure, std::string proteinName);
+};
+
+
+#endif //OPENGL_FRAMEWORK_PDBPARSER_H
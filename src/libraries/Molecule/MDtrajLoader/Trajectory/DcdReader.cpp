@@ -0,0 +1,94 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#include "DcdReader.h"
+#include "Utils/Logger.h"
+
+#include <algorithm>
+
+#define DCD_HEADER_SIZE 84      // "CORD" and the 20 control integers
+#define DCD_CELL_SIZE   48      // six doubles of the unit cell
+
+bool DcdReader::open(std::string filePath)
+{
+    close();
+    if (!m_file.open(filePath)) return false;
+    m_filePath = filePath;
+
+    /*
+     * every record is enclosed by fortran markers holding its size, the
+     * first one tells the byte order
+     */
+    int32_t marker;
+    bool swapBytes = false;
+    if (!readInt(0, false, marker)) marker = 0;
+    if (marker != DCD_HEADER_SIZE) {
+        swapBytes = true;
+        readInt(0, true, marker);
+    }
+    if (marker != DCD_HEADER_SIZE || std::memcmp(m_file.getData() + 4, "CORD", 4) != 0) {
+        Logger::instance().print(filePath + " is no dcd file with 32 bit record markers", Logger::Mode::ERROR);
+        close();
+        return false;
+    }
+
+    int32_t control[20];
+    for (int i = 0; i < 20; i++) {
+        readInt(8 + 4 * i, swapBytes, control[i]);
+    }
+    bool charmm = control[19] != 0;
+    bool unitCell = charmm && control[10] != 0;
+    bool fourDimensions = charmm && control[11] != 0;
+    if (control[8] != 0) {
+        // only the free atoms are stored after the first frame, which would need the indices of the free atoms
+        Logger::instance().print("Dcd file " + filePath + " has " + std::to_string(control[8])
+                                 + " fixed atoms, dcd files with fixed atoms are not supported", Logger::Mode::ERROR);
+        close();
+        return false;
+    }
+
+    // title record and the record with the number of atoms
+    size_t offset = 4 + DCD_HEADER_SIZE + 4;
+    int32_t titleSize, atomMarker, numberOfAtoms;
+    if (!readInt(offset, swapBytes, titleSize) || titleSize < 0
+        || !readInt(offset + 8 + titleSize, swapBytes, atomMarker) || atomMarker != 4
+        || !readInt(offset + 12 + titleSize, swapBytes, numberOfAtoms) || numberOfAtoms <= 0) {
+        Logger::instance().print("Dcd file " + filePath + " has a broken header", Logger::Mode::ERROR);
+        close();
+        return false;
+    }
+    offset += 8 + titleSize + 12;
+    m_numberOfAtoms = numberOfAtoms;
+
+    // all frames have the same size, so they are indexed without reading them
+    size_t blockSize = 4 + 4 * (size_t)numberOfAtoms + 4;
+    size_t cellSize = unitCell ? 4 + DCD_CELL_SIZE + 4 : 0;
+    size_t frameSize = cellSize + (fourDimensions ? 4 : 3) * blockSize;
+    size_t numberOfFrames = (m_file.getSize() - std::min(offset, m_file.getSize())) / frameSize;
+    if (control[0] > 0 && (size_t)control[0] != numberOfFrames) {
+        Logger::instance().print("Dcd file " + filePath + " announces " + std::to_string(control[0]) + " frames but holds "
+                                 + std::to_string(numberOfFrames) + ", using the latter", Logger::Mode::WARNING);
+    }
+
+    TrajectoryFrameView view;
+    view.stride = 4;
+    view.valueSize = 4;
+    view.swapBytes = swapBytes;
+    view.scale = 1.f;
+    view.numberOfAtoms = numberOfAtoms;
+    m_frames.reserve(numberOfFrames);
+    for (size_t f = 0; f < numberOfFrames; f++) {
+        size_t coordinates = offset + f * frameSize + cellSize;
+        int32_t coordinateMarker;
+        if (!readInt(coordinates, swapBytes, coordinateMarker) || coordinateMarker != 4 * numberOfAtoms) {
+            Logger::instance().print("Dcd file " + filePath + " is broken after frame " + std::to_string(f), Logger::Mode::WARNING);
+            break;
+        }
+        view.pX = m_file.getData() + coordinates + 4;
+        view.pY = view.pX + blockSize;
+        view.pZ = view.pY + blockSize;
+        m_frames.push_back(view);
+    }
+    return true;
+}
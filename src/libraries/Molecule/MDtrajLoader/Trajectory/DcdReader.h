@@ -0,0 +1,23 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#ifndef OPENGL_FRAMEWORK_DCDREADER_H
+#define OPENGL_FRAMEWORK_DCDREADER_H
+
+#include "MappedTrajectory.h"
+
+/*
+ * CHARMM and NAMD dcd trajectories. Every frame stores the x, y and z
+ * coordinates as separate float blocks in Angstrom, optionally preceded by
+ * the unit cell, all frames have the same size. The byte order is taken from
+ * the first record marker. Files with fixed atoms are not supported.
+ */
+class DcdReader : public MappedTrajectory
+{
+public:
+    bool open(std::string filePath);
+};
+
+
+#endif //OPENGL_FRAMEWORK_DCDREADER_H
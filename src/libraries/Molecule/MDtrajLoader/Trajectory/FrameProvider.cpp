@@ -0,0 +1,164 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#include "FrameProvider.h"
+#include "Utils/Logger.h"
+
+#include <algorithm>
+
+FrameProvider::~FrameProvider()
+{
+
+}
+
+void FrameProvider::prefetch(int /*firstFrame*/, int /*numberOfFrames*/)
+{
+    // nothing to do for providers holding all frames
+}
+
+
+
+//-----------------------------------------------------//
+//                    CONSTRUCTION                     //
+//-----------------------------------------------------//
+WindowedFrameProvider::WindowedFrameProvider(const Trajectory& rPositions, std::unique_ptr<MappedTrajectory> upTrajectory, int windowSize, int prefetchCount)
+    : m_upTrajectory(std::move(upTrajectory))
+{
+    if (m_upTrajectory) m_numberOfFrames = m_upTrajectory->getNumberOfFrames();
+    start(rPositions, windowSize, prefetchCount);
+}
+
+WindowedFrameProvider::WindowedFrameProvider(const Trajectory& rPositions, std::unique_ptr<XtcReader> upReader, int windowSize, int prefetchCount)
+    : m_upReader(std::move(upReader))
+{
+    if (m_upReader) m_numberOfFrames = m_upReader->getNumberOfFrames();
+    start(rPositions, windowSize, prefetchCount);
+}
+
+void WindowedFrameProvider::start(const Trajectory& rPositions, int windowSize, int prefetchCount)
+{
+    std::shared_ptr<std::vector<glm::vec3> > spFirstFrame = std::make_shared<std::vector<glm::vec3> >(
+        rPositions.getFrame(0), rPositions.getFrame(0) + rPositions.getNumberOfAtoms());
+    m_firstFrame = Frame(spFirstFrame->data(), (int)spFirstFrame->size(), spFirstFrame);
+    m_numberOfFrames += 1;
+
+    // the window has to hold the queried frame besides the prefetched ones
+    m_prefetchCount = std::max(0, prefetchCount);
+    m_windowSize = std::max(windowSize, m_prefetchCount + 2);
+    m_prefetchThread = std::thread(&WindowedFrameProvider::prefetchFrames, this);
+}
+
+WindowedFrameProvider::~WindowedFrameProvider()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_prefetchCondition.notify_all();
+    m_prefetchThread.join();
+}
+
+
+
+//-----------------------------------------------------//
+//                      FRAMES                         //
+//-----------------------------------------------------//
+int WindowedFrameProvider::getNumberOfAtoms() const
+{
+    return m_firstFrame.size();
+}
+
+int WindowedFrameProvider::getNumberOfFrames() const
+{
+    return m_numberOfFrames;
+}
+
+FrameProvider::Frame WindowedFrameProvider::getFrame(int frame, bool prefetchFollowing)
+{
+    if (frame < 0 || frame >= m_numberOfFrames) return Frame();
+
+    Frame positions;
+    if (frame == 0) {
+        positions = m_firstFrame;
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            positions = findFrame(frame);
+        }
+        if (!positions) {
+            positions = decodeFrame(frame);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (positions) insertFrame(frame, positions);
+        }
+    }
+    if (prefetchFollowing) prefetch(frame + 1, m_prefetchCount);
+    return positions;
+}
+
+void WindowedFrameProvider::prefetch(int firstFrame, int numberOfFrames)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_prefetchFirst = std::max(1, firstFrame);
+        m_prefetchEnd = std::min(m_numberOfFrames, firstFrame + std::min(numberOfFrames, m_windowSize - 1));
+    }
+    m_prefetchCondition.notify_one();
+}
+
+FrameProvider::Frame WindowedFrameProvider::decodeFrame(int frame)
+{
+    std::shared_ptr<std::vector<glm::vec3> > spPositions = std::make_shared<std::vector<glm::vec3> >(m_firstFrame.size());
+    bool decoded;
+    if (m_upTrajectory) {
+        // reading the mapping needs no lock
+        decoded = m_upTrajectory->readFrame(frame - 1, spPositions->data());
+    } else {
+        std::lock_guard<std::mutex> lock(m_readerMutex);
+        decoded = m_upReader->seekFrame(frame - 1) && m_upReader->readNextFrame(spPositions->data());
+    }
+    if (!decoded) {
+        Logger::instance().print("Could not decode frame " + std::to_string(frame), Logger::Mode::ERROR);
+        return Frame();
+    }
+    return Frame(spPositions->data(), (int)spPositions->size(), spPositions);
+}
+
+FrameProvider::Frame WindowedFrameProvider::findFrame(int frame)
+{
+    auto found = m_frames.find(frame);
+    if (found == m_frames.end()) return Frame();
+    m_recentFrames.splice(m_recentFrames.begin(), m_recentFrames, found->second.second);
+    return found->second.first;
+}
+
+void WindowedFrameProvider::insertFrame(int frame, Frame positions)
+{
+    // the frame may have been decoded by the prefetching meanwhile
+    if (findFrame(frame)) return;
+    m_recentFrames.push_front(frame);
+    m_frames[frame] = std::make_pair(positions, m_recentFrames.begin());
+    while ((int)m_frames.size() > m_windowSize) {
+        m_frames.erase(m_recentFrames.back());
+        m_recentFrames.pop_back();
+    }
+}
+
+void WindowedFrameProvider::prefetchFrames()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_prefetchCondition.wait(lock, [this] { return m_quit || m_prefetchFirst < m_prefetchEnd; });
+        if (m_quit) return;
+
+        // frames decoded already are marked as used, so they are not dropped before they are queried
+        int frame = m_prefetchFirst++;
+        if (findFrame(frame)) continue;
+
+        // decoding does not block queries of other frames
+        lock.unlock();
+        Frame positions = decodeFrame(frame);
+        lock.lock();
+        if (positions) insertFrame(frame, positions);
+    }
+}
@@ -0,0 +1,97 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#ifndef OPENGL_FRAMEWORK_FRAMEPROVIDER_H
+#define OPENGL_FRAMEWORK_FRAMEPROVIDER_H
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "MappedTrajectory.h"
+#include "Molecule/MDtrajLoader/Data/Trajectory.h"
+#include "Molecule/MDtrajLoader/Xtc/XtcReader.h"
+
+/*
+ * Positions of a trajectory queried frame by frame, so no one has to hold all of them
+ */
+class FrameProvider
+{
+public:
+    typedef TrajectoryFrame Frame;
+
+    virtual ~FrameProvider();
+
+    virtual int getNumberOfAtoms() const = 0;
+    virtual int getNumberOfFrames() const = 0;
+
+    /*
+     * positions of a frame in Angstrom, they stay valid while the frame is held.
+     * Empty if the frame does not exist or could not be decoded. Callers going
+     * through a range they prefetched themselves pass false for prefetchFollowing,
+     * so the query does not replace their range
+     */
+    virtual Frame getFrame(int frame, bool prefetchFollowing = true) = 0;
+
+    /*
+     * hint that the frames will be queried soon, they may be decoded in the background
+     */
+    virtual void prefetch(int firstFrame, int numberOfFrames);
+};
+
+/*
+ * First frame of rPositions, usually the pdb frame, followed by the frames of a
+ * trajectory, which are decoded on demand.
+ * The last windowSize decoded frames are kept, the least recently used one is
+ * dropped first. Every query schedules the following prefetchCount frames unless
+ * told otherwise, a background thread decodes them meanwhile, so playback and
+ * computations that go through the frames in order mostly find them decoded.
+ */
+class WindowedFrameProvider : public FrameProvider
+{
+public:
+    WindowedFrameProvider(const Trajectory& rPositions, std::unique_ptr<MappedTrajectory> upTrajectory, int windowSize, int prefetchCount);
+    WindowedFrameProvider(const Trajectory& rPositions, std::unique_ptr<XtcReader> upReader, int windowSize, int prefetchCount);
+    ~WindowedFrameProvider();
+
+    int getNumberOfAtoms() const;
+    int getNumberOfFrames() const;
+    Frame getFrame(int frame, bool prefetchFollowing = true);
+    void prefetch(int firstFrame, int numberOfFrames);
+
+private:
+    void start(const Trajectory& rPositions, int windowSize, int prefetchCount);
+    Frame decodeFrame(int frame);
+    Frame findFrame(int frame);             // expects m_mutex to be locked
+    void insertFrame(int frame, Frame positions); // expects m_mutex to be locked
+    void prefetchFrames();
+
+    Frame                        m_firstFrame;
+    std::unique_ptr<MappedTrajectory> m_upTrajectory;
+    std::unique_ptr<XtcReader>   m_upReader;
+    std::mutex                   m_readerMutex;     // the xtc reader seeks in a single file
+    int                          m_numberOfFrames = 0;
+    int                          m_windowSize = 0;
+    int                          m_prefetchCount = 0;
+
+    // decoded frames, most recently used first
+    std::mutex                   m_mutex;
+    std::list<int>               m_recentFrames;
+    std::unordered_map<int, std::pair<Frame, std::list<int>::iterator> > m_frames;
+
+    // frames still to prefetch, from m_prefetchFirst to excluding m_prefetchEnd
+    std::condition_variable      m_prefetchCondition;
+    std::thread                  m_prefetchThread;
+    int                          m_prefetchFirst = 0;
+    int                          m_prefetchEnd = 0;
+    bool                         m_quit = false;
+};
+
+
+#endif //OPENGL_FRAMEWORK_FRAMEPROVIDER_H
@@ -0,0 +1,205 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#include "MappedTrajectory.h"
+#include "DcdReader.h"
+#include "TrrReader.h"
+#include "Utils/Logger.h"
+
+#include <algorithm>
+#include <cctype>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    std::string extension(std::string filePath)
+    {
+        std::string extension = filePath.substr(filePath.find_last_of(".") + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        return extension;
+    }
+}
+
+
+
+//-----------------------------------------------------//
+//                   MAPPED FILE                       //
+//-----------------------------------------------------//
+MappedFile::MappedFile()
+{
+
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(std::string filePath)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0x0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0x0);
+    if (file == INVALID_HANDLE_VALUE) {
+        Logger::instance().print("Could not open " + filePath, Logger::Mode::ERROR);
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+        Logger::instance().print("Could not read " + filePath, Logger::Mode::ERROR);
+        CloseHandle(file);
+        return false;
+    }
+
+    // the view stays valid after the handles of the file and the mapping are closed
+    HANDLE mapping = CreateFileMappingA(file, 0x0, PAGE_READONLY, 0, 0, 0x0);
+    CloseHandle(file);
+    void* pData = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : 0x0;
+    if (mapping) CloseHandle(mapping);
+    if (!pData) {
+        Logger::instance().print("Could not map " + filePath, Logger::Mode::ERROR);
+        return false;
+    }
+    mp_data = (const unsigned char*)pData;
+    m_size = (size_t)size.QuadPart;
+    return true;
+#else
+    int descriptor = ::open(filePath.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        Logger::instance().print("Could not open " + filePath, Logger::Mode::ERROR);
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size <= 0) {
+        Logger::instance().print("Could not read " + filePath, Logger::Mode::ERROR);
+        ::close(descriptor);
+        return false;
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    void* pData = mmap(0x0, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    ::close(descriptor);
+    if (pData == MAP_FAILED) {
+        Logger::instance().print("Could not map " + filePath, Logger::Mode::ERROR);
+        return false;
+    }
+    mp_data = (const unsigned char*)pData;
+    m_size = (size_t)status.st_size;
+    return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (mp_data) UnmapViewOfFile(mp_data);
+#else
+    if (mp_data) munmap((void*)mp_data, m_size);
+#endif
+    mp_data = 0x0;
+    m_size = 0;
+}
+
+
+
+//-----------------------------------------------------//
+//                   TRAJECTORY                        //
+//-----------------------------------------------------//
+MappedTrajectory::~MappedTrajectory()
+{
+
+}
+
+std::unique_ptr<MappedTrajectory> MappedTrajectory::openFile(std::string filePath)
+{
+    std::unique_ptr<MappedTrajectory> upTrajectory;
+    if (extension(filePath) == "dcd") {
+        upTrajectory.reset(new DcdReader());
+    } else if (extension(filePath) == "trr") {
+        upTrajectory.reset(new TrrReader());
+    } else {
+        Logger::instance().print("Unknown trajectory format of " + filePath, Logger::Mode::ERROR);
+        return upTrajectory;
+    }
+    if (!upTrajectory->open(filePath)) upTrajectory.reset();
+    return upTrajectory;
+}
+
+bool MappedTrajectory::isSupported(std::string filePath)
+{
+    return extension(filePath) == "dcd" || extension(filePath) == "trr";
+}
+
+void MappedTrajectory::close()
+{
+    m_file.close();
+    m_filePath.clear();
+    m_numberOfAtoms = 0;
+    m_frames.clear();
+}
+
+bool MappedTrajectory::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+int MappedTrajectory::getNumberOfAtoms() const
+{
+    return m_numberOfAtoms;
+}
+
+int MappedTrajectory::getNumberOfFrames() const
+{
+    return (int)m_frames.size();
+}
+
+std::string MappedTrajectory::getFilePath() const
+{
+    return m_filePath;
+}
+
+TrajectoryFrameView MappedTrajectory::getFrame(int frame) const
+{
+    if (frame < 0 || frame >= (int)m_frames.size()) return TrajectoryFrameView();
+    return m_frames[frame];
+}
+
+bool MappedTrajectory::readFrame(int frame, glm::vec3* pPositions) const
+{
+    TrajectoryFrameView view = getFrame(frame);
+    if (!view.isValid()) {
+        Logger::instance().print("Frame " + std::to_string(frame) + " does not exist in " + m_filePath, Logger::Mode::ERROR);
+        return false;
+    }
+    view.copyTo(pPositions);
+    return true;
+}
+
+bool MappedTrajectory::readInt(size_t offset, bool swapBytes, int32_t& rValue) const
+{
+    if (!m_file.isOpen() || offset + 4 > m_file.getSize()) return false;
+    uint32_t bits;
+    std::memcpy(&bits, m_file.getData() + offset, 4);
+    if (swapBytes) bits = (bits >> 24) | ((bits >> 8) & 0xff00u) | ((bits << 8) & 0xff0000u) | (bits << 24);
+    rValue = (int32_t)bits;
+    return true;
+}
+
+bool MappedTrajectory::isLittleEndianHost()
+{
+    uint16_t one = 1;
+    unsigned char firstByte;
+    std::memcpy(&firstByte, &one, 1);
+    return firstByte == 1;
+}
@@ -0,0 +1,137 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#ifndef OPENGL_FRAMEWORK_MAPPEDTRAJECTORY_H
+#define OPENGL_FRAMEWORK_MAPPEDTRAJECTORY_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+/*
+ * Coordinates of one frame inside a mapped trajectory file, nothing is copied.
+ * The three axes may be interleaved (TRR) or stored as separate blocks (DCD),
+ * they are converted to float Angstrom when an atom is accessed.
+ */
+struct TrajectoryFrameView {
+    const unsigned char* pX = 0x0;   // first x coordinate
+    const unsigned char* pY = 0x0;   // first y coordinate
+    const unsigned char* pZ = 0x0;   // first z coordinate
+    size_t stride = 0;               // bytes from one atom to the next on every axis
+    int    valueSize = 4;            // 4 for float, 8 for double coordinates
+    bool   swapBytes = false;        // file endianness differs from the host
+    float  scale = 1.f;              // file unit to Angstrom
+    int    numberOfAtoms = 0;
+
+    bool isValid() const { return pX != 0x0; }
+
+    glm::vec3 operator[](int atom) const
+    {
+        size_t offset = (size_t)atom * stride;
+        return glm::vec3(value(pX + offset), value(pY + offset), value(pZ + offset)) * scale;
+    }
+
+    void copyTo(glm::vec3* pPositions) const
+    {
+        for (int i = 0; i < numberOfAtoms; i++) {
+            pPositions[i] = (*this)[i];
+        }
+    }
+
+private:
+    float value(const unsigned char* pValue) const
+    {
+        unsigned char bytes[8];
+        std::memcpy(bytes, pValue, valueSize);
+        if (swapBytes) {
+            for (int b = 0; b < valueSize / 2; b++) std::swap(bytes[b], bytes[valueSize - 1 - b]);
+        }
+        if (valueSize == 8) {
+            double value;
+            std::memcpy(&value, bytes, 8);
+            return (float)value;
+        }
+        float value;
+        std::memcpy(&value, bytes, 4);
+        return value;
+    }
+};
+
+/*
+ * Read only memory mapping of a whole file, pages are loaded on first access
+ */
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(std::string filePath);
+    void close();
+    bool isOpen() const { return mp_data != 0x0; }
+    const unsigned char* getData() const { return mp_data; }
+    size_t getSize() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const unsigned char* mp_data = 0x0;
+    size_t               m_size = 0;
+};
+
+/*
+ * Trajectory formats with uncompressed frames, read through a memory mapping.
+ * Opening indexes the frame offsets, afterwards every frame is accessed at
+ * random as a view into the mapping or copied into a buffer of the caller.
+ */
+class MappedTrajectory
+{
+public:
+    virtual ~MappedTrajectory();
+
+    /*
+     * reader for the format given by the file extension, .dcd or .trr,
+     * 0x0 if the format is unknown or the file could not be opened
+     */
+    static std::unique_ptr<MappedTrajectory> openFile(std::string filePath);
+    static bool isSupported(std::string filePath);
+
+    virtual bool open(std::string filePath) = 0;
+    void close();
+    bool isOpen() const;
+
+    int getNumberOfAtoms() const;
+    int getNumberOfFrames() const;
+    std::string getFilePath() const;
+
+    /*
+     * view of a frame without copying, invalid for frames out of range
+     */
+    TrajectoryFrameView getFrame(int frame) const;
+
+    /*
+     * copies the positions of a frame in Angstrom
+     */
+    bool readFrame(int frame, glm::vec3* pPositions) const;
+
+protected:
+    /*
+     * 32 bit integer at an offset of the mapping, false if the file is too short
+     */
+    bool readInt(size_t offset, bool swapBytes, int32_t& rValue) const;
+    static bool isLittleEndianHost();
+
+    MappedFile                       m_file;
+    std::string                      m_filePath;
+    int                              m_numberOfAtoms = 0;
+    std::vector<TrajectoryFrameView> m_frames;
+};
+
+
+#endif //OPENGL_FRAMEWORK_MAPPEDTRAJECTORY_H
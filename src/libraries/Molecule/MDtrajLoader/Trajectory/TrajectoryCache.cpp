@@ -0,0 +1,293 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#include "TrajectoryCache.h"
+#include "FrameProvider.h"
+#include "Utils/Logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC         "SDVCACHE"
+#define CACHE_VERSION       1
+#define CACHE_BYTE_ORDER    0x01020304u
+#define CACHE_HASHED_BYTES  (1 << 20)   // at the start and at the end of an input file
+#define CACHE_ALIGNMENT     16          // of the frames
+
+namespace {
+    /*
+     * fixed size start of the file, followed by the topology and the first
+     * frame, the further frames start at frameOffset
+     */
+    struct CacheHeader {
+        char         magic[8];
+        uint32_t     version;
+        uint32_t     byteOrder;
+        CacheFileKey pdbKey;
+        CacheFileKey trajectoryKey;
+        int32_t      numberOfAtoms;
+        int32_t      numberOfResidues;
+        int32_t      numberOfBonds;
+        int32_t      numberOfFrames;
+        uint64_t     frameOffset;
+    };
+
+    uint64_t hashBytes(const unsigned char* pData, size_t size, uint64_t hash)
+    {
+        // FNV-1a
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ pData[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    //-----------------------------------------------------//
+    //                     WRITING                         //
+    //-----------------------------------------------------//
+    template<typename T>
+    void writeValues(std::ofstream& rFile, const T* pValues, size_t count)
+    {
+        rFile.write((const char*)pValues, count * sizeof(T));
+    }
+
+    void writeStrings(std::ofstream& rFile, const std::vector<std::string>& rStrings)
+    {
+        for (const std::string& rString : rStrings) {
+            uint32_t length = (uint32_t)rString.size();
+            writeValues(rFile, &length, 1);
+            rFile.write(rString.data(), length);
+        }
+    }
+
+    //-----------------------------------------------------//
+    //                     READING                         //
+    //-----------------------------------------------------//
+    // reads sequentially from the mapping, every read fails once the end is passed
+    struct CacheCursor {
+        const unsigned char* pData;
+        size_t size;
+        size_t offset;
+
+        template<typename T>
+        bool values(T* pValues, size_t count)
+        {
+            size_t bytes = count * sizeof(T);
+            if (offset + bytes > size) return false;
+            if (bytes == 0) return true;
+            std::memcpy(pValues, pData + offset, bytes);
+            offset += bytes;
+            return true;
+        }
+
+        bool strings(std::vector<std::string>& rStrings, size_t count)
+        {
+            rStrings.resize(count);
+            for (size_t i = 0; i < count; i++) {
+                uint32_t length;
+                if (!values(&length, 1) || offset + length > size) return false;
+                rStrings[i].assign((const char*)pData + offset, length);
+                offset += length;
+            }
+            return true;
+        }
+    };
+}
+
+
+
+//-----------------------------------------------------//
+//                      KEYS                           //
+//-----------------------------------------------------//
+std::string TrajectoryCache::getCachePath(std::string pdbPath, std::string trajectoryPath)
+{
+    return (trajectoryPath.empty() ? pdbPath : trajectoryPath) + ".cache";
+}
+
+bool TrajectoryCache::getFileKey(std::string filePath, CacheFileKey& rKey)
+{
+    rKey = CacheFileKey();
+    if (filePath.empty()) return true;
+
+    struct stat status;
+    if (stat(filePath.c_str(), &status) != 0) return false;
+    rKey.size = (uint64_t)status.st_size;
+#ifdef _WIN32
+    rKey.modificationTime = (int64_t)status.st_mtime * 1000000000ll;
+#else
+    rKey.modificationTime = (int64_t)status.st_mtim.tv_sec * 1000000000ll + status.st_mtim.tv_nsec;
+#endif
+
+    MappedFile file;
+    if (!file.open(filePath)) return false;
+    size_t hashed = std::min(file.getSize(), (size_t)CACHE_HASHED_BYTES);
+    rKey.hash = hashBytes(file.getData(), hashed, 14695981039346656037ull);
+    rKey.hash = hashBytes(file.getData() + file.getSize() - hashed, hashed, rKey.hash);
+    return true;
+}
+
+
+
+//-----------------------------------------------------//
+//                     WRITING                         //
+//-----------------------------------------------------//
+bool TrajectoryCache::write(std::string cachePath, std::string pdbPath, std::string trajectoryPath, const PdbStructure& rStructure, FrameProvider* pFrames)
+{
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CACHE_MAGIC, 8);
+    header.version = CACHE_VERSION;
+    header.byteOrder = CACHE_BYTE_ORDER;
+    if (!getFileKey(pdbPath, header.pdbKey) || !getFileKey(trajectoryPath, header.trajectoryKey)) {
+        Logger::instance().print("Could not read the input files of cache " + cachePath, Logger::Mode::ERROR);
+        return false;
+    }
+    header.numberOfAtoms = rStructure.getNumberOfAtoms();
+    header.numberOfResidues = (int32_t)rStructure.residueNames.size();
+    header.numberOfBonds = (int32_t)rStructure.bonds.size();
+    header.numberOfFrames = std::max(0, (pFrames ? pFrames->getNumberOfFrames() : rStructure.getNumberOfFrames()) - 1);
+    if (rStructure.getNumberOfFrames() < 1 || rStructure.positions.getNumberOfAtoms() != header.numberOfAtoms) {
+        Logger::instance().print("No positions to write to cache " + cachePath, Logger::Mode::ERROR);
+        return false;
+    }
+
+    std::string temporaryPath = cachePath + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        Logger::instance().print("Could not write cache " + cachePath, Logger::Mode::WARNING);
+        return false;
+    }
+
+    // the frame offset is known once the topology is written
+    writeValues(file, &header, 1);
+    writeStrings(file, rStructure.atomNames);
+    writeStrings(file, rStructure.elementNames);
+    writeValues(file, rStructure.radii.data(), rStructure.radii.size());
+    writeValues(file, rStructure.atomResidues.data(), rStructure.atomResidues.size());
+    writeStrings(file, rStructure.residueNames);
+    writeValues(file, rStructure.residueNumbers.data(), rStructure.residueNumbers.size());
+    for (auto& rBond : rStructure.bonds) {
+        int32_t atoms[2] = { rBond.first, rBond.second };
+        writeValues(file, atoms, 2);
+    }
+    writeValues(file, rStructure.positions.getFrame(0), header.numberOfAtoms);
+
+    uint64_t offset = (uint64_t)file.tellp();
+    header.frameOffset = (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+    char padding[CACHE_ALIGNMENT] = {};
+    file.write(padding, header.frameOffset - offset);
+    bool complete = true;
+    for (int f = 1; f <= header.numberOfFrames && complete; f++) {
+        if (pFrames) {
+            FrameProvider::Frame positions = pFrames->getFrame(f);
+            complete = positions && positions.size() == header.numberOfAtoms;
+            if (complete) writeValues(file, positions.data(), positions.size());
+        } else {
+            writeValues(file, rStructure.positions.getFrame(f), header.numberOfAtoms);
+        }
+    }
+    file.seekp(0, std::ios::beg);
+    writeValues(file, &header, 1);
+    file.close();
+
+#ifdef _WIN32
+    // renaming does not replace an existing file there
+    if (complete && file) std::remove(cachePath.c_str());
+#endif
+    if (!complete || !file || std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+        Logger::instance().print("Could not write cache " + cachePath, Logger::Mode::WARNING);
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+
+//-----------------------------------------------------//
+//                     READING                         //
+//-----------------------------------------------------//
+bool TrajectoryCache::open(std::string filePath)
+{
+    close();
+    m_structure = PdbStructure();
+
+    // a missing cache is no error, it is written after the first load
+    struct stat status;
+    if (stat(filePath.c_str(), &status) != 0 || !m_file.open(filePath)) return false;
+    m_filePath = filePath;
+
+    CacheCursor cursor = { m_file.getData(), m_file.getSize(), 0 };
+    CacheHeader header;
+    if (!cursor.values(&header, 1) || std::memcmp(header.magic, CACHE_MAGIC, 8) != 0
+        || header.version != CACHE_VERSION || header.byteOrder != CACHE_BYTE_ORDER) {
+        Logger::instance().print("Cache " + filePath + " was written by another version and is ignored", Logger::Mode::WARNING);
+        close();
+        m_structure = PdbStructure();
+        return false;
+    }
+
+    int numberOfAtoms = header.numberOfAtoms;
+    std::vector<int32_t> bonds(2 * (size_t)std::max(0, header.numberOfBonds));
+    m_structure.radii.resize(std::max(0, numberOfAtoms));
+    m_structure.atomResidues.resize(std::max(0, numberOfAtoms));
+    m_structure.residueNumbers.resize(std::max(0, header.numberOfResidues));
+    m_structure.positions = Trajectory(std::max(0, numberOfAtoms), 1);
+    size_t frameSize = 3 * sizeof(float) * (size_t)std::max(0, numberOfAtoms);
+    bool complete = numberOfAtoms > 0 && header.numberOfResidues >= 0 && header.numberOfBonds >= 0 && header.numberOfFrames >= 0
+        && cursor.strings(m_structure.atomNames, numberOfAtoms)
+        && cursor.strings(m_structure.elementNames, numberOfAtoms)
+        && cursor.values(m_structure.radii.data(), numberOfAtoms)
+        && cursor.values(m_structure.atomResidues.data(), numberOfAtoms)
+        && cursor.strings(m_structure.residueNames, header.numberOfResidues)
+        && cursor.values(m_structure.residueNumbers.data(), header.numberOfResidues)
+        && cursor.values(bonds.data(), bonds.size())
+        && cursor.values(m_structure.positions.getFrame(0), numberOfAtoms)
+        && header.frameOffset >= cursor.offset
+        && header.frameOffset + frameSize * header.numberOfFrames <= m_file.getSize();
+
+    // the residues of the atoms index the residue arrays
+    for (int a = 0; a < numberOfAtoms && complete; a++) {
+        complete = m_structure.atomResidues[a] >= 0 && m_structure.atomResidues[a] < header.numberOfResidues;
+    }
+    if (!complete) {
+        Logger::instance().print("Cache " + filePath + " is broken and ignored", Logger::Mode::WARNING);
+        close();
+        m_structure = PdbStructure();
+        return false;
+    }
+    for (size_t b = 0; b < bonds.size(); b += 2) {
+        m_structure.bonds.push_back(std::make_pair(bonds[b], bonds[b+1]));
+    }
+    m_pdbKey = header.pdbKey;
+    m_trajectoryKey = header.trajectoryKey;
+    m_numberOfAtoms = numberOfAtoms;
+
+    // the frames are used as they are
+    TrajectoryFrameView view;
+    view.stride = 3 * sizeof(float);
+    view.valueSize = sizeof(float);
+    view.numberOfAtoms = numberOfAtoms;
+    m_frames.reserve(header.numberOfFrames);
+    for (int f = 0; f < header.numberOfFrames; f++) {
+        view.pX = m_file.getData() + header.frameOffset + f * frameSize;
+        view.pY = view.pX + sizeof(float);
+        view.pZ = view.pY + sizeof(float);
+        m_frames.push_back(view);
+    }
+    return true;
+}
+
+bool TrajectoryCache::matches(std::string pdbPath, std::string trajectoryPath) const
+{
+    CacheFileKey pdbKey, trajectoryKey;
+    return isOpen() && getFileKey(pdbPath, pdbKey) && getFileKey(trajectoryPath, trajectoryKey)
+        && pdbKey == m_pdbKey && trajectoryKey == m_trajectoryKey;
+}
+
+const PdbStructure& TrajectoryCache::getStructure() const
+{
+    return m_structure;
+}
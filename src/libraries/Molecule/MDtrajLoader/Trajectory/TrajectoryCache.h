@@ -0,0 +1,73 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#ifndef OPENGL_FRAMEWORK_TRAJECTORYCACHE_H
+#define OPENGL_FRAMEWORK_TRAJECTORYCACHE_H
+
+#include "MappedTrajectory.h"
+#include "Molecule/MDtrajLoader/Pdb/PdbParser.h"
+
+class FrameProvider;
+
+/*
+ * identifies the version of an input file the cache was written for
+ */
+struct CacheFileKey {
+    uint64_t size = 0;
+    int64_t  modificationTime = 0;  // ns since epoch
+    uint64_t hash = 0;              // of the first and last MB, so large files are not read completely
+
+    bool operator==(const CacheFileKey& rOther) const
+    {
+        return size == rOther.size && modificationTime == rOther.modificationTime && hash == rOther.hash;
+    }
+};
+
+/*
+ * Binary cache of a molecule and its trajectory, written after the first load
+ * so later loads neither parse the pdb file nor decode the trajectory. It holds
+ * the topology of a PdbStructure with its first frame, followed by the frames of
+ * the trajectory as frame-major floats in Angstrom. Those are mapped and exposed
+ * as frames without any conversion.
+ *
+ * The cache stores the keys of both input files and is rebuilt whenever one of
+ * them changes or the format version differs. It is written in the byte order
+ * of the host and not meant to be moved to other machines.
+ */
+class TrajectoryCache : public MappedTrajectory
+{
+public:
+    /*
+     * cache next to the trajectory, or next to the pdb file without trajectory
+     */
+    static std::string getCachePath(std::string pdbPath, std::string trajectoryPath);
+    static bool getFileKey(std::string filePath, CacheFileKey& rKey);
+
+    /*
+     * Writes the topology and first frame of rStructure. The further frames are
+     * streamed from pFrames if given, else taken from rStructure.positions. The
+     * file is written under a temporary name and renamed when complete
+     */
+    static bool write(std::string cachePath, std::string pdbPath, std::string trajectoryPath, const PdbStructure& rStructure, FrameProvider* pFrames = 0x0);
+
+    bool open(std::string filePath);
+
+    /*
+     * whether the cache was written for the current versions of the input files
+     */
+    bool matches(std::string pdbPath, std::string trajectoryPath) const;
+
+    /*
+     * topology with the first frame only
+     */
+    const PdbStructure& getStructure() const;
+
+private:
+    PdbStructure m_structure;
+    CacheFileKey m_pdbKey;
+    CacheFileKey m_trajectoryKey;
+};
+
+
+#endif //OPENGL_FRAMEWORK_TRAJECTORYCACHE_H
@@ -0,0 +1,105 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#include "TrrReader.h"
+#include "Utils/Logger.h"
+
+#define TRR_MAGIC       1993
+#define TRR_NM_TO_A     10.f
+
+namespace {
+    /*
+     * sizes of the frame header, the data blocks follow in the order box,
+     * virial, pressure, positions, velocities and forces
+     */
+    struct TrrHeader {
+        int32_t irSize, eSize, boxSize, virSize, presSize, topSize, symSize, xSize, vSize, fSize;
+        int32_t numberOfAtoms, step, nre;
+    };
+}
+
+bool TrrReader::open(std::string filePath)
+{
+    close();
+    if (!m_file.open(filePath)) return false;
+    m_filePath = filePath;
+
+    // xdr is big endian
+    bool swapBytes = isLittleEndianHost();
+
+    size_t offset = 0;
+    while (offset < m_file.getSize()) {
+        /*
+         * magic number and the version string, written as its length
+         * including the terminating zero followed by an xdr string
+         */
+        int32_t magic, stringSize, versionSize;
+        if (!readInt(offset, swapBytes, magic) || magic != TRR_MAGIC
+            || !readInt(offset + 4, swapBytes, stringSize) || !readInt(offset + 8, swapBytes, versionSize)
+            || versionSize < 0 || versionSize > 1024) {
+            if (offset == 0) {
+                Logger::instance().print(filePath + " is no trr file", Logger::Mode::ERROR);
+                close();
+                return false;
+            }
+            Logger::instance().print("Trr file " + filePath + " is broken after frame " + std::to_string(m_frames.size()), Logger::Mode::WARNING);
+            break;
+        }
+        size_t position = offset + 12 + ((versionSize + 3) / 4) * 4;
+
+        TrrHeader header;
+        int32_t* pHeader = (int32_t*)&header;
+        bool complete = true;
+        for (int i = 0; i < (int)(sizeof(TrrHeader) / 4); i++) {
+            complete = complete && readInt(position + 4 * i, swapBytes, pHeader[i]);
+        }
+        for (int i = 0; i < 10; i++) {
+            complete = complete && pHeader[i] >= 0; // block sizes
+        }
+        position += sizeof(TrrHeader);
+
+        // the precision is only known from the size of the blocks
+        int valueSize = 0;
+        if (header.boxSize) valueSize = header.boxSize / 9;
+        else if (header.xSize && header.numberOfAtoms) valueSize = header.xSize / (header.numberOfAtoms * 3);
+        else if (header.vSize && header.numberOfAtoms) valueSize = header.vSize / (header.numberOfAtoms * 3);
+        else if (header.fSize && header.numberOfAtoms) valueSize = header.fSize / (header.numberOfAtoms * 3);
+        position += 2 * valueSize; // time and lambda
+
+        size_t positionsOffset = position + header.boxSize + header.virSize + header.presSize;
+        size_t nextOffset = positionsOffset + (size_t)header.xSize + header.vSize + header.fSize;
+        if (!complete || (valueSize != 4 && valueSize != 8) || header.numberOfAtoms <= 0 || nextOffset > m_file.getSize()
+            || (m_numberOfAtoms && header.numberOfAtoms != m_numberOfAtoms)) {
+            if (offset == 0) {
+                Logger::instance().print("Trr file " + filePath + " has a broken header", Logger::Mode::ERROR);
+                close();
+                return false;
+            }
+            Logger::instance().print("Trr file " + filePath + " is broken after frame " + std::to_string(m_frames.size()), Logger::Mode::WARNING);
+            break;
+        }
+        m_numberOfAtoms = header.numberOfAtoms;
+
+        if (header.xSize) {
+            TrajectoryFrameView view;
+            view.pX = m_file.getData() + positionsOffset;
+            view.pY = view.pX + valueSize;
+            view.pZ = view.pY + valueSize;
+            view.stride = 3 * valueSize;
+            view.valueSize = valueSize;
+            view.swapBytes = swapBytes;
+            view.scale = TRR_NM_TO_A;
+            view.numberOfAtoms = m_numberOfAtoms;
+            m_frames.push_back(view);
+        }
+        offset = nextOffset;
+    }
+
+    if (m_frames.empty()) {
+        Logger::instance().print("Trr file " + filePath + " holds no positions", Logger::Mode::ERROR);
+        close();
+        return false;
+    }
+    return true;
+}
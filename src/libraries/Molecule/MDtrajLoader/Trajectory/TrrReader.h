@@ -0,0 +1,22 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#ifndef OPENGL_FRAMEWORK_TRRREADER_H
+#define OPENGL_FRAMEWORK_TRRREADER_H
+
+#include "MappedTrajectory.h"
+
+/*
+ * GROMACS trr trajectories, uncompressed big endian frames in float or double
+ * precision and nm. Frames may hold velocities or forces only, just those with
+ * positions become frames of the trajectory.
+ */
+class TrrReader : public MappedTrajectory
+{
+public:
+    bool open(std::string filePath);
+};
+
+
+#endif //OPENGL_FRAMEWORK_TRRREADER_H
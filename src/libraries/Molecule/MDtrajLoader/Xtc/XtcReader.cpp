@@ -0,0 +1,511 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#include "XtcReader.h"
+#include "Utils/Logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#define XTC_MAGIC       1995
+#define XTC_LARGE_MAGIC 2023    // GROMACS 2023 and newer, 64 bit byte count for huge frames
+#define XTC_FIRSTIDX    9       // first index of magicints that is not zero
+
+namespace {
+    /*
+     * sizes of the small integers between successive atoms, growing by about 2^(1/3)
+     */
+    const int magicints[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 10, 12, 16, 20, 25, 32, 40, 50, 64,
+        80, 101, 128, 161, 203, 256, 322, 406, 512, 645, 812, 1024, 1290,
+        1625, 2048, 2580, 3250, 4096, 5060, 6501, 8192, 10321, 13003,
+        16384, 20642, 26007, 32768, 41285, 52015, 65536, 82570, 104031,
+        131072, 165140, 208063, 262144, 330280, 416127, 524287, 660561,
+        832255, 1048576, 1321122, 1664510, 2097152, 2642245, 3329021,
+        4194304, 5284491, 6658042, 8388607, 10568983, 13316085, 16777216
+    };
+    const int numberOfMagicInts = sizeof(magicints) / sizeof(magicints[0]);
+
+    //-----------------------------------------------------//
+    //                        XDR                          //
+    //-----------------------------------------------------//
+    // xdr stores everything big endian in multiples of four bytes
+    bool readInt(std::istream& rFile, int& rValue)
+    {
+        unsigned char bytes[4];
+        if (!rFile.read((char*)bytes, 4)) return false;
+        rValue = (int)(((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3]);
+        return true;
+    }
+
+    bool readInt64(std::istream& rFile, int64_t& rValue)
+    {
+        int high, low;
+        if (!readInt(rFile, high) || !readInt(rFile, low)) return false;
+        rValue = (int64_t)(((uint64_t)(uint32_t)high << 32) | (uint64_t)(uint32_t)low);
+        return true;
+    }
+
+    bool readFloat(std::istream& rFile, float& rValue)
+    {
+        int bits;
+        if (!readInt(rFile, bits)) return false;
+        uint32_t unsignedBits = (uint32_t)bits;
+        std::memcpy(&rValue, &unsignedBits, 4);
+        return true;
+    }
+
+    //-----------------------------------------------------//
+    //                   BIT DECODING                      //
+    //-----------------------------------------------------//
+    struct BitReader {
+        const unsigned char* pData;
+        int64_t  size;
+        int64_t  count;
+        unsigned lastBits;
+        unsigned lastByte;
+    };
+
+    // reading behind the compressed bytes yields zeros and is reported by the caller
+    int decodeBits(BitReader& rReader, int numberOfBits)
+    {
+        unsigned mask = (numberOfBits < 32) ? (1u << numberOfBits) - 1 : 0xffffffffu;
+        unsigned num = 0;
+        while (numberOfBits >= 8) {
+            unsigned byte = (rReader.count < rReader.size) ? rReader.pData[rReader.count] : 0;
+            rReader.count++;
+            rReader.lastByte = (rReader.lastByte << 8) | byte;
+            num |= (rReader.lastByte >> rReader.lastBits) << (numberOfBits - 8);
+            numberOfBits -= 8;
+        }
+        if (numberOfBits > 0) {
+            if ((int)rReader.lastBits < numberOfBits) {
+                unsigned byte = (rReader.count < rReader.size) ? rReader.pData[rReader.count] : 0;
+                rReader.count++;
+                rReader.lastBits += 8;
+                rReader.lastByte = (rReader.lastByte << 8) | byte;
+            }
+            rReader.lastBits -= numberOfBits;
+            num |= (rReader.lastByte >> rReader.lastBits) & ((1u << numberOfBits) - 1);
+        }
+        return (int)(num & mask);
+    }
+
+    // three integers of the given ranges packed into one number of numberOfBits bits
+    void decodeInts(BitReader& rReader, int numberOfBits, const unsigned sizes[3], int nums[3])
+    {
+        int bytes[32];
+        int numberOfBytes = 0;
+        bytes[1] = bytes[2] = bytes[3] = 0;
+        while (numberOfBits > 8) {
+            bytes[numberOfBytes++] = decodeBits(rReader, 8);
+            numberOfBits -= 8;
+        }
+        if (numberOfBits > 0) {
+            bytes[numberOfBytes++] = decodeBits(rReader, numberOfBits);
+        }
+        for (int i = 2; i > 0; i--) {
+            unsigned num = 0;
+            for (int j = numberOfBytes - 1; j >= 0; j--) {
+                num = (num << 8) | (unsigned)bytes[j];
+                unsigned p = num / sizes[i];
+                bytes[j] = (int)p;
+                num = num - p * sizes[i];
+            }
+            nums[i] = (int)num;
+        }
+        nums[0] = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
+    }
+
+    int sizeOfInt(unsigned size)
+    {
+        unsigned num = 1;
+        int numberOfBits = 0;
+        while (size >= num && numberOfBits < 32) {
+            numberOfBits++;
+            num <<= 1;
+        }
+        return numberOfBits;
+    }
+
+    // bits needed for the product of the three ranges
+    int sizeOfInts(const unsigned sizes[3])
+    {
+        unsigned bytes[32];
+        int numberOfBytes = 1;
+        bytes[0] = 1;
+        for (int i = 0; i < 3; i++) {
+            unsigned tmp = 0;
+            int byteCount;
+            for (byteCount = 0; byteCount < numberOfBytes; byteCount++) {
+                tmp = bytes[byteCount] * sizes[i] + tmp;
+                bytes[byteCount] = tmp & 0xff;
+                tmp >>= 8;
+            }
+            while (tmp != 0) {
+                bytes[byteCount++] = tmp & 0xff;
+                tmp >>= 8;
+            }
+            numberOfBytes = byteCount;
+        }
+        unsigned num = 1;
+        int numberOfBits = 0;
+        numberOfBytes--;
+        while (bytes[numberOfBytes] >= num) {
+            numberOfBits++;
+            num *= 2;
+        }
+        return numberOfBits + numberOfBytes * 8;
+    }
+
+    //-----------------------------------------------------//
+    //                      FRAMES                         //
+    //-----------------------------------------------------//
+    /*
+     * frame layout: magic, atoms, step, time, box, atoms again and the coordinates.
+     * Up to nine atoms are stored as plain floats, more are compressed:
+     * precision, minint[3], maxint[3], smallidx, byte count and the padded bytes
+     */
+    bool readHeader(std::istream& rFile, int& rMagic, int& rNumberOfAtoms, XtcFrameInfo& rInfo)
+    {
+        if (!readInt(rFile, rMagic)) return false;
+        if (rMagic != XTC_MAGIC && rMagic != XTC_LARGE_MAGIC) {
+            Logger::instance().print("Unknown xtc magic number " + std::to_string(rMagic), Logger::Mode::ERROR);
+            return false;
+        }
+        if (!readInt(rFile, rNumberOfAtoms) || !readInt(rFile, rInfo.step) || !readFloat(rFile, rInfo.time)) return false;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                float value;
+                if (!readFloat(rFile, value)) return false;
+                rInfo.box[i][j] = value * 10.f;
+            }
+        }
+        int numberOfCoordinates;
+        if (!readInt(rFile, numberOfCoordinates) || numberOfCoordinates != rNumberOfAtoms) return false;
+        return true;
+    }
+
+    bool readByteCount(std::istream& rFile, int magic, int64_t& rByteCount)
+    {
+        if (magic == XTC_LARGE_MAGIC) return readInt64(rFile, rByteCount);
+        int byteCount;
+        if (!readInt(rFile, byteCount)) return false;
+        rByteCount = byteCount;
+        return byteCount >= 0;
+    }
+
+    // jumps behind the coordinates of a frame whose header has just been read
+    bool skipCoordinates(std::istream& rFile, int magic, int numberOfAtoms)
+    {
+        if (numberOfAtoms <= 9) {
+            return (bool)rFile.seekg(numberOfAtoms * 3 * 4, std::ios::cur);
+        }
+        rFile.seekg(4 * 8, std::ios::cur); // precision, minint, maxint and smallidx
+        int64_t byteCount;
+        if (!rFile || !readByteCount(rFile, magic, byteCount)) return false;
+        return (bool)rFile.seekg((byteCount + 3) & ~(int64_t)3, std::ios::cur);
+    }
+
+    bool decodeFrame(std::istream& rFile, int expectedAtoms, std::vector<unsigned char>& rBuffer, glm::vec3* pPositions, XtcFrameInfo* pInfo)
+    {
+        int magic, numberOfAtoms;
+        XtcFrameInfo info;
+        if (!readHeader(rFile, magic, numberOfAtoms, info)) return false;
+        if (numberOfAtoms != expectedAtoms) {
+            Logger::instance().print("Xtc frame with " + std::to_string(numberOfAtoms) + " atoms instead of " + std::to_string(expectedAtoms), Logger::Mode::ERROR);
+            return false;
+        }
+
+        // few atoms are not compressed
+        if (numberOfAtoms <= 9) {
+            for (int i = 0; i < numberOfAtoms; i++) {
+                for (int c = 0; c < 3; c++) {
+                    if (!readFloat(rFile, pPositions[i][c])) return false;
+                    pPositions[i][c] *= 10.f;
+                }
+            }
+            info.precision = 0.f;
+            if (pInfo) *pInfo = info;
+            return true;
+        }
+
+        int minint[3], maxint[3], smallidx;
+        int64_t byteCount;
+        if (!readFloat(rFile, info.precision)) return false;
+        for (int c = 0; c < 3; c++) if (!readInt(rFile, minint[c])) return false;
+        for (int c = 0; c < 3; c++) if (!readInt(rFile, maxint[c])) return false;
+        if (!readInt(rFile, smallidx) || !readByteCount(rFile, magic, byteCount)) return false;
+        if (smallidx < XTC_FIRSTIDX || smallidx >= numberOfMagicInts || info.precision <= 0.f) {
+            Logger::instance().print("Corrupt xtc frame at step " + std::to_string(info.step), Logger::Mode::ERROR);
+            return false;
+        }
+        int64_t paddedCount = (byteCount + 3) & ~(int64_t)3;
+        if ((int64_t)rBuffer.size() < paddedCount) rBuffer.resize((size_t)paddedCount);
+        if (!rFile.read((char*)rBuffer.data(), paddedCount)) return false;
+
+        // ranges of the large integers, the product has to fit into 32 bit for packing
+        unsigned sizeint[3], bitsizeint[3], sizesmall[3];
+        for (int c = 0; c < 3; c++) sizeint[c] = (unsigned)(maxint[c] - minint[c]) + 1;
+        int bitsize = 0;
+        if ((sizeint[0] | sizeint[1] | sizeint[2]) > 0xffffff) {
+            for (int c = 0; c < 3; c++) bitsizeint[c] = sizeOfInt(sizeint[c]);
+        } else {
+            bitsize = sizeOfInts(sizeint);
+        }
+
+        int smaller = magicints[std::max(XTC_FIRSTIDX, smallidx - 1)] / 2;
+        int smallnum = magicints[smallidx] / 2;
+        sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+
+        BitReader reader = {rBuffer.data(), byteCount, 0, 0, 0};
+        float scale = 10.f / info.precision; // nm to Angstrom
+        int i = 0;
+        int run = 0;
+        while (i < numberOfAtoms) {
+            int thiscoord[3], prevcoord[3];
+            if (bitsize == 0) {
+                for (int c = 0; c < 3; c++) thiscoord[c] = decodeBits(reader, bitsizeint[c]);
+            } else {
+                decodeInts(reader, bitsize, sizeint, thiscoord);
+            }
+            i++;
+            for (int c = 0; c < 3; c++) {
+                thiscoord[c] += minint[c];
+                prevcoord[c] = thiscoord[c];
+            }
+
+            int isSmaller = 0;
+            if (decodeBits(reader, 1) == 1) {
+                run = decodeBits(reader, 5);
+                isSmaller = run % 3;
+                run -= isSmaller;
+                isSmaller--;
+            }
+
+            /*
+             * a run of atoms stored as small differences to their predecessor. The first
+             * two atoms of a run are swapped, which compresses water molecules better
+             */
+            if (run > 0 && i + run / 3 > numberOfAtoms) {
+                Logger::instance().print("Corrupt xtc frame at step " + std::to_string(info.step), Logger::Mode::ERROR);
+                return false;
+            }
+            if (run > 0) {
+                for (int k = 0; k < run; k += 3) {
+                    decodeInts(reader, smallidx, sizesmall, thiscoord);
+                    i++;
+                    for (int c = 0; c < 3; c++) thiscoord[c] += prevcoord[c] - smallnum;
+                    if (k == 0) {
+                        std::swap(thiscoord[0], prevcoord[0]);
+                        std::swap(thiscoord[1], prevcoord[1]);
+                        std::swap(thiscoord[2], prevcoord[2]);
+                        *pPositions++ = glm::vec3(prevcoord[0], prevcoord[1], prevcoord[2]) * scale;
+                    } else {
+                        prevcoord[0] = thiscoord[0];
+                        prevcoord[1] = thiscoord[1];
+                        prevcoord[2] = thiscoord[2];
+                    }
+                    *pPositions++ = glm::vec3(thiscoord[0], thiscoord[1], thiscoord[2]) * scale;
+                }
+            } else {
+                *pPositions++ = glm::vec3(thiscoord[0], thiscoord[1], thiscoord[2]) * scale;
+            }
+
+            smallidx += isSmaller;
+            if (smallidx < XTC_FIRSTIDX || smallidx >= numberOfMagicInts) {
+                Logger::instance().print("Corrupt xtc frame at step " + std::to_string(info.step), Logger::Mode::ERROR);
+                return false;
+            }
+            if (isSmaller < 0) {
+                smallnum = smaller;
+                smaller = (smallidx > XTC_FIRSTIDX) ? magicints[smallidx - 1] / 2 : 0;
+            } else if (isSmaller > 0) {
+                smaller = smallnum;
+                smallnum = magicints[smallidx] / 2;
+            }
+            sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+        }
+        if (reader.count > reader.size) {
+            Logger::instance().print("Truncated xtc frame at step " + std::to_string(info.step), Logger::Mode::ERROR);
+            return false;
+        }
+
+        if (pInfo) *pInfo = info;
+        return true;
+    }
+}
+
+
+
+//-----------------------------------------------------//
+//                     READER                          //
+//-----------------------------------------------------//
+XtcReader::XtcReader()
+{
+}
+
+XtcReader::~XtcReader()
+{
+    close();
+}
+
+bool XtcReader::open(std::string filePath)
+{
+    close();
+    m_file.open(filePath, std::ios::binary);
+    if (!m_file.is_open()) {
+        Logger::instance().print("Could not open " + filePath, Logger::Mode::ERROR);
+        return false;
+    }
+
+    // the atom count of the first frame holds for the whole trajectory
+    int magic;
+    XtcFrameInfo info;
+    if (!readHeader(m_file, magic, m_numberOfAtoms, info)) {
+        Logger::instance().print("No xtc frame found in " + filePath, Logger::Mode::ERROR);
+        close();
+        return false;
+    }
+    m_file.seekg(0, std::ios::beg);
+    m_filePath = filePath;
+    return true;
+}
+
+void XtcReader::close()
+{
+    if (m_file.is_open()) m_file.close();
+    m_file.clear();
+    m_filePath.clear();
+    m_numberOfAtoms = 0;
+    m_nextFrame = 0;
+    m_indexed = false;
+    m_frameOffsets.clear();
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+}
+
+bool XtcReader::isOpen() const
+{
+    return m_file.is_open();
+}
+
+int XtcReader::getNumberOfAtoms() const
+{
+    return m_numberOfAtoms;
+}
+
+int XtcReader::getNumberOfFrames()
+{
+    if (!indexFrames()) return 0;
+    return (int)m_frameOffsets.size();
+}
+
+
+
+bool XtcReader::indexFrames()
+{
+    if (m_indexed) return true;
+    if (!isOpen()) return false;
+
+    // walk from header to header, the position of the sequential reading is kept
+    std::ifstream file(m_filePath, std::ios::binary);
+    m_frameOffsets.clear();
+    while (true) {
+        int64_t offset = (int64_t)file.tellg();
+        int magic, numberOfAtoms;
+        XtcFrameInfo info;
+        if (file.peek() == std::char_traits<char>::eof()) break;
+        if (!readHeader(file, magic, numberOfAtoms, info) || !skipCoordinates(file, magic, numberOfAtoms)) {
+            Logger::instance().print("Xtc file " + m_filePath + " ends with an incomplete frame, it is ignored", Logger::Mode::WARNING);
+            break;
+        }
+        file.peek(); // the seek behind the end is only noticed by the next read
+        if (!file) {
+            Logger::instance().print("Xtc file " + m_filePath + " ends with an incomplete frame, it is ignored", Logger::Mode::WARNING);
+            break;
+        }
+        m_frameOffsets.push_back(offset);
+    }
+    m_indexed = true;
+    return true;
+}
+
+bool XtcReader::seekFrame(int frame)
+{
+    if (!indexFrames() || frame < 0 || frame >= (int)m_frameOffsets.size()) {
+        Logger::instance().print("Xtc frame " + std::to_string(frame) + " does not exist", Logger::Mode::ERROR);
+        return false;
+    }
+    m_file.clear();
+    m_file.seekg(m_frameOffsets[frame], std::ios::beg);
+    m_nextFrame = frame;
+    return (bool)m_file;
+}
+
+bool XtcReader::readNextFrame(glm::vec3* pPositions, XtcFrameInfo* pInfo)
+{
+    if (!isOpen() || m_file.peek() == std::char_traits<char>::eof()) return false;
+    if (!decodeFrame(m_file, m_numberOfAtoms, m_buffer, pPositions, pInfo)) return false;
+    m_nextFrame++;
+    return true;
+}
+
+
+
+bool XtcReader::readFrames(int firstFrame, int numberOfFrames, glm::vec3* const* ppFrames, int threadCount, XtcFrameInfo* pInfos)
+{
+    if (!indexFrames()) return false;
+    if (firstFrame < 0 || numberOfFrames < 0 || firstFrame + numberOfFrames > (int)m_frameOffsets.size()) {
+        Logger::instance().print("Xtc frames " + std::to_string(firstFrame) + " to " + std::to_string(firstFrame + numberOfFrames - 1)
+                                 + " exceed the " + std::to_string(m_frameOffsets.size()) + " frames of " + m_filePath, Logger::Mode::ERROR);
+        return false;
+    }
+    threadCount = std::max(1, std::min(threadCount, numberOfFrames));
+
+    /*
+     * every thread decodes a contiguous chunk of frames with its own
+     * file handle and compressed buffer
+     */
+    std::atomic<bool> success(true);
+    auto decodeChunk = [&](int minFrame, int maxFrame)
+    {
+        std::ifstream file(m_filePath, std::ios::binary);
+        std::vector<unsigned char> buffer;
+        if (minFrame < maxFrame) file.seekg(m_frameOffsets[firstFrame + minFrame], std::ios::beg);
+        for (int f = minFrame; f < maxFrame && success; f++) {
+            if (!decodeFrame(file, m_numberOfAtoms, buffer, ppFrames[f], pInfos ? pInfos + f : 0x0)) success = false;
+        }
+    };
+
+    if (threadCount == 1) {
+        decodeChunk(0, numberOfFrames);
+    } else {
+        std::vector<std::thread> threads;
+        int chunkSize = numberOfFrames / threadCount;
+        for (int t = 0; t < threadCount; t++) {
+            int minFrame = t * chunkSize;
+            int maxFrame = (t == threadCount - 1) ? numberOfFrames : minFrame + chunkSize;
+            threads.push_back(std::thread(decodeChunk, minFrame, maxFrame));
+        }
+        for (auto& rThread : threads) {
+            rThread.join();
+        }
+    }
+    if (!success) {
+        Logger::instance().print("Could not decode all frames of " + m_filePath, Logger::Mode::ERROR);
+    }
+    return success;
+}
+
+bool XtcReader::readFrames(int firstFrame, int numberOfFrames, glm::vec3* pPositions, int threadCount, XtcFrameInfo* pInfos)
+{
+    std::vector<glm::vec3*> frames(std::max(0, numberOfFrames));
+    for (int f = 0; f < numberOfFrames; f++) {
+        frames[f] = pPositions + (size_t)f * m_numberOfAtoms;
+    }
+    return readFrames(firstFrame, numberOfFrames, frames.data(), threadCount, pInfos);
+}
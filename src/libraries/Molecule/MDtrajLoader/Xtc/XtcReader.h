@@ -0,0 +1,74 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#ifndef OPENGL_FRAMEWORK_XTCREADER_H
+#define OPENGL_FRAMEWORK_XTCREADER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+/*
+ * header of a trajectory frame, the box is in Angstrom
+ */
+struct XtcFrameInfo {
+    int       step;
+    float     time;         // ps
+    glm::mat3 box;          // box vectors as columns
+    float     precision;    // coordinates are stored as integers of 1/precision nm, 0 for uncompressed frames
+};
+
+/*
+ * Native reader for GROMACS xtc trajectories. Frames are decompressed straight
+ * into buffers of the caller, numberOfAtoms positions in Angstrom each, so
+ * besides the output only the compressed bytes of one frame are held per thread.
+ *
+ * Every frame stores its compressed size, so the frame offsets are indexed by
+ * skipping from header to header without decompressing anything. Since frames
+ * are independent, readFrames decodes them in parallel, every thread with its
+ * own file handle.
+ */
+class XtcReader
+{
+public:
+    XtcReader();
+    ~XtcReader();
+
+    bool open(std::string filePath);
+    void close();
+    bool isOpen() const;
+
+    int getNumberOfAtoms() const;
+    int getNumberOfFrames(); // indexes the frame offsets on the first call
+
+    /*
+     * sequential reading, the next frame is the one after the last read or seeked one
+     */
+    bool readNextFrame(glm::vec3* pPositions, XtcFrameInfo* pInfo = 0x0);
+    bool seekFrame(int frame);
+
+    /*
+     * Decodes numberOfFrames frames starting at firstFrame. The positions of frame
+     * firstFrame + f are written to ppFrames[f], or to pPositions + f * numberOfAtoms
+     * in the contiguous variant. pInfos, if given, gets one header per frame
+     */
+    bool readFrames(int firstFrame, int numberOfFrames, glm::vec3* const* ppFrames, int threadCount = 1, XtcFrameInfo* pInfos = 0x0);
+    bool readFrames(int firstFrame, int numberOfFrames, glm::vec3* pPositions, int threadCount = 1, XtcFrameInfo* pInfos = 0x0);
+
+private:
+    bool indexFrames();
+
+    std::string                m_filePath;
+    std::ifstream              m_file;
+    int                        m_numberOfAtoms = 0;
+    int                        m_nextFrame = 0;
+    bool                       m_indexed = false;
+    std::vector<int64_t>       m_frameOffsets;
+    std::vector<unsigned char> m_buffer;        // compressed bytes of the frame read sequentially
+};
+
+
+#endif //OPENGL_FRAMEWORK_XTCREADER_H
@@ -0,0 +1,216 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#include <fstream>
+#include "ContactMap.h"
+
+ContactMap::ContactMap(const std::vector<uint>& rResidues, const std::vector<uint>& rGroups)
+    : m_residues(rResidues), m_groups(rGroups)
+{
+    if (m_residues.size() != m_groups.size()) {
+        Logger::instance().print("Contact map got " + std::to_string(m_residues.size()) + " residues but "
+                                 + std::to_string(m_groups.size()) + " groups", Logger::Mode::ERROR);
+        size_t size = std::min(m_residues.size(), m_groups.size());
+        m_residues.resize(size);
+        m_groups.resize(size);
+    }
+}
+
+
+
+//-----------------------------------------------------//
+//                      FRAMES                         //
+//-----------------------------------------------------//
+void ContactMap::addFrame(const NeighborListCPU& neighborList, int numberOfElements, int threadCount)
+{
+    if ((size_t)numberOfElements > m_residues.size()) {
+        Logger::instance().print("Contact map got more particles than residues", Logger::Mode::ERROR);
+        return;
+    }
+    accumulateFrame(neighborList.p_neighborOffsets, neighborList.p_neighborIndices, neighborList.halfStencil, numberOfElements, threadCount);
+}
+
+void ContactMap::addFrame(const NeighborList& neighborList, int numberOfElements, int threadCount)
+{
+    if ((size_t)numberOfElements > m_residues.size()) {
+        Logger::instance().print("Contact map got more particles than residues", Logger::Mode::ERROR);
+        return;
+    }
+
+    // the list is only read on the host, so one readback of both buffers suffices
+    int*  neighborOffsets = GPUHandler::getDataFromSSBO<int>(neighborList.dp_neighborOffsets, numberOfElements + 1);
+    uint* neighborIndices = GPUHandler::getDataFromSSBO<uint>(neighborList.dp_neighborIndices, std::max(1, neighborList.numberOfNeighbors));
+    accumulateFrame(neighborOffsets, neighborIndices, neighborList.halfStencil, numberOfElements, threadCount);
+    delete[] neighborOffsets;
+    delete[] neighborIndices;
+}
+
+
+
+void ContactMap::accumulateFrame(const int* pNeighborOffsets, const uint* pNeighborIndices, bool halfList, int numberOfElements, int threadCount)
+{
+    threadCount = std::max(1, std::min(threadCount, numberOfElements));
+
+    /*
+     * every thread reduces the atom contacts of its chunk of particles to residue
+     * pairs. A full list holds every pair twice, there only i < j is counted
+     */
+    std::vector<std::unordered_map<uint64_t, ResidueContact>> threadContacts(threadCount);
+    auto reduceChunk = [&](int thread, int minIndex, int maxIndex)
+    {
+        std::unordered_map<uint64_t, ResidueContact>& rContacts = threadContacts[thread];
+        for (int i = minIndex; i < maxIndex; i++) {
+            for (int n = pNeighborOffsets[i]; n < pNeighborOffsets[i+1]; n++) {
+                uint j = pNeighborIndices[n];
+                if ((!halfList && j <= (uint)i) || j >= (uint)numberOfElements || m_groups[i] == m_groups[j]) continue;
+
+                bool firstLower = m_groups[i] < m_groups[j];
+                uint residueA = firstLower ? m_residues[i] : m_residues[j];
+                uint residueB = firstLower ? m_residues[j] : m_residues[i];
+                auto inserted = rContacts.insert({pairKey(residueA, residueB), ResidueContact{residueA, residueB, 0, 1}});
+                inserted.first->second.atomContacts++;
+            }
+        }
+    };
+
+    // same chunking as the neighborhood search
+    if (threadCount == 1) {
+        reduceChunk(0, 0, numberOfElements);
+    } else {
+        std::vector<std::thread> threads;
+        int chunkSize = numberOfElements / threadCount;
+        for (int t = 0; t < threadCount; t++) {
+            int minIndex = t * chunkSize;
+            int maxIndex = (t == threadCount - 1) ? numberOfElements : minIndex + chunkSize;
+            threads.push_back(std::thread(reduceChunk, t, minIndex, maxIndex));
+        }
+        for (auto& rThread : threads) {
+            rThread.join();
+        }
+    }
+
+    // merge the chunks, a residue pair may have been found by several threads
+    std::unordered_map<uint64_t, ResidueContact>& rFrameContacts = threadContacts[0];
+    for (int t = 1; t < threadCount; t++) {
+        for (auto& rEntry : threadContacts[t]) {
+            auto inserted = rFrameContacts.insert(rEntry);
+            if (!inserted.second) inserted.first->second.atomContacts += rEntry.second.atomContacts;
+        }
+    }
+
+    /*
+     * add the frame to the map and stream it out in a fixed order,
+     * so the output does not depend on the thread count
+     */
+    std::vector<ResidueContact> frameContacts;
+    frameContacts.reserve(rFrameContacts.size());
+    for (auto& rEntry : rFrameContacts) {
+        auto inserted = m_contacts.insert(rEntry);
+        if (!inserted.second) {
+            inserted.first->second.atomContacts += rEntry.second.atomContacts;
+            inserted.first->second.frames++;
+        }
+        if (mp_frameStream) frameContacts.push_back(rEntry.second);
+    }
+
+    if (mp_frameStream) {
+        std::sort(frameContacts.begin(), frameContacts.end(), [](const ResidueContact& a, const ResidueContact& b) {
+            return a.residueA < b.residueA || (a.residueA == b.residueA && a.residueB < b.residueB);
+        });
+        for (auto& rContact : frameContacts) {
+            *mp_frameStream << m_numberOfFrames << " " << rContact.residueA << " " << rContact.residueB << " " << rContact.atomContacts << "\n";
+        }
+        mp_frameStream->flush();
+    }
+
+    m_numberOfFrames++;
+}
+
+
+
+//-----------------------------------------------------//
+//                      EXPORT                         //
+//-----------------------------------------------------//
+void ContactMap::setFrameStream(std::ostream* pStream)
+{
+    mp_frameStream = pStream;
+}
+
+void ContactMap::write(std::ostream& rStream) const
+{
+    rStream << "# frames " << m_numberOfFrames << "\n";
+    rStream << "# residueA residueB atomContacts frames frequency\n";
+    for (auto& rContact : getContacts()) {
+        float frequency = (float)rContact.frames / (float)std::max(1u, m_numberOfFrames);
+        rStream << rContact.residueA << " " << rContact.residueB << " " << rContact.atomContacts << " " << rContact.frames << " " << frequency << "\n";
+    }
+}
+
+bool ContactMap::writeToFile(std::string filePath) const
+{
+    std::ofstream file(filePath);
+    if (!file.is_open()) {
+        Logger::instance().print("Could not open " + filePath + " for the contact map", Logger::Mode::ERROR);
+        return false;
+    }
+    write(file);
+    return file.good();
+}
+
+
+
+//-----------------------------------------------------//
+//                      GETTER                         //
+//-----------------------------------------------------//
+uint ContactMap::getNumberOfFrames() const
+{
+    return m_numberOfFrames;
+}
+
+size_t ContactMap::getNumberOfResiduePairs() const
+{
+    return m_contacts.size();
+}
+
+ResidueContact ContactMap::getContact(uint residueA, uint residueB) const
+{
+    auto entry = m_contacts.find(pairKey(residueA, residueB));
+    if (entry == m_contacts.end()) return ResidueContact{residueA, residueB, 0, 0};
+    return entry->second;
+}
+
+float ContactMap::getFrequency(uint residueA, uint residueB) const
+{
+    if (m_numberOfFrames == 0) return 0.f;
+    return (float)getContact(residueA, residueB).frames / (float)m_numberOfFrames;
+}
+
+std::vector<ResidueContact> ContactMap::getContacts() const
+{
+    std::vector<ResidueContact> contacts;
+    contacts.reserve(m_contacts.size());
+    for (auto& rEntry : m_contacts) {
+        contacts.push_back(rEntry.second);
+    }
+    std::sort(contacts.begin(), contacts.end(), [](const ResidueContact& a, const ResidueContact& b) {
+        return a.residueA < b.residueA || (a.residueA == b.residueA && a.residueB < b.residueB);
+    });
+    return contacts;
+}
+
+void ContactMap::clear()
+{
+    m_contacts.clear();
+    m_numberOfFrames = 0;
+}
+
+
+
+// residue pairs are stored independent of the order they are asked for
+uint64_t ContactMap::pairKey(uint residueA, uint residueB) const
+{
+    uint lower = std::min(residueA, residueB);
+    uint upper = std::max(residueA, residueB);
+    return ((uint64_t)lower << 32) | upper;
+}
@@ -0,0 +1,87 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+#ifndef OPENGL_FRAMEWORK_CONTACTMAP_H
+#define OPENGL_FRAMEWORK_CONTACTMAP_H
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "GPUHandler.h"
+#include "Utils/Logger.h"
+#include "NeighborhoodSearchDefines.h"
+
+/*
+ * accumulated contacts of one residue pair, residueA belongs
+ * to the group with the lower index
+ */
+struct ResidueContact {
+    uint     residueA;
+    uint     residueB;
+    uint64_t atomContacts;  // atom pairs in contact, summed over all frames
+    uint     frames;        // frames with at least one atom pair in contact
+};
+
+/*
+ * Residue contact map between groups of particles, e.g. proteins. Every frame
+ * takes a neighbor list, atoms of different groups in that list are in contact.
+ * The contacts are reduced to residue pairs in parallel and accumulated over
+ * the frames in a sparse map, only residue pairs that were ever in contact are
+ * stored. Residues are indexed globally, so residues of different groups never
+ * share an index.
+ */
+class ContactMap {
+public:
+    /*
+     * residue and group of every particle by original index
+     */
+    ContactMap(const std::vector<uint>& rResidues, const std::vector<uint>& rGroups);
+
+    /*
+     * Accumulates the contacts of one frame from a neighbor list built for the
+     * given number of particles. The GPU list is read back first
+     */
+    void addFrame(const NeighborListCPU& neighborList, int numberOfElements, int threadCount = 1);
+    void addFrame(const NeighborList& neighborList, int numberOfElements, int threadCount = 1);
+
+    /*
+     * Every added frame is written to the stream as soon as it is accumulated,
+     * one line "frame residueA residueB atomContacts" per residue pair in contact.
+     * The stream stays owned by the caller, 0x0 stops streaming
+     */
+    void setFrameStream(std::ostream* pStream);
+
+    /*
+     * Writes the accumulated map, one line
+     * "residueA residueB atomContacts frames frequency" per residue pair
+     */
+    void write(std::ostream& rStream) const;
+    bool writeToFile(std::string filePath) const;
+
+    uint getNumberOfFrames() const;
+    size_t getNumberOfResiduePairs() const;
+    ResidueContact getContact(uint residueA, uint residueB) const; // zero counts if never in contact
+    float getFrequency(uint residueA, uint residueB) const;        // fraction of frames in contact
+    std::vector<ResidueContact> getContacts() const;               // sorted by residueA and residueB
+    void clear();
+
+private:
+    void accumulateFrame(const int* pNeighborOffsets, const uint* pNeighborIndices, bool halfList, int numberOfElements, int threadCount);
+    uint64_t pairKey(uint residueA, uint residueB) const;
+
+    std::vector<uint>  m_residues;
+    std::vector<uint>  m_groups;
+    std::unordered_map<uint64_t, ResidueContact> m_contacts;
+    uint               m_numberOfFrames = 0;
+    std::ostream*      mp_frameStream = 0x0;
+};
+
+
+#endif //OPENGL_FRAMEWORK_CONTACTMAP_H
@@ -13,6 +13,14 @@
 #include "NeighborhoodSearchDefines.h"
 #include "../../executables/NeighborSearchTest/SimpleAtom.h"
 
+/*
+ * texel formats for clearing buffers of 32 bit scalars on the device
+ */
+template<class T> struct SSBOClearFormat;
+template<> struct SSBOClearFormat<int>   { static const GLenum internalFormat = GL_R32I;  static const GLenum format = GL_RED_INTEGER; static const GLenum type = GL_INT;          };
+template<> struct SSBOClearFormat<uint>  { static const GLenum internalFormat = GL_R32UI; static const GLenum format = GL_RED_INTEGER; static const GLenum type = GL_UNSIGNED_INT; };
+template<> struct SSBOClearFormat<float> { static const GLenum internalFormat = GL_R32F;  static const GLenum format = GL_RED;         static const GLenum type = GL_FLOAT;        };
+
 class GPUHandler {
 public:
     /*
@@ -31,6 +39,22 @@ public:
         }
     }
 
+    /*
+     * reallocate the storage of an existing ssbo, the handle stays the same
+     * and the previous content is lost
+     */
+    template<class T>
+    static void resizeSSBO(GLuint* ssboHandler, int length){
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, *ssboHandler);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(T)*length, NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            Logger::instance().print("Error while resizing SSBO: " + std::to_string(err), Logger::Mode::ERROR);
+        }
+    }
+
     /*
      * fill every block of the ssbo with the provided value
      */
@@ -52,6 +76,25 @@ public:
         delete[] values;
     }
 
+    /*
+     * set the first length entries of the ssbo to the provided value on the device,
+     * nothing is allocated or transferred on the host. Shader writes before the
+     * clear need a memory barrier like any other buffer update
+     */
+    template<class T>
+    static void clearSSBO(GLuint* ssboHandler, int length, T value){
+        if (length <= 0) return;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, *ssboHandler);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, SSBOClearFormat<T>::internalFormat, 0, sizeof(T)*length,
+                             SSBOClearFormat<T>::format, SSBOClearFormat<T>::type, &value);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            Logger::instance().print("Error while clearing SSBO: " + std::to_string(err), Logger::Mode::ERROR);
+        }
+    }
+
     /*
      * transfer data from or to the ssbo
      */
@@ -59,8 +102,9 @@ public:
     static void copyDataToSSBO(GLuint* targetHandler, T* data, int length){
         glBindBuffer(GL_SHADER_STORAGE_BUFFER, *targetHandler);
         GLvoid* p = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY);
-        memcpy(p, &data, sizeof(T)*length);
+        memcpy(p, data, sizeof(T)*length);
         glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
     }
     template<class T>
     static T* getDataFromSSBO(GLuint* ssboHandler, int length)
@@ -77,6 +121,16 @@ public:
         return data;
     }
 
+    template<class T>
+    static T getValueFromSSBO(GLuint* ssboHandler, int index)
+    {
+        T value;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, *ssboHandler);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(T)*index, sizeof(T), &value);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        return value;
+    }
+
     /*
      * prints the specified number of entries of the ssbo
      */
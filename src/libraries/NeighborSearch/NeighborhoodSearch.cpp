@@ -7,8 +7,10 @@
 NeighborhoodSearch::~NeighborhoodSearch()
 {
     Logger::instance().print("Destroy NeighborhoodSearch object");
-    freeGrid();
-    deallocateBuffers();
+    if (m_backend == Backend::GPU) {
+        deallocateBuffers();
+        deallocBlockSumsInt();
+    }
 }
 
 
@@ -23,6 +25,10 @@ glm::vec3 NeighborhoodSearch::getGridSize()
 {
     return m_gridSize;
 }
+glm::vec3 NeighborhoodSearch::getPeriodicBox()
+{
+    return m_periodicBox;
+}
 glm::ivec3 NeighborhoodSearch::getGridResolution()
 {
     return m_gridRes;
@@ -64,36 +70,174 @@ float NeighborhoodSearch::getMaxSearchRadius()
 {
     return m_maxSearchRadius;
 }
+NeighborhoodSearch::Backend NeighborhoodSearch::getBackend()
+{
+    return m_backend;
+}
+void NeighborhoodSearch::setCellOrder(CellOrder cellOrder)
+{
+    m_requestedCellOrder = cellOrder;
+}
+NeighborhoodSearch::CellOrder NeighborhoodSearch::getCellOrder()
+{
+    return m_cellOrder;
+}
+void NeighborhoodSearch::setGridType(GridType gridType)
+{
+    m_requestedGridType = gridType;
+}
+NeighborhoodSearch::GridType NeighborhoodSearch::getGridType()
+{
+    return m_hashed ? GridType::Hashed : GridType::Dense;
+}
+void NeighborhoodSearch::setStencil(Stencil stencil)
+{
+    m_stencil = stencil;
+}
+NeighborhoodSearch::Stencil NeighborhoodSearch::getStencil()
+{
+    return m_stencil;
+}
+void NeighborhoodSearch::setDeterministic(bool deterministic)
+{
+    m_deterministic = deterministic;
+    m_structureValid = false; // a kept structure would still have the order of the atomics
+}
+bool NeighborhoodSearch::getDeterministic()
+{
+    return m_deterministic;
+}
+void NeighborhoodSearch::setSkin(float skin)
+{
+    m_requestedSkin = std::max(0.f, skin);
+}
+float NeighborhoodSearch::getSkin()
+{
+    return m_skin;
+}
+uint NeighborhoodSearch::getRunCount()
+{
+    return m_runCount;
+}
+uint NeighborhoodSearch::getRebuildCount()
+{
+    return m_rebuildCount;
+}
+float NeighborhoodSearch::getRebuildRate()
+{
+    return (m_runCount > 0) ? (float)m_rebuildCount / (float)m_runCount : 0.f;
+}
+void NeighborhoodSearch::resetRebuildStatistics()
+{
+    m_runCount = 0;
+    m_rebuildCount = 0;
+}
+void NeighborhoodSearch::setElementRadii(GLuint* radiiSSBO, float probeRadius)
+{
+    m_radiiSSBO = radiiSSBO;
+    m_cpuRadii.clear();
+    m_probeRadius = std::max(0.f, probeRadius);
+    m_pairwiseCutoff = true;
+}
+void NeighborhoodSearch::setElementRadii(const std::vector<float>& rRadii, float probeRadius)
+{
+    m_radiiSSBO = 0x0;
+    m_cpuRadii = rRadii;
+    m_probeRadius = std::max(0.f, probeRadius);
+    m_pairwiseCutoff = true;
+}
+void NeighborhoodSearch::clearElementRadii()
+{
+    m_radiiSSBO = 0x0;
+    m_cpuRadii.clear();
+    m_probeRadius = 0.f;
+    m_pairwiseCutoff = false;
+}
+float NeighborhoodSearch::getMaxElementRadius()
+{
+    return m_maxElementRadius;
+}
+void NeighborhoodSearch::setProfiling(bool profiling)
+{
+    m_profiling = profiling;
+}
+bool NeighborhoodSearch::getProfiling()
+{
+    return m_profiling;
+}
+StageTimings NeighborhoodSearch::getStageTimings()
+{
+    // timers store microseconds and cannot average without any duration
+    auto average = [](Timer& rTimer) { return rTimer.durations.empty() ? 0.0 : rTimer.getDuration() / 1000.0; };
+    StageTimings timings;
+    timings.insert = average(m_insertTimer);
+    timings.scan   = average(m_scanTimer);
+    timings.sort   = average(m_sortTimer);
+    timings.total  = timings.insert + timings.scan + timings.sort;
+    return timings;
+}
+void NeighborhoodSearch::resetStageTimings()
+{
+    m_insertTimer = Timer();
+    m_scanTimer   = Timer();
+    m_sortTimer   = Timer();
+}
+void NeighborhoodSearch::printStageTimings()
+{
+    StageTimings timings = getStageTimings();
+    Logger::instance().print("Grid " + std::to_string(m_gridRes.x) + "x" + std::to_string(m_gridRes.y) + "x" + std::to_string(m_gridRes.z)
+                             + " with " + std::to_string(m_gridTotal) + (m_hashed ? " hashed" : "") + " cells:"); Logger::instance().tabIn();
+    Logger::instance().print("insert: " + std::to_string(timings.insert) + " ms");
+    Logger::instance().print("scan:   " + std::to_string(timings.scan) + " ms");
+    Logger::instance().print("sort:   " + std::to_string(timings.sort) + " ms");
+    Logger::instance().print("total:  " + std::to_string(timings.total) + " ms");
+    Logger::instance().tabOut();
+}
 
 
 
 //-----------------------------------------------------//
 //                   INITIALIZATION                    //
 //-----------------------------------------------------//
-void NeighborhoodSearch::init(uint numElements, glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius)
+void NeighborhoodSearch::init(uint numElements, glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius, Backend backend, glm::vec3 periodicBox)
 {
     m_numElements = numElements;    // save number of elements for later calculations
-    setupGrid(min, max, resolution, searchRadius);
+    m_backend = backend;
+    if (resolution.x <= 0 || resolution.y <= 0 || resolution.z <= 0) {
+        resolution = suggestResolution(numElements, min, max, searchRadius, periodicBox);
+    }
+    setupGrid(min, max, resolution, searchRadius, periodicBox);
+
+    // cpu backend only needs host memory
+    if (m_backend == Backend::CPU) {
+        allocateHostBuffers(numElements);
+        return;
+    }
+
     calculateNumberOfBlocksAndThreads(numElements);
     setupComputeShaders();
-    allocateBuffers(numElements);
-    //preallocBlockSumsInt(1);
-    //deallocBlockSumsInt();
-    preallocBlockSumsInt(m_gridTotal);
+    reserveBuffers(numElements, m_gridTotal);
 }
 
 
 
-void NeighborhoodSearch::update(uint numElements, glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius)
+void NeighborhoodSearch::update(uint numElements, glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius, glm::vec3 periodicBox)
 {
     m_numElements = numElements;
-    freeGrid();
-    setupGrid(min, max, resolution, searchRadius);
+    if (resolution.x <= 0 || resolution.y <= 0 || resolution.z <= 0) {
+        resolution = suggestResolution(numElements, min, max, searchRadius, periodicBox);
+    }
+    setupGrid(min, max, resolution, searchRadius, periodicBox);
+
+    // backend stays the one chosen at initialization
+    if (m_backend == Backend::CPU) {
+        allocateHostBuffers(numElements);
+        return;
+    }
+
+    // buffers are only reallocated if they are too small
     calculateNumberOfBlocksAndThreads(numElements);
-    deallocateBuffers();
-    allocateBuffers(numElements);
-    deallocBlockSumsInt();
-    preallocBlockSumsInt(m_gridTotal);
+    reserveBuffers(numElements, m_gridTotal);
 }
 
 
@@ -105,69 +249,140 @@ void NeighborhoodSearch::setupComputeShaders()
     m_uniformAddIntShader               = ShaderProgram("/NeighborSearch/neighborhoodSearch/uniformAddInt.comp");
     m_fillTempDataShader                = ShaderProgram("/NeighborSearch/neighborhoodSearch/fillTempData.comp");
     m_countingSortShader                = ShaderProgram("/NeighborSearch/neighborhoodSearch/countingSort.comp");
+    m_stableCellRankShader              = ShaderProgram("/NeighborSearch/neighborhoodSearch/stableCellRank.comp");
+    m_maxDisplacementShader             = ShaderProgram("/NeighborSearch/neighborhoodSearch/maxDisplacement.comp");
+    m_neighborListShader                = ShaderProgram("/NeighborSearch/neighborhoodSearch/neighborList.comp");
+    m_nearestNeighborsShader            = ShaderProgram("/NeighborSearch/neighborhoodSearch/nearestNeighbors.comp");
 }
 
 
 
-void NeighborhoodSearch::allocateBuffers(uint numElements)
+void NeighborhoodSearch::reserveBuffers(uint numElements, uint numCells)
 {
-    // element related buffers
-    m_gpuBuffers.dp_pos       = new GLuint;
-    m_gpuBuffers.dp_gcell     = new GLuint;
-    m_gpuBuffers.dp_gndx      = new GLuint;
-    // grid related buffers
-    m_gpuBuffers.dp_gridcnt   = new GLuint;
-    m_gpuBuffers.dp_gridoff   = new GLuint;
-    m_gpuBuffers.dp_grid      = new GLuint;
-    // temp buffers
-    m_gpuBuffers.dp_tempPos   = new GLuint;
-    m_gpuBuffers.dp_tempGcell = new GLuint;
-    m_gpuBuffers.dp_tempGndx  = new GLuint;
-    // final results
-    m_gpuBuffers.dp_undx      = new GLuint;
-
-
-    // init ssbo's
-    GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_gcell,     numElements);
-    GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_gndx,      numElements);
-
-    GPUHandler::initSSBO<int>      (m_gpuBuffers.dp_gridcnt,   m_gridTotal);
-    GPUHandler::initSSBO<int>      (m_gpuBuffers.dp_gridoff,   m_gridTotal);
-    GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_grid,      numElements);
-
-    GPUHandler::initSSBO<glm::vec4>(m_gpuBuffers.dp_tempPos,   numElements);
-    GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_tempGcell, numElements);
-    GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_tempGndx,  numElements);
-
-    GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_undx,      numElements);
+    /*
+     * handles are created once, later updates only resize the storage behind them.
+     * Positions are provided by the caller with every run and are not owned
+     */
+    if (m_gpuBuffers.dp_gcell == 0x0) {
+        // element related buffers
+        m_gpuBuffers.dp_sortedPos = new GLuint;
+        m_gpuBuffers.dp_gcell     = new GLuint;
+        m_gpuBuffers.dp_gndx      = new GLuint;
+        // grid related buffers
+        m_gpuBuffers.dp_gridcnt   = new GLuint;
+        m_gpuBuffers.dp_gridoff   = new GLuint;
+        m_gpuBuffers.dp_grid      = new GLuint;
+        // temp buffers
+        m_gpuBuffers.dp_tempPos   = new GLuint;
+        m_gpuBuffers.dp_tempGcell = new GLuint;
+        m_gpuBuffers.dp_tempGndx  = new GLuint;
+        // final results
+        m_gpuBuffers.dp_undx      = new GLuint;
+        m_gpuBuffers.dp_gridadj   = new GLuint;
+        // verlet skin
+        m_gpuBuffers.dp_refPos       = new GLuint;
+        m_gpuBuffers.dp_displacement = new GLuint;
+        // neighbor list
+        m_gpuBuffers.dp_neighborCnt  = new GLuint;
+        m_gpuBuffers.dp_neighborOff  = new GLuint;
+        m_gpuBuffers.dp_neighbors    = new GLuint;
+        // nearest neighbors
+        m_gpuBuffers.dp_knnIndices   = new GLuint;
+        m_gpuBuffers.dp_knnDistances = new GLuint;
+        // deterministic order
+        m_gpuBuffers.dp_rankPairs     = new GLuint;
+        m_gpuBuffers.dp_rankPairsTemp = new GLuint;
+        m_gpuBuffers.dp_rankFlags     = new GLuint;
+        m_gpuBuffers.dp_rankOff       = new GLuint;
+
+        GPUHandler::initSSBO<glm::vec4>(m_gpuBuffers.dp_sortedPos, 0);
+        GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_gcell,     0);
+        GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_gndx,      0);
+        GPUHandler::initSSBO<int>      (m_gpuBuffers.dp_gridcnt,   0);
+        GPUHandler::initSSBO<int>      (m_gpuBuffers.dp_gridoff,   0);
+        GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_grid,      0);
+        GPUHandler::initSSBO<glm::vec4>(m_gpuBuffers.dp_tempPos,   0);
+        GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_tempGcell, 0);
+        GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_tempGndx,  0);
+        GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_undx,      0);
+        GPUHandler::initSSBO<int>      (m_gpuBuffers.dp_gridadj,   0);
+        GPUHandler::initSSBO<glm::vec4>(m_gpuBuffers.dp_refPos,    0);
+        GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_displacement, 1);
+        GPUHandler::initSSBO<int>      (m_gpuBuffers.dp_neighborCnt, 0);
+        GPUHandler::initSSBO<int>      (m_gpuBuffers.dp_neighborOff, 0);
+        GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_neighbors,   0);
+        GPUHandler::initSSBO<uint>     (m_gpuBuffers.dp_knnIndices,  0);
+        GPUHandler::initSSBO<float>    (m_gpuBuffers.dp_knnDistances, 0);
+        GPUHandler::initSSBO<glm::uvec2>(m_gpuBuffers.dp_rankPairs,     0);
+        GPUHandler::initSSBO<glm::uvec2>(m_gpuBuffers.dp_rankPairsTemp, 0);
+        GPUHandler::initSSBO<int>      (m_gpuBuffers.dp_rankFlags,   0);
+        GPUHandler::initSSBO<int>      (m_gpuBuffers.dp_rankOff,     0);
+    }
 
+    // grow geometrically, so that slowly increasing sizes do not reallocate every time
+    if (numElements > m_elementCapacity) {
+        m_elementCapacity = std::max(numElements, 2 * m_elementCapacity);
+        GPUHandler::resizeSSBO<glm::vec4>(m_gpuBuffers.dp_sortedPos, m_elementCapacity);
+        GPUHandler::resizeSSBO<uint>     (m_gpuBuffers.dp_gcell,     m_elementCapacity);
+        GPUHandler::resizeSSBO<uint>     (m_gpuBuffers.dp_gndx,      m_elementCapacity);
+        GPUHandler::resizeSSBO<uint>     (m_gpuBuffers.dp_grid,      m_elementCapacity);
+        GPUHandler::resizeSSBO<glm::vec4>(m_gpuBuffers.dp_tempPos,   m_elementCapacity);
+        GPUHandler::resizeSSBO<uint>     (m_gpuBuffers.dp_tempGcell, m_elementCapacity);
+        GPUHandler::resizeSSBO<uint>     (m_gpuBuffers.dp_tempGndx,  m_elementCapacity);
+        GPUHandler::resizeSSBO<uint>     (m_gpuBuffers.dp_undx,      m_elementCapacity);
+        GPUHandler::resizeSSBO<glm::vec4>(m_gpuBuffers.dp_refPos,    m_elementCapacity);
+        GPUHandler::resizeSSBO<int>      (m_gpuBuffers.dp_neighborCnt, m_elementCapacity + 1);
+        GPUHandler::resizeSSBO<int>      (m_gpuBuffers.dp_neighborOff, m_elementCapacity + 1);
+        GPUHandler::resizeSSBO<glm::uvec2>(m_gpuBuffers.dp_rankPairs,     m_elementCapacity);
+        GPUHandler::resizeSSBO<glm::uvec2>(m_gpuBuffers.dp_rankPairsTemp, m_elementCapacity);
+        GPUHandler::resizeSSBO<int>      (m_gpuBuffers.dp_rankFlags,   m_elementCapacity + 1);
+        GPUHandler::resizeSSBO<int>      (m_gpuBuffers.dp_rankOff,     m_elementCapacity + 1);
+    }
+    if (numCells > m_cellCapacity) {
+        m_cellCapacity = std::max(numCells, 2 * m_cellCapacity);
+        GPUHandler::resizeSSBO<int>      (m_gpuBuffers.dp_gridcnt,   m_cellCapacity);
+        GPUHandler::resizeSSBO<int>      (m_gpuBuffers.dp_gridoff,   m_cellCapacity);
+    }
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, *m_gpuBuffers.dp_gcell);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, *m_gpuBuffers.dp_gndx);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, *m_gpuBuffers.dp_gridcnt);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, *m_gpuBuffers.dp_gridoff);
-    // TODO: maybe bind some of the other buffers here
-    // slots 5 to 7 are used for temporary buffers in unifromAddInt and prescanInt
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, *m_gpuBuffers.dp_grid);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, *m_gpuBuffers.dp_tempPos);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,10, *m_gpuBuffers.dp_tempGcell);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,11, *m_gpuBuffers.dp_tempGndx);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,12, *m_gpuBuffers.dp_undx);
+    // block sums have to cover the scan of the cells and of the neighbor counts or rank flags
+    uint scanSize = std::max(m_cellCapacity, m_elementCapacity + 1);
+    if (scanSize > m_scanCapacity) {
+        m_scanCapacity = scanSize;
+        deallocBlockSumsInt();
+        preallocBlockSumsInt(m_scanCapacity);
+    }
+    if ((uint)m_gridAdjCnt > m_searchCellCapacity) {
+        m_searchCellCapacity = std::max((uint)m_gridAdjCnt, 2 * m_searchCellCapacity);
+        GPUHandler::resizeSSBO<int>      (m_gpuBuffers.dp_gridadj,   m_searchCellCapacity);
+    }
 
+    // search cells are small and change with every grid setup
+    GPUHandler::copyDataToSSBO<int>(m_gpuBuffers.dp_gridadj, m_gridAdj.data(), m_gridAdjCnt);
 }
 void NeighborhoodSearch::deallocateBuffers()
 {
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_pos);
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_gcell);
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_gndx);
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_gridcnt);
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_gridoff);
-
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_grid);
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_tempPos);
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_tempGcell);
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_tempGndx);
-    GPUHandler::deleteSSBO(m_gpuBuffers.dp_undx);
+    if (m_gpuBuffers.dp_gcell == 0x0) return;
+
+    GLuint** handles[] = {
+        &m_gpuBuffers.dp_gcell,   &m_gpuBuffers.dp_gndx,     &m_gpuBuffers.dp_gridcnt,
+        &m_gpuBuffers.dp_gridoff, &m_gpuBuffers.dp_grid,     &m_gpuBuffers.dp_tempPos,
+        &m_gpuBuffers.dp_tempGcell, &m_gpuBuffers.dp_tempGndx, &m_gpuBuffers.dp_undx,
+        &m_gpuBuffers.dp_gridadj, &m_gpuBuffers.dp_refPos, &m_gpuBuffers.dp_displacement,
+        &m_gpuBuffers.dp_sortedPos, &m_gpuBuffers.dp_neighborCnt, &m_gpuBuffers.dp_neighborOff,
+        &m_gpuBuffers.dp_neighbors, &m_gpuBuffers.dp_knnIndices, &m_gpuBuffers.dp_knnDistances,
+        &m_gpuBuffers.dp_rankPairs, &m_gpuBuffers.dp_rankPairsTemp, &m_gpuBuffers.dp_rankFlags,
+        &m_gpuBuffers.dp_rankOff };
+    for (GLuint** pHandle : handles) {
+        GPUHandler::deleteSSBO(*pHandle);
+        delete *pHandle;
+        *pHandle = 0x0;
+    }
+    m_elementCapacity = 0;
+    m_cellCapacity = 0;
+    m_searchCellCapacity = 0;
+    m_scanCapacity = 0;
+    m_neighborCapacity = 0;
+    m_knnCapacity = 0;
 }
 
 
@@ -232,15 +447,53 @@ void NeighborhoodSearch::deallocBlockSumsInt()
     if (m_scanBlockSumsInt != 0x0) {
         for (uint i = 0; i < m_numLevelsAllocated; i++) {
             GPUHandler::deleteSSBO(m_scanBlockSumsInt[i]);
+            delete m_scanBlockSumsInt[i];
         }
         free(m_scanBlockSumsInt);
+        m_scanBlockSumsInt = 0x0;
+        m_numLevelsAllocated = 0;
     }
 }
 
 
 
-void NeighborhoodSearch::setupGrid(glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius)
+void NeighborhoodSearch::updateMaxElementRadius(uint numElements)
 {
+    m_maxElementRadius = 0.f;
+    if (!m_pairwiseCutoff || numElements == 0) return;
+
+    if (m_backend == Backend::GPU && m_radiiSSBO != 0x0) {
+        float* pRadii = GPUHandler::getDataFromSSBO<float>(m_radiiSSBO, numElements);
+        m_maxElementRadius = *std::max_element(pRadii, pRadii + numElements);
+        delete[] pRadii;
+    } else if (m_backend == Backend::CPU && m_cpuRadii.size() >= (size_t)numElements) {
+        m_maxElementRadius = *std::max_element(m_cpuRadii.begin(), m_cpuRadii.begin() + numElements);
+    } else {
+        Logger::instance().print("Element radii do not match the backend or the number of elements, pairwise cutoffs are disabled", Logger::Mode::WARNING);
+        clearElementRadii();
+    }
+}
+float NeighborhoodSearch::pairwiseSearchRadius(float searchRadius) const
+{
+    // the largest pair of elements has the cutoff 2 maxRadius + 2 probeRadius
+    if (!m_pairwiseCutoff) return searchRadius;
+    return std::max(searchRadius, 2.f * (m_maxElementRadius + m_probeRadius));
+}
+
+
+
+void NeighborhoodSearch::setupGrid(glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius, glm::vec3 periodicBox)
+{
+    // periodic axes span exactly one box
+    m_periodicBox = periodicBox;
+    for (int a = 0; a < 3; a++) {
+        if (m_periodicBox[a] > 0.f) {
+            max[a] = min[a] + m_periodicBox[a];
+        } else {
+            m_periodicBox[a] = 0.f;
+        }
+    }
+
     // calculate grid parameters
     m_gridMin = min;
     m_gridMax = max;
@@ -252,17 +505,46 @@ void NeighborhoodSearch::setupGrid(glm::fvec3 min, glm::fvec3 max, glm::ivec3 re
     m_cellSize = std::max(cellSizes.x, std::max(cellSizes.y, cellSizes.z));
     m_gridSize  = m_gridRes; // update grid size to be a multiple of the cell size
     m_gridSize *= m_cellSize;
+    for (int a = 0; a < 3; a++) {
+        if (m_periodicBox[a] > 0.f) m_gridSize[a] = m_periodicBox[a]; // cells must tile the box exactly
+    }
     m_gridMax = m_gridMin + m_gridSize;
     m_gridDelta = m_gridRes;
     m_gridDelta /= m_gridSize;
-    m_gridTotal = m_gridRes.x * m_gridRes.y * m_gridRes.z;
-    m_searchRadius = searchRadius;
+    m_cellOrder = m_requestedCellOrder;
+    m_skin = m_requestedSkin;
+    m_structureValid = false;
+    if (m_cellOrder == CellOrder::Morton &&
+            (m_gridRes.x > MORTON_MAX_RES || m_gridRes.y > MORTON_MAX_RES || m_gridRes.z > MORTON_MAX_RES)) {
+        Logger::instance().print("Grid resolution too high for morton order, linear order is used instead", Logger::Mode::WARNING);
+        m_cellOrder = CellOrder::Linear;
+    }
 
-    // allocate grid
-    m_grid = (uint*) malloc(sizeof(uint*)* m_gridTotal);
-    m_gridCnt = (uint*) malloc(sizeof(uint*)* m_gridTotal);
-    memset(m_grid, (int)GRID_UNDEF, m_gridTotal*sizeof(uint));
-    memset(m_gridCnt, (int)GRID_UNDEF, m_gridTotal*sizeof(uint));
+    /*
+     * morton codes of a non power of two grid are not dense,
+     * the cell arrays have to cover every code up to the last cell
+     */
+    long long denseTotal;
+    if (m_cellOrder == CellOrder::Morton) {
+        denseTotal = (long long)mortonEncode(m_gridRes - glm::ivec3(1)) + 1;
+    } else {
+        denseTotal = (long long)m_gridRes.x * m_gridRes.y * m_gridRes.z;
+    }
+
+    /*
+     * a hash table with at least two slots per element keeps most occupied
+     * cells apart, its size is a power of two for a cheap modulo
+     */
+    int hashTotal = 1;
+    while (hashTotal < 2 * m_numElements) hashTotal <<= 1;
+    m_hashed = (m_requestedGridType == GridType::Hashed) ||
+               (m_requestedGridType == GridType::Automatic && denseTotal > (long long)HASH_AUTO_RATIO * hashTotal);
+    m_gridTotal = m_hashed ? hashTotal : (int)denseTotal;
+
+    // the search cells have to reach the largest pairwise cutoff
+    updateMaxElementRadius(m_numElements);
+    searchRadius = pairwiseSearchRadius(searchRadius);
+    m_searchRadius = searchRadius;
 
     // number of cells to search
     /*
@@ -271,25 +553,50 @@ void NeighborhoodSearch::setupGrid(glm::fvec3 min, glm::fvec3 max, glm::ivec3 re
      * r: search radius
      * w: cell width
      */
-    m_gridSearch = (int) 2*ceil(searchRadius / m_cellSize) +1;
+    float minCellWidth = m_cellSize; // periodic axes may have narrower cells
+    for (int a = 0; a < 3; a++) {
+        minCellWidth = std::min(minCellWidth, m_gridSize[a] / m_gridRes[a]);
+    }
+    m_gridSearch = (int) 2*ceil((searchRadius + m_skin) / minCellWidth) +1;
     if (m_gridSearch < 3) m_gridSearch = 3;
-    m_gridAdjCnt = m_gridSearch * m_gridSearch * m_gridSearch;
-    if (m_gridSearch > 5) {
-        Logger::instance().print("Warning: Neighbor search is n > 5, n is set to 5 instead", Logger::Mode::WARNING);
-        m_gridSearch = 5;
+    int searchCellRange = (m_gridSearch-1)/2;
+    m_maxSearchRadius = searchCellRange * minCellWidth;
+
+    /*
+     * search cells relative to the particle cell. On periodic axes a search
+     * wider than the grid would visit cells twice, there every cell is visited once
+     */
+    for (int a = 0; a < 3; a++) {
+        m_gridSearchMin[a] = -searchCellRange;
+        m_gridSearchMax[a] =  searchCellRange;
+        if (m_periodicBox[a] > 0.f && m_gridSearch > m_gridRes[a]) {
+            m_gridSearchMin[a] = -(m_gridRes[a]-1)/2;
+            m_gridSearchMax[a] = m_gridSearchMin[a] + m_gridRes[a] - 1;
+        }
+        if (m_periodicBox[a] > 0.f && 2.f * (searchRadius + m_skin) > m_periodicBox[a]) {
+            Logger::instance().print("Search radius exceeds half of the periodic box, only the nearest image of every particle is found", Logger::Mode::WARNING);
+        }
     }
-    m_maxSearchRadius = 5/2 * m_cellSize;
 
     // setup adjacency grid
-    int cell = 0;
+    m_gridAdj.clear();
+    m_gridAdj.reserve(m_gridSearch * m_gridSearch * m_gridSearch);
     for (int y = 0; y < m_gridSearch; y++) {
         for (int z = 0; z < m_gridSearch; z++) {
             for (int x = 0; x < m_gridSearch; x++) {
-                m_gridAdj[cell++] = (y * m_gridRes.z + z) * m_gridRes.x + x;
+                m_gridAdj.push_back((y * m_gridRes.z + z) * m_gridRes.x + x);
             }
         }
     }
 
+    /*
+     * if the mask is wider than the grid, several mask cells map onto the same
+     * grid cell. Removing those duplicates keeps every cell visited exactly once
+     */
+    std::sort(m_gridAdj.begin(), m_gridAdj.end());
+    m_gridAdj.erase(std::unique(m_gridAdj.begin(), m_gridAdj.end()), m_gridAdj.end());
+    m_gridAdjCnt = (int)m_gridAdj.size();
+
     // setup adjacency grid offset for the upper left grid cell of the grid search
     int totalOffset = ((m_gridSearch*m_gridSearch)-1)/2;
     int localX = totalOffset % m_gridSearch;
@@ -299,6 +606,12 @@ void NeighborhoodSearch::setupGrid(glm::fvec3 min, glm::fvec3 max, glm::ivec3 re
     int globalZ = localZ * m_gridRes.x;
     m_gridAdjOff = globalX + globalY + globalZ;
 
+    // report coverage, large masks are correct but slow
+    if (m_gridSearch > 5) {
+        Logger::instance().print("Neighbor search uses " + std::to_string(m_gridAdjCnt) + " search cells to cover radius "
+                                 + std::to_string(m_maxSearchRadius) + ", a coarser grid would be faster", Logger::Mode::WARNING);
+    }
+
     /*
      * set grid data for gpu
      */
@@ -306,11 +619,6 @@ void NeighborhoodSearch::setupGrid(glm::fvec3 min, glm::fvec3 max, glm::ivec3 re
     m_gridDataGPU.delta = m_gridDelta;
     m_gridDataGPU.res   = m_gridRes;
 }
-void NeighborhoodSearch::freeGrid()
-{
-    if (m_grid != 0x0) free(m_grid);
-    if (m_gridCnt != 0x0) free(m_gridCnt);
-}
 
 
 
@@ -325,6 +633,26 @@ void NeighborhoodSearch::computeNumBlocks(int numElements, int maxThreads, uint&
     numThreads = std::min(maxThreads, numElements);
     numBlocks = (numElements % numThreads != 0) ? (numElements/numThreads + 1) : (numElements/numThreads);
 }
+uint NeighborhoodSearch::cellIndex(glm::ivec3 cell) const
+{
+    if (m_hashed) {
+        return hashCell(cell, m_gridTotal);
+    }
+    if (m_cellOrder == CellOrder::Morton) {
+        return mortonEncode(cell);
+    }
+    return (uint)((cell.y * m_gridRes.z + cell.z) * m_gridRes.x + cell.x);
+}
+int NeighborhoodSearch::cellOrderDefine() const
+{
+    if (m_hashed) return CELL_ORDER_HASHED;
+    return (m_cellOrder == CellOrder::Morton) ? CELL_ORDER_MORTON : CELL_ORDER_LINEAR;
+}
+int NeighborhoodSearch::hashedShellCount() const
+{
+    // shells of nearest neighbor queries on open hashed axes, together they hold as many cells as the table
+    return (int)std::ceil(0.5f * (std::cbrt((float)m_gridTotal) - 1.f));
+}
 
 
 
@@ -336,33 +664,176 @@ void NeighborhoodSearch::computeNumBlocks(int numElements, int maxThreads, uint&
 //-----------------------------------------------------//
 void NeighborhoodSearch::run(GLuint* positionsSSBO, Neighborhood& neighborhood)
 {
+    if (m_backend != Backend::GPU) {
+        Logger::instance().print("Neighborhood search has been initialized for the CPU, use the host run instead", Logger::Mode::ERROR);
+        return;
+    }
+
     m_gpuBuffers.dp_pos = positionsSSBO;
-    insertElementsInGridGPU();
-    prefixSumCellsGPU();
-    countingSort();
+    m_runCount++;
+
+    // with a skin the structure of the last build is kept as long as it is valid
+    if (needsRebuildGPU()) {
+        // remember positions of this build
+        if (m_skin > 0.f) {
+            glBindBuffer(GL_COPY_READ_BUFFER,  *m_gpuBuffers.dp_pos);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, *m_gpuBuffers.dp_refPos);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(glm::vec4) * m_numElements);
+            glBindBuffer(GL_COPY_READ_BUFFER,  0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        startStageTimer(m_insertTimer);
+        insertElementsInGridGPU(1);
+        stopStageTimer(m_insertTimer);
+        startStageTimer(m_scanTimer);
+        prefixSumCellsGPU(1);
+        stopStageTimer(m_scanTimer);
+        startStageTimer(m_sortTimer);
+        countingSort(1);
+        stopStageTimer(m_sortTimer);
+        m_structureValid = true;
+        m_rebuildCount++;
+    }
 
     // update neighborhood
+    describeNeighborhood(neighborhood);
+}
+
+
+void NeighborhoodSearch::runBatch(GLuint* positionsSSBO, int numberOfFrames, NeighborhoodBatch& batch)
+{
+    if (m_backend != Backend::GPU) {
+        Logger::instance().print("Batched builds are only supported by the GPU backend, run the CPU backend frame by frame", Logger::Mode::ERROR);
+        return;
+    }
+    if (numberOfFrames < 1) {
+        Logger::instance().print("Batched build needs at least one frame", Logger::Mode::ERROR);
+        return;
+    }
+
+    /*
+     * all frames share the grid of the last init or update. Elements and cells are
+     * laid out frame after frame, so one pass of every stage builds the whole block
+     * and the buffers are reset once per block instead of once per frame
+     */
+    m_gpuBuffers.dp_pos = positionsSSBO;
+    reserveBuffers(m_numElements * numberOfFrames, m_gridTotal * numberOfFrames);
+
+    startStageTimer(m_insertTimer);
+    insertElementsInGridGPU(numberOfFrames);
+    stopStageTimer(m_insertTimer);
+    startStageTimer(m_scanTimer);
+    prefixSumCellsGPU(numberOfFrames);
+    stopStageTimer(m_scanTimer);
+    startStageTimer(m_sortTimer);
+    countingSort(numberOfFrames);
+    stopStageTimer(m_sortTimer);
+
+    // the structure of the last single frame run has been overwritten
+    m_structureValid = false;
+
+    describeNeighborhood(batch.neighborhood);
+    batch.numberOfFrames   = numberOfFrames;
+    batch.elementsPerFrame = m_numElements;
+    batch.cellsPerFrame    = m_gridTotal;
+}
+
+
+
+void NeighborhoodSearch::describeNeighborhood(Neighborhood& neighborhood)
+{
     neighborhood.dp_particleOriginalIndex   = m_gpuBuffers.dp_undx;
     neighborhood.dp_particleCell            = m_gpuBuffers.dp_gcell;
     neighborhood.dp_particleCellIndex       = m_gpuBuffers.dp_gndx;
     neighborhood.dp_grid                    = m_gpuBuffers.dp_grid;
+    neighborhood.dp_sortedPositions         = m_gpuBuffers.dp_sortedPos;
     neighborhood.dp_gridCellCounts          = m_gpuBuffers.dp_gridcnt;
     neighborhood.dp_gridCellOffsets         = m_gpuBuffers.dp_gridoff;
-    neighborhood.p_searchCellOffsets        = m_gridAdj;
+    neighborhood.dp_searchCellOffsets       = m_gpuBuffers.dp_gridadj;
+    neighborhood.p_searchCellOffsets        = m_gridAdj.data();
     neighborhood.startCellOffset            = m_gridAdjOff;
     neighborhood.numberOfSearchCells        = m_gridAdjCnt;
     neighborhood.searchRadius               = m_searchRadius;
+    neighborhood.coveredSearchRadius        = m_maxSearchRadius;
+    neighborhood.cellOrder                  = cellOrderDefine();
+    neighborhood.gridResolution             = m_gridRes;
+    neighborhood.numberOfGridCells          = m_gridTotal;
+    neighborhood.searchCellMin              = m_gridSearchMin;
+    neighborhood.searchCellMax              = m_gridSearchMax;
+    neighborhood.periodicBox                = m_periodicBox;
+    neighborhood.gridMin                    = m_gridMin;
+    neighborhood.gridDelta                  = m_gridDelta;
+    neighborhood.dp_elementRadii            = m_radiiSSBO;
+    neighborhood.pairwiseCutoff             = m_pairwiseCutoff ? 1 : 0;
+    neighborhood.probeRadius                = m_probeRadius;
+}
+
+
+
+void NeighborhoodSearch::startStageTimer(Timer& rTimer)
+{
+    if (!m_profiling) return;
+    if (m_backend == Backend::GPU) glFinish(); // previous work must not be counted
+    rTimer.start();
+}
+void NeighborhoodSearch::stopStageTimer(Timer& rTimer)
+{
+    if (!m_profiling) return;
+    if (m_backend == Backend::GPU) glFinish(); // wait for the dispatched stage
+    rTimer.stop();
 }
 
 
 
-void NeighborhoodSearch::insertElementsInGridGPU()
+bool NeighborhoodSearch::needsRebuildGPU()
 {
+    if (!m_structureValid || m_skin <= 0.f) return true;
+
+    // maximal displacement of all particles since the last build
+    GPUHandler::clearSSBO<uint>(m_gpuBuffers.dp_displacement, 1, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, *m_gpuBuffers.dp_pos);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, *m_gpuBuffers.dp_refPos);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, *m_gpuBuffers.dp_displacement);
+    m_maxDisplacementShader.use();
+    m_maxDisplacementShader.update("pnum", m_numElements);
+    glDispatchCompute(m_numBlocks, 1, 1);
+    glMemoryBarrier (GL_ALL_BARRIER_BITS);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+
+    uint* pBits = GPUHandler::getDataFromSSBO<uint>(m_gpuBuffers.dp_displacement, 1);
+    float maxDisplacement2;
+    memcpy(&maxDisplacement2, pBits, sizeof(float));
+    delete[] pBits;
+
+    // no pair can have come closer than the searched radius plus skin
+    float halfSkin = 0.5f * m_skin;
+    return maxDisplacement2 > halfSkin * halfSkin;
+}
+
+
+
+GLuint NeighborhoodSearch::buildPositionsGPU() const
+{
+    // positions the cells have been filled with, see buildPositionsCPU
+    return (m_skin > 0.f) ? *m_gpuBuffers.dp_refPos : *m_gpuBuffers.dp_pos;
+}
+
+
+
+void NeighborhoodSearch::insertElementsInGridGPU(int numberOfFrames)
+{
+    int numberOfElements = m_numElements * numberOfFrames;
+    uint numBlocks, numThreads;
+    computeNumBlocks(std::max(1, numberOfElements), BLOCK_SIZE, numBlocks, numThreads);
+    int numberOfCells = m_gridTotal * numberOfFrames;
 
     /*
      * reset grid count
      */
-    GPUHandler::fillSSBO<int>(m_gpuBuffers.dp_gridcnt, m_gridTotal, 0);
+    GPUHandler::clearSSBO<int>(m_gpuBuffers.dp_gridcnt, numberOfCells, 0);
 
     /*
      * insert elements
@@ -375,8 +846,12 @@ void NeighborhoodSearch::insertElementsInGridGPU()
     m_insertElementsShader.update("grid.min",   glm::vec4(m_gridDataGPU.min, 0));
     m_insertElementsShader.update("grid.delta", glm::vec4(m_gridDataGPU.delta, 0));
     m_insertElementsShader.update("grid.res",   glm::ivec4(m_gridDataGPU.res, 0));
-    m_insertElementsShader.update("pnum",       m_numElements);
-    glDispatchCompute(m_numBlocks, 1, 1);
+    m_insertElementsShader.update("pnum",       numberOfElements);
+    m_insertElementsShader.update("cellOrder",  cellOrderDefine());
+    m_insertElementsShader.update("periodicBox", m_periodicBox);
+    m_insertElementsShader.update("numberOfGridCells", m_gridTotal);
+    m_insertElementsShader.update("elementsPerFrame", m_numElements);
+    glDispatchCompute(numBlocks, 1, 1);
     glMemoryBarrier (GL_ALL_BARRIER_BITS);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
@@ -392,22 +867,22 @@ void NeighborhoodSearch::insertElementsInGridGPU()
         Logger::instance().print("Checking data for insertElementsInGridGPU:"); Logger::instance().tabIn();
 
         Logger::instance().print("Checking pos"); Logger::instance().tabIn();
-        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_pos, m_numElements, m_gridMin, m_gridMax);
+        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_pos, numberOfElements, m_gridMin, m_gridMax);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking gridcnt"); Logger::instance().tabIn();
-        AssertData::assertSum<int>(m_gpuBuffers.dp_gridcnt, m_gridTotal, m_numElements);
+        AssertData::assertSum<int>(m_gpuBuffers.dp_gridcnt, numberOfCells, numberOfElements);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking gcell"); Logger::instance().tabIn();
-        AssertData::assertAboveLimit<int>(m_gpuBuffers.dp_gcell, m_numElements, -1);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gcell, m_numElements, m_gridTotal+1);
-        AssertData::assertCellContent(m_gpuBuffers.dp_gcell, m_gpuBuffers.dp_gridcnt, m_numElements, m_gridTotal);
+        AssertData::assertAboveLimit<int>(m_gpuBuffers.dp_gcell, numberOfElements, -1);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gcell, numberOfElements, numberOfCells+1);
+        AssertData::assertCellContent(m_gpuBuffers.dp_gcell, m_gpuBuffers.dp_gridcnt, numberOfElements, numberOfCells);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking gndx"); Logger::instance().tabIn();
-        AssertData::assertAboveLimit<int>(m_gpuBuffers.dp_gndx, m_numElements, -1);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gndx, m_numElements, m_numElements+1);
+        AssertData::assertAboveLimit<int>(m_gpuBuffers.dp_gndx, numberOfElements, -1);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gndx, numberOfElements, numberOfElements+1);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checks successful");
@@ -417,9 +892,11 @@ void NeighborhoodSearch::insertElementsInGridGPU()
 
 
 
-void NeighborhoodSearch::prefixSumCellsGPU()
+void NeighborhoodSearch::prefixSumCellsGPU(int numberOfFrames)
 {
-    prescanArrayRecursiveInt(m_gpuBuffers.dp_gridoff, m_gpuBuffers.dp_gridcnt, m_gridTotal, 0);
+    int numberOfElements = m_numElements * numberOfFrames;
+    int numberOfCells = m_gridTotal * numberOfFrames;
+    prescanArrayRecursiveInt(m_gpuBuffers.dp_gridoff, m_gpuBuffers.dp_gridcnt, numberOfCells, 0);
     glMemoryBarrier(GL_ALL_BARRIER_BITS);
 
 
@@ -431,9 +908,9 @@ void NeighborhoodSearch::prefixSumCellsGPU()
         Logger::instance().print("Checking data for prefixSumCellsGPU:"); Logger::instance().tabIn();
 
         Logger::instance().print("Checking gridoff"); Logger::instance().tabIn();
-        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_gridoff, m_gridTotal, 0);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gridoff, m_gridTotal, m_numElements+1);
-        AssertData::assertDataMonotInc<int>(m_gpuBuffers.dp_gridoff, m_gridTotal, 0);
+        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_gridoff, numberOfCells, 0);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gridoff, numberOfCells, numberOfElements+1);
+        AssertData::assertDataMonotInc<int>(m_gpuBuffers.dp_gridoff, numberOfCells, 0);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checks successful");
@@ -566,8 +1043,13 @@ int NeighborhoodSearch::floorPow2(int n)
 
 
 
-void NeighborhoodSearch::countingSort()
+void NeighborhoodSearch::countingSort(int numberOfFrames)
 {
+    int numberOfElements = m_numElements * numberOfFrames;
+    int numberOfCells = m_gridTotal * numberOfFrames;
+    uint numBlocks, numThreads;
+    computeNumBlocks(std::max(1, numberOfElements), BLOCK_SIZE, numBlocks, numThreads);
+
     // copy positions, cells and indices to temporary buffers
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, *m_gpuBuffers.dp_pos);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, *m_gpuBuffers.dp_gcell);
@@ -577,8 +1059,8 @@ void NeighborhoodSearch::countingSort()
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, *m_gpuBuffers.dp_tempGndx);
 
     m_fillTempDataShader.use();
-    m_fillTempDataShader.update("pnum", m_numElements);
-    glDispatchCompute(m_numBlocks, 1, 1);
+    m_fillTempDataShader.update("pnum", numberOfElements);
+    glDispatchCompute(numBlocks, 1, 1);
     glMemoryBarrier (GL_ALL_BARRIER_BITS);
 
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
@@ -597,19 +1079,19 @@ void NeighborhoodSearch::countingSort()
         Logger::instance().print("Checking data for fill temp data:"); Logger::instance().tabIn();
 
         Logger::instance().print("Checking tempPos"); Logger::instance().tabIn();
-        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_tempPos, m_numElements, m_gridMin, m_gridMax);
+        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_tempPos, numberOfElements, m_gridMin, m_gridMax);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking tempGcell"); Logger::instance().tabIn();
-        AssertData::assertAboveLimit<int>(m_gpuBuffers.dp_tempGcell, m_numElements, -1);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_tempGcell, m_numElements, m_gridTotal+1);
-        AssertData::assertArraysEqual<uint>(m_gpuBuffers.dp_tempGcell, m_gpuBuffers.dp_gcell, m_numElements);
+        AssertData::assertAboveLimit<int>(m_gpuBuffers.dp_tempGcell, numberOfElements, -1);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_tempGcell, numberOfElements, numberOfCells+1);
+        AssertData::assertArraysEqual<uint>(m_gpuBuffers.dp_tempGcell, m_gpuBuffers.dp_gcell, numberOfElements);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking tempGndx"); Logger::instance().tabIn();
-        AssertData::assertAboveLimit<int>(m_gpuBuffers.dp_tempGndx,  m_numElements, -1);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_tempGndx,  m_numElements, m_numElements+1);
-        AssertData::assertArraysEqual<uint>(m_gpuBuffers.dp_tempGndx, m_gpuBuffers.dp_gndx, m_numElements);
+        AssertData::assertAboveLimit<int>(m_gpuBuffers.dp_tempGndx,  numberOfElements, -1);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_tempGndx,  numberOfElements, numberOfElements+1);
+        AssertData::assertArraysEqual<uint>(m_gpuBuffers.dp_tempGndx, m_gpuBuffers.dp_gndx, numberOfElements);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checks successful");
@@ -619,10 +1101,10 @@ void NeighborhoodSearch::countingSort()
 
 
     // reset grid
-    GPUHandler::fillSSBO<uint>(m_gpuBuffers.dp_gcell, m_numElements, (uint)GRID_UNDEF);
-    GPUHandler::fillSSBO<uint>(m_gpuBuffers.dp_gndx,  m_numElements, (uint)GRID_UNDEF);
-    GPUHandler::fillSSBO<uint>(m_gpuBuffers.dp_grid,  m_numElements, (uint)GRID_UNDEF);
-    GPUHandler::fillSSBO<uint>(m_gpuBuffers.dp_undx,  m_numElements, (uint)GRID_UNDEF);
+    GPUHandler::clearSSBO<uint>(m_gpuBuffers.dp_gcell, numberOfElements, (uint)GRID_UNDEF);
+    GPUHandler::clearSSBO<uint>(m_gpuBuffers.dp_gndx,  numberOfElements, (uint)GRID_UNDEF);
+    GPUHandler::clearSSBO<uint>(m_gpuBuffers.dp_grid,  numberOfElements, (uint)GRID_UNDEF);
+    GPUHandler::clearSSBO<uint>(m_gpuBuffers.dp_undx,  numberOfElements, (uint)GRID_UNDEF);
 
 
     // check all data before counting sort
@@ -630,42 +1112,42 @@ void NeighborhoodSearch::countingSort()
         Logger::instance().print("Checking all data before counting sort:"); Logger::instance().tabIn();
 
         Logger::instance().print("Checking pos"); Logger::instance().tabIn();
-        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_pos, m_numElements, m_gridMin, m_gridMax);
+        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_pos, numberOfElements, m_gridMin, m_gridMax);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking gcell"); Logger::instance().tabIn();
-        AssertData::assertAllEqual<uint>(m_gpuBuffers.dp_gcell,  m_numElements, (uint)GRID_UNDEF);
+        AssertData::assertAllEqual<uint>(m_gpuBuffers.dp_gcell,  numberOfElements, (uint)GRID_UNDEF);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking gndx"); Logger::instance().tabIn();
-        AssertData::assertAllEqual<uint>(m_gpuBuffers.dp_gndx,  m_numElements, (uint)GRID_UNDEF);
+        AssertData::assertAllEqual<uint>(m_gpuBuffers.dp_gndx,  numberOfElements, (uint)GRID_UNDEF);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking gridoff"); Logger::instance().tabIn();
-        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_gridoff,  m_gridTotal, 0);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gridoff,  m_gridTotal, m_numElements+1);
+        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_gridoff,  numberOfCells, 0);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gridoff,  numberOfCells, numberOfElements+1);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking grid"); Logger::instance().tabIn();
-        AssertData::assertAllEqual<uint>(m_gpuBuffers.dp_grid,  m_numElements, (uint)GRID_UNDEF);
+        AssertData::assertAllEqual<uint>(m_gpuBuffers.dp_grid,  numberOfElements, (uint)GRID_UNDEF);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking tempPos"); Logger::instance().tabIn();
-        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_tempPos, m_numElements, m_gridMin, m_gridMax);
+        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_tempPos, numberOfElements, m_gridMin, m_gridMax);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking tempGcell"); Logger::instance().tabIn();
-        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_tempGcell, m_numElements, 0);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_tempGcell, m_numElements, m_gridTotal+1);
+        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_tempGcell, numberOfElements, 0);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_tempGcell, numberOfElements, numberOfCells+1);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking tempGndx"); Logger::instance().tabIn();
-        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_tempGndx,  m_numElements, 0);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_tempGndx,  m_numElements, m_numElements+1);
+        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_tempGndx,  numberOfElements, 0);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_tempGndx,  numberOfElements, numberOfElements+1);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking undx"); Logger::instance().tabIn();
-        AssertData::assertAllEqual<uint>(m_gpuBuffers.dp_undx,  m_numElements, (uint)GRID_UNDEF);
+        AssertData::assertAllEqual<uint>(m_gpuBuffers.dp_undx,  numberOfElements, (uint)GRID_UNDEF);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checks successful");
@@ -673,31 +1155,39 @@ void NeighborhoodSearch::countingSort()
     }
 
 
-    // call shader countingSort
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, *m_gpuBuffers.dp_pos);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, *m_gpuBuffers.dp_gcell);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, *m_gpuBuffers.dp_gndx);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, *m_gpuBuffers.dp_gridoff);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, *m_gpuBuffers.dp_grid);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, *m_gpuBuffers.dp_tempPos);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, *m_gpuBuffers.dp_tempGcell);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, *m_gpuBuffers.dp_tempGndx);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, *m_gpuBuffers.dp_undx);
-
-    m_countingSortShader.use();
-    m_countingSortShader.update("pnum", m_numElements);
-    glDispatchCompute(m_numBlocks, 1, 1);
-    glMemoryBarrier (GL_ALL_BARRIER_BITS);
+    // call shader countingSort, the positions of the caller stay in original order
+    auto scatter = [&]()
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, *m_gpuBuffers.dp_sortedPos);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, *m_gpuBuffers.dp_gcell);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, *m_gpuBuffers.dp_gndx);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, *m_gpuBuffers.dp_gridoff);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, *m_gpuBuffers.dp_grid);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, *m_gpuBuffers.dp_tempPos);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, *m_gpuBuffers.dp_tempGcell);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, *m_gpuBuffers.dp_tempGndx);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, *m_gpuBuffers.dp_undx);
+
+        m_countingSortShader.use();
+        m_countingSortShader.update("pnum", numberOfElements);
+        glDispatchCompute(numBlocks, 1, 1);
+        glMemoryBarrier (GL_ALL_BARRIER_BITS);
+
+        for (GLuint binding = 0; binding <= 8; binding++) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+        }
+    };
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, 0);
+    /*
+     * The insertion indices come from atomics, so the order inside a cell changes
+     * from run to run. In deterministic mode every particle gets the rank of its
+     * original index inside its cell before the scatter, afterwards the cells
+     * are ordered like on the CPU backend and the results are reproducible
+     */
+    if (m_deterministic) {
+        stableCellRanksGPU(numberOfElements, numberOfCells);
+    }
+    scatter();
 
 
 
@@ -707,31 +1197,1030 @@ void NeighborhoodSearch::countingSort()
     if (NHS_DEBUG) {
         Logger::instance().print("Checking data for countingSort:"); Logger::instance().tabIn();
 
-        Logger::instance().print("Checking pos"); Logger::instance().tabIn();
-        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_pos, m_numElements, m_gridMin, m_gridMax);
+        Logger::instance().print("Checking sortedPos"); Logger::instance().tabIn();
+        AssertData::assertAtomsAreInBounds(m_gpuBuffers.dp_sortedPos, numberOfElements, m_gridMin, m_gridMax);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking gcell"); Logger::instance().tabIn();
-        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_gcell, m_numElements, (uint)0);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gcell, m_numElements, (uint)m_gridTotal+1);
+        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_gcell, numberOfElements, (uint)0);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gcell, numberOfElements, (uint)numberOfCells+1);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking gndx"); Logger::instance().tabIn();
-        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_gndx,  m_numElements, 0);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gndx,  m_numElements, m_numElements+1);
+        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_gndx,  numberOfElements, 0);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_gndx,  numberOfElements, numberOfElements+1);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking grid"); Logger::instance().tabIn();
-        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_grid,  m_numElements, (uint)0);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_grid,  m_numElements, m_numElements+1);
+        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_grid,  numberOfElements, (uint)0);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_grid,  numberOfElements, numberOfElements+1);
         Logger::instance().tabOut();
 
         Logger::instance().print("Checking undx"); Logger::instance().tabIn();
-        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_undx,  m_numElements, (uint)0);
-        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_undx,  m_numElements, (uint)(m_numElements+1));
+        AssertData::assertAboveEqLimit<int>(m_gpuBuffers.dp_undx,  numberOfElements, (uint)0);
+        AssertData::assertBelowLimit<int>(m_gpuBuffers.dp_undx,  numberOfElements, (uint)(numberOfElements+1));
         Logger::instance().tabOut();
 
         Logger::instance().print("Checks successful");
         Logger::instance().tabOut();
     }
 }
+
+
+void NeighborhoodSearch::stableCellRanksGPU(int numberOfElements, int numberOfCells)
+{
+    /*
+     * Radix sort of the particles by cell, one bit per pass. Every pass splits the
+     * particles stably by the bit with a scan of the flags. The particles start in
+     * original order, so afterwards the particles of a cell are ordered by original
+     * index and the rank is the distance to the cell offset. Particles outside the
+     * grid get the key numberOfCells and end up behind all cells. The work is linear
+     * in the number of particles per bit of the cell count, whatever the occupancy
+     */
+    uint numBlocks, numThreads, flagBlocks;
+    computeNumBlocks(std::max(1, numberOfElements), BLOCK_SIZE, numBlocks, numThreads);
+    computeNumBlocks(numberOfElements + 1, BLOCK_SIZE, flagBlocks, numThreads);
+    int numberOfBits = 0;
+    while (numberOfBits < 32 && ((uint)numberOfCells >> numberOfBits) != 0) numberOfBits++;
+
+    GLuint* pPairs     = m_gpuBuffers.dp_rankPairs;
+    GLuint* pTempPairs = m_gpuBuffers.dp_rankPairsTemp;
+    auto dispatch = [&](int stage, int bit, uint blocks)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, *m_gpuBuffers.dp_tempGcell);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, *pPairs);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, *pTempPairs);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, *m_gpuBuffers.dp_rankFlags);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, *m_gpuBuffers.dp_rankOff);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, *m_gpuBuffers.dp_gridoff);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, *m_gpuBuffers.dp_tempGndx);
+
+        m_stableCellRankShader.use();
+        m_stableCellRankShader.update("pnum",          numberOfElements);
+        m_stableCellRankShader.update("stage",         stage);
+        m_stableCellRankShader.update("bit",           bit);
+        m_stableCellRankShader.update("numberOfCells", numberOfCells);
+        glDispatchCompute(blocks, 1, 1);
+        glMemoryBarrier (GL_ALL_BARRIER_BITS);
+    };
+
+    dispatch(STABLE_RANK_INIT, 0, numBlocks);
+    std::swap(pPairs, pTempPairs);
+    for (int bit = 0; bit < numberOfBits; bit++) {
+        dispatch(STABLE_RANK_FLAGS, bit, flagBlocks);
+        prescanArrayRecursiveInt(m_gpuBuffers.dp_rankOff, m_gpuBuffers.dp_rankFlags, numberOfElements + 1, 0);
+        glMemoryBarrier(GL_ALL_BARRIER_BITS);
+        dispatch(STABLE_RANK_SPLIT, bit, numBlocks);
+        std::swap(pPairs, pTempPairs);
+    }
+    dispatch(STABLE_RANK_WRITE, 0, numBlocks);
+
+    for (GLuint binding = 0; binding <= 6; binding++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+}
+
+
+
+
+
+
+//-----------------------------------------------------//
+//                    CPU BACKEND                      //
+//-----------------------------------------------------//
+void NeighborhoodSearch::allocateHostBuffers(uint numElements)
+{
+    // element related arrays
+    m_cpuParticleCell.resize(numElements);
+    m_cpuParticleCellIndex.resize(numElements);
+    m_cpuGrid.resize(numElements);
+    m_cpuOriginalIndex.resize(numElements);
+    m_cpuTempCell.resize(numElements);
+    m_cpuTempCellIndex.resize(numElements);
+
+    // grid related arrays
+    m_cpuGridCnt.resize(m_gridTotal);
+    m_cpuGridOff.resize(m_gridTotal);
+}
+
+
+
+template<typename F>
+void NeighborhoodSearch::parallelFor(int count, int threadCount, F function)
+{
+    if (threadCount <= 1) {
+        function(0, 0, count);
+        return;
+    }
+
+    /*
+     * every thread gets one contiguous chunk, the last one also takes the remainder.
+     * Chunks only depend on count and thread count, so consecutive passes over the
+     * same range see the same split
+     */
+    std::vector<std::thread> threads;
+    int chunkSize = count / threadCount;
+    for (int t = 0; t < threadCount; t++) {
+        int minIndex = t * chunkSize;
+        int maxIndex = (t == threadCount - 1) ? count : minIndex + chunkSize;
+        threads.push_back(std::thread(function, t, minIndex, maxIndex));
+    }
+    for (auto& rThread : threads) {
+        rThread.join();
+    }
+}
+
+
+
+void NeighborhoodSearch::run(const std::vector<glm::vec3>& rPositions, NeighborhoodCPU& neighborhood, int threadCount)
+{
+    if (m_backend != Backend::CPU) {
+        Logger::instance().print("Neighborhood search has been initialized for the GPU, use the SSBO run instead", Logger::Mode::ERROR);
+        return;
+    }
+    if (rPositions.size() < (size_t)m_numElements) {
+        Logger::instance().print("Neighborhood search got less positions than elements", Logger::Mode::ERROR);
+        return;
+    }
+    threadCount = std::max(1, threadCount);
+
+    m_runCount++;
+
+    // with a skin the structure of the last build is kept as long as it is valid
+    if (needsRebuildCPU(rPositions, threadCount)) {
+        if (m_skin > 0.f) {
+            m_cpuRefPos.assign(rPositions.begin(), rPositions.begin() + m_numElements);
+        }
+
+        startStageTimer(m_insertTimer);
+        insertElementsInGridCPU(rPositions, threadCount);
+        stopStageTimer(m_insertTimer);
+        startStageTimer(m_scanTimer);
+        prefixSumCellsCPU(threadCount);
+        stopStageTimer(m_scanTimer);
+        startStageTimer(m_sortTimer);
+        countingSortCPU(threadCount);
+        stopStageTimer(m_sortTimer);
+        m_structureValid = true;
+        m_rebuildCount++;
+    }
+
+    // update neighborhood
+    neighborhood.p_particleOriginalIndex    = m_cpuOriginalIndex.data();
+    neighborhood.p_particleCell             = m_cpuParticleCell.data();
+    neighborhood.p_particleCellIndex        = m_cpuParticleCellIndex.data();
+    neighborhood.p_grid                     = m_cpuGrid.data();
+    neighborhood.p_gridCellCounts           = m_cpuGridCnt.data();
+    neighborhood.p_gridCellOffsets          = m_cpuGridOff.data();
+    neighborhood.p_searchCellOffsets        = m_gridAdj.data();
+    neighborhood.startCellOffset            = m_gridAdjOff;
+    neighborhood.numberOfSearchCells        = m_gridAdjCnt;
+    neighborhood.searchRadius               = m_searchRadius;
+    neighborhood.coveredSearchRadius        = m_maxSearchRadius;
+    neighborhood.cellOrder                  = cellOrderDefine();
+    neighborhood.gridResolution             = m_gridRes;
+    neighborhood.numberOfGridCells          = m_gridTotal;
+    neighborhood.searchCellMin              = m_gridSearchMin;
+    neighborhood.searchCellMax              = m_gridSearchMax;
+    neighborhood.periodicBox                = m_periodicBox;
+    neighborhood.gridMin                    = m_gridMin;
+    neighborhood.gridDelta                  = m_gridDelta;
+    neighborhood.p_elementRadii             = m_pairwiseCutoff ? m_cpuRadii.data() : 0x0;
+    neighborhood.pairwiseCutoff             = m_pairwiseCutoff ? 1 : 0;
+    neighborhood.probeRadius                = m_probeRadius;
+}
+
+
+
+bool NeighborhoodSearch::needsRebuildCPU(const std::vector<glm::vec3>& rPositions, int threadCount)
+{
+    if (!m_structureValid || m_skin <= 0.f) return true;
+
+    // maximal displacement of all particles since the last build
+    std::vector<float> threadMaxDisplacement2(threadCount, 0.f);
+    parallelFor(m_numElements, threadCount, [&](int thread, int minIndex, int maxIndex)
+    {
+        float maxDisplacement2 = 0.f;
+        for (int i = minIndex; i < maxIndex; i++) {
+            glm::vec3 displacement = rPositions[i] - m_cpuRefPos[i];
+            maxDisplacement2 = std::max(maxDisplacement2, glm::dot(displacement, displacement));
+        }
+        threadMaxDisplacement2[thread] = maxDisplacement2;
+    });
+    float maxDisplacement2 = *std::max_element(threadMaxDisplacement2.begin(), threadMaxDisplacement2.end());
+
+    // no pair can have come closer than the searched radius plus skin
+    float halfSkin = 0.5f * m_skin;
+    return maxDisplacement2 > halfSkin * halfSkin;
+}
+
+
+
+const std::vector<glm::vec3>& NeighborhoodSearch::buildPositionsCPU(const std::vector<glm::vec3>& rPositions) const
+{
+    /*
+     * positions the cells have been filled with, a kept structure
+     * still holds every particle in the cell of its last build
+     */
+    return (m_skin > 0.f) ? m_cpuRefPos : rPositions;
+}
+
+
+
+void NeighborhoodSearch::insertElementsInGridCPU(const std::vector<glm::vec3>& rPositions, int threadCount)
+{
+    /*
+     * every thread counts the elements of its chunk in its own cell counts,
+     * so no atomics are needed and the insertion order is the element order
+     */
+    m_cpuThreadGridCnt.assign((size_t)threadCount * m_gridTotal, 0);
+    parallelFor(m_numElements, threadCount, [&](int thread, int minIndex, int maxIndex)
+    {
+        int* pCounts = m_cpuThreadGridCnt.data() + (size_t)thread * m_gridTotal;
+        for (int i = minIndex; i < maxIndex; i++) {
+            // determine the corresponding cell from the element position, hashed cells are never outside
+            glm::ivec3 gc = cellOfPosition(rPositions[i], m_gridMin, m_gridDelta, m_gridRes, m_periodicBox);
+            if (m_hashed ||
+                (gc.x >= 0 && gc.x < m_gridRes.x &&
+                 gc.y >= 0 && gc.y < m_gridRes.y &&
+                 gc.z >= 0 && gc.z < m_gridRes.z)) {
+                uint gs = cellIndex(gc);
+                m_cpuTempCell[i] = gs;
+                m_cpuTempCellIndex[i] = (uint)pCounts[gs]++;
+            } else {
+                // if element is outside the grid it has no corresponding grid cell
+                m_cpuTempCell[i] = (uint)GRID_UNDEF;
+                m_cpuTempCellIndex[i] = (uint)GRID_UNDEF;
+            }
+        }
+    });
+
+    /*
+     * merge the counts of all threads, afterwards every thread count holds
+     * the insertion index of the first element of that thread inside the cell
+     */
+    parallelFor(m_gridTotal, threadCount, [&](int, int minCell, int maxCell)
+    {
+        for (int c = minCell; c < maxCell; c++) {
+            int count = 0;
+            for (int t = 0; t < threadCount; t++) {
+                int& rThreadCount = m_cpuThreadGridCnt[(size_t)t * m_gridTotal + c];
+                int threadCellCount = rThreadCount;
+                rThreadCount = count;
+                count += threadCellCount;
+            }
+            m_cpuGridCnt[c] = count;
+        }
+    });
+
+    // shift local insertion indices by the base of their thread
+    if (threadCount > 1) {
+        parallelFor(m_numElements, threadCount, [&](int thread, int minIndex, int maxIndex)
+        {
+            const int* pBases = m_cpuThreadGridCnt.data() + (size_t)thread * m_gridTotal;
+            for (int i = minIndex; i < maxIndex; i++) {
+                uint cell = m_cpuTempCell[i];
+                if (cell != (uint)GRID_UNDEF) {
+                    m_cpuTempCellIndex[i] += (uint)pBases[cell];
+                }
+            }
+        });
+    }
+}
+
+
+
+void NeighborhoodSearch::prefixSumCellsCPU(int threadCount)
+{
+    // exclusive scan in two passes, first every chunk of cells is summed up
+    std::vector<int> chunkOffsets(threadCount + 1, 0);
+    parallelFor(m_gridTotal, threadCount, [&](int thread, int minCell, int maxCell)
+    {
+        int sum = 0;
+        for (int c = minCell; c < maxCell; c++) {
+            sum += m_cpuGridCnt[c];
+        }
+        chunkOffsets[thread + 1] = sum;
+    });
+    for (int t = 0; t < threadCount; t++) {
+        chunkOffsets[t + 1] += chunkOffsets[t];
+    }
+
+    // then every chunk is scanned starting at its offset
+    parallelFor(m_gridTotal, threadCount, [&](int thread, int minCell, int maxCell)
+    {
+        int offset = chunkOffsets[thread];
+        for (int c = minCell; c < maxCell; c++) {
+            m_cpuGridOff[c] = offset;
+            offset += m_cpuGridCnt[c];
+        }
+    });
+}
+
+
+
+void NeighborhoodSearch::countingSortCPU(int threadCount)
+{
+    // elements outside of the grid are not sorted and leave undefined entries at the end
+    std::fill(m_cpuParticleCell.begin(),      m_cpuParticleCell.end(),      (uint)GRID_UNDEF);
+    std::fill(m_cpuParticleCellIndex.begin(), m_cpuParticleCellIndex.end(), (uint)GRID_UNDEF);
+    std::fill(m_cpuGrid.begin(),              m_cpuGrid.end(),              (uint)GRID_UNDEF);
+    std::fill(m_cpuOriginalIndex.begin(),     m_cpuOriginalIndex.end(),     (uint)GRID_UNDEF);
+
+    parallelFor(m_numElements, threadCount, [&](int, int minIndex, int maxIndex)
+    {
+        for (int i = minIndex; i < maxIndex; i++) {
+            uint icell = m_cpuTempCell[i];
+            if (icell != (uint)GRID_UNDEF) {
+                // sort index is offset of the cell plus offset of the element inside the cell
+                uint indx = m_cpuTempCellIndex[i];
+                uint sortIndex = (uint)m_cpuGridOff[icell] + indx;
+
+                // transfer data to sort location
+                m_cpuGrid[sortIndex]                = sortIndex; // grid indexing becomes identity
+                m_cpuParticleCell[sortIndex]        = icell;
+                m_cpuParticleCellIndex[sortIndex]   = indx;
+                m_cpuOriginalIndex[sortIndex]       = (uint)i;
+            }
+        }
+    });
+}
+
+
+
+
+//-----------------------------------------------------//
+//                   NEIGHBOR LIST                     //
+//-----------------------------------------------------//
+void NeighborhoodSearch::buildNeighborList(NeighborList& neighborList)
+{
+    if (m_backend != Backend::GPU) {
+        Logger::instance().print("Neighborhood search has been initialized for the CPU, use the host neighbor list instead", Logger::Mode::ERROR);
+        return;
+    }
+    if (!m_structureValid) {
+        Logger::instance().print("Neighbor list needs a run of the neighborhood search first", Logger::Mode::ERROR);
+        return;
+    }
+
+    // count the neighbors, the entry behind the last particle stays zero
+    GPUHandler::clearSSBO<int>(m_gpuBuffers.dp_neighborCnt, m_numElements + 1, 0);
+    neighborListPassGPU(NEIGHBOR_LIST_COUNT);
+
+    // exclusive scan turns the counts into offsets, the last offset is the total
+    prescanArrayRecursiveInt(m_gpuBuffers.dp_neighborOff, m_gpuBuffers.dp_neighborCnt, m_numElements + 1, 0);
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    int numberOfNeighbors = GPUHandler::getValueFromSSBO<int>(m_gpuBuffers.dp_neighborOff, m_numElements);
+
+    // write the neighbors, the list grows geometrically like the other buffers
+    if ((uint)numberOfNeighbors > m_neighborCapacity) {
+        m_neighborCapacity = std::max((uint)numberOfNeighbors, 2 * m_neighborCapacity);
+        GPUHandler::resizeSSBO<uint>(m_gpuBuffers.dp_neighbors, m_neighborCapacity);
+    }
+    if (numberOfNeighbors > 0) {
+        neighborListPassGPU(NEIGHBOR_LIST_FILL);
+    }
+
+    neighborList.dp_neighborOffsets = m_gpuBuffers.dp_neighborOff;
+    neighborList.dp_neighborIndices = m_gpuBuffers.dp_neighbors;
+    neighborList.numberOfNeighbors  = numberOfNeighbors;
+    neighborList.halfStencil        = (m_stencil == Stencil::Half);
+}
+
+
+
+void NeighborhoodSearch::neighborListPassGPU(int pass)
+{
+    // cells are read in original order from the temporary buffer of the sort
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, *m_gpuBuffers.dp_pos);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, *m_gpuBuffers.dp_tempGcell);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, *m_gpuBuffers.dp_gridcnt);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, *m_gpuBuffers.dp_gridoff);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, *m_gpuBuffers.dp_undx);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, *m_gpuBuffers.dp_gridadj);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, *m_gpuBuffers.dp_neighborCnt);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, *m_gpuBuffers.dp_neighborOff);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, *m_gpuBuffers.dp_neighbors);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, m_pairwiseCutoff ? *m_radiiSSBO : 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, buildPositionsGPU());
+
+    m_neighborListShader.use();
+    m_neighborListShader.update("pnum",              m_numElements);
+    m_neighborListShader.update("pass",              pass);
+    m_neighborListShader.update("radius2",           m_searchRadius * m_searchRadius);
+    m_neighborListShader.update("gridRes",           m_gridRes);
+    m_neighborListShader.update("numberOfGridCells", m_gridTotal);
+    m_neighborListShader.update("gridAdjCnt",        m_gridAdjCnt);
+    m_neighborListShader.update("searchCellOff",     m_gridAdjOff);
+    m_neighborListShader.update("cellOrder",         cellOrderDefine());
+    m_neighborListShader.update("searchCellMin",     m_gridSearchMin);
+    m_neighborListShader.update("searchCellMax",     m_gridSearchMax);
+    m_neighborListShader.update("periodicBox",       m_periodicBox);
+    m_neighborListShader.update("gridMin",           m_gridMin);
+    m_neighborListShader.update("gridDelta",         m_gridDelta);
+    m_neighborListShader.update("pairwiseCutoff",    m_pairwiseCutoff ? 1 : 0);
+    m_neighborListShader.update("probeRadius",       m_probeRadius);
+    m_neighborListShader.update("halfStencil",       m_stencil == Stencil::Half ? 1 : 0);
+    glDispatchCompute(m_numBlocks, 1, 1);
+    glMemoryBarrier (GL_ALL_BARRIER_BITS);
+
+    for (GLuint binding = 0; binding <= 10; binding++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+}
+
+
+
+void NeighborhoodSearch::buildNeighborList(const std::vector<glm::vec3>& rPositions, NeighborListCPU& neighborList, int threadCount)
+{
+    if (m_backend != Backend::CPU) {
+        Logger::instance().print("Neighborhood search has been initialized for the GPU, use the SSBO neighbor list instead", Logger::Mode::ERROR);
+        return;
+    }
+    if (!m_structureValid) {
+        Logger::instance().print("Neighbor list needs a run of the neighborhood search first", Logger::Mode::ERROR);
+        return;
+    }
+    if (rPositions.size() < (size_t)m_numElements) {
+        Logger::instance().print("Neighbor list got less positions than elements", Logger::Mode::ERROR);
+        return;
+    }
+    threadCount = std::max(1, threadCount);
+    float radius2 = m_searchRadius * m_searchRadius;
+
+    /*
+     * visits all neighbors of element i in the order of the search cells,
+     * both passes see the same order so the counts match the written neighbors
+     */
+    bool halfStencil = (m_stencil == Stencil::Half);
+    const std::vector<glm::vec3>& rBuildPositions = buildPositionsCPU(rPositions);
+    auto forEachNeighbor = [&](int i, uint* pNeighbors) -> int
+    {
+        int count = 0;
+        uint cell = m_cpuTempCell[i];
+        if (cell == (uint)GRID_UNDEF) return 0;
+        glm::vec3 position = rPositions[i];
+        glm::ivec3 cellCoordinates = m_hashed ? cellOfPosition(rBuildPositions[i], m_gridMin, m_gridDelta, m_gridRes, m_periodicBox)
+                                              : decodeCell(cell, m_gridRes, cellOrderDefine());
+        auto visitCell = [&](uint searchCell, glm::ivec3 searchCellCoordinates, bool ownCell)
+        {
+            int cellStart = m_cpuGridOff[searchCell];
+            int cellEnd = cellStart + m_cpuGridCnt[searchCell];
+            for (int j = cellStart; j < cellEnd; j++) {
+                uint neighbor = m_cpuOriginalIndex[j];
+                if (neighbor == (uint)i || (ownCell && neighbor < (uint)i)) continue;
+
+                // cells sharing a hash slot would otherwise be visited several times
+                if (m_hashed && cellOfPosition(rBuildPositions[neighbor], m_gridMin, m_gridDelta, m_gridRes, m_periodicBox) != searchCellCoordinates) continue;
+
+                glm::vec3 distance = minimumImage(position - rPositions[neighbor], m_periodicBox);
+                float cutoff2 = radius2;
+                if (m_pairwiseCutoff) {
+                    float cutoff = m_cpuRadii[i] + m_cpuRadii[neighbor] + 2.f * m_probeRadius;
+                    cutoff2 = cutoff * cutoff;
+                }
+                if (glm::dot(distance, distance) < cutoff2) {
+                    if (pNeighbors != 0x0) pNeighbors[count] = neighbor;
+                    count++;
+                }
+            }
+        };
+        if (halfStencil) {
+            forEachHalfSearchCell(cellCoordinates, visitCell);
+        } else {
+            forEachSearchCell(cellCoordinates, [&](uint searchCell, glm::ivec3 searchCellCoordinates)
+            {
+                visitCell(searchCell, searchCellCoordinates, false);
+            });
+        }
+        return count;
+    };
+
+    // count the neighbors of every element
+    m_cpuNeighborOff.assign(m_numElements + 1, 0);
+    parallelFor(m_numElements, threadCount, [&](int, int minIndex, int maxIndex)
+    {
+        for (int i = minIndex; i < maxIndex; i++) {
+            m_cpuNeighborOff[i] = forEachNeighbor(i, 0x0);
+        }
+    });
+
+    // exclusive scan, the last offset is the total
+    int offset = 0;
+    for (int i = 0; i <= m_numElements; i++) {
+        int count = m_cpuNeighborOff[i];
+        m_cpuNeighborOff[i] = offset;
+        offset += count;
+    }
+
+    // write the neighbors
+    m_cpuNeighbors.resize(offset);
+    parallelFor(m_numElements, threadCount, [&](int, int minIndex, int maxIndex)
+    {
+        for (int i = minIndex; i < maxIndex; i++) {
+            forEachNeighbor(i, m_cpuNeighbors.data() + m_cpuNeighborOff[i]);
+        }
+    });
+
+    neighborList.p_neighborOffsets = m_cpuNeighborOff.data();
+    neighborList.p_neighborIndices = m_cpuNeighbors.data();
+    neighborList.numberOfNeighbors = offset;
+    neighborList.halfStencil       = halfStencil;
+}
+
+
+
+void NeighborhoodSearch::forEachPair(const std::vector<glm::vec3>& rPositions, PairFunction function, int threadCount)
+{
+    if (m_backend != Backend::CPU) {
+        Logger::instance().print("Neighborhood search has been initialized for the GPU, pairs are only visited on the CPU", Logger::Mode::ERROR);
+        return;
+    }
+    if (!m_structureValid) {
+        Logger::instance().print("Pair iteration needs a run of the neighborhood search first", Logger::Mode::ERROR);
+        return;
+    }
+    if (rPositions.size() < (size_t)m_numElements) {
+        Logger::instance().print("Pair iteration got less positions than elements", Logger::Mode::ERROR);
+        return;
+    }
+    threadCount = std::max(1, threadCount);
+    float radius2 = m_searchRadius * m_searchRadius;
+    const std::vector<glm::vec3>& rBuildPositions = buildPositionsCPU(rPositions);
+
+    parallelFor(m_numElements, threadCount, [&](int thread, int minIndex, int maxIndex)
+    {
+        for (int i = minIndex; i < maxIndex; i++) {
+            uint cell = m_cpuTempCell[i];
+            if (cell == (uint)GRID_UNDEF) continue;
+            glm::vec3 position = rPositions[i];
+            glm::ivec3 cellCoordinates = m_hashed ? cellOfPosition(rBuildPositions[i], m_gridMin, m_gridDelta, m_gridRes, m_periodicBox)
+                                                  : decodeCell(cell, m_gridRes, cellOrderDefine());
+            forEachHalfSearchCell(cellCoordinates, [&](uint searchCell, glm::ivec3 searchCellCoordinates, bool ownCell)
+            {
+                int cellStart = m_cpuGridOff[searchCell];
+                int cellEnd = cellStart + m_cpuGridCnt[searchCell];
+                for (int j = cellStart; j < cellEnd; j++) {
+                    uint neighbor = m_cpuOriginalIndex[j];
+                    if (ownCell && neighbor <= (uint)i) continue;
+
+                    // cells sharing a hash slot would otherwise be visited several times
+                    if (m_hashed && cellOfPosition(rBuildPositions[neighbor], m_gridMin, m_gridDelta, m_gridRes, m_periodicBox) != searchCellCoordinates) continue;
+
+                    glm::vec3 distance = minimumImage(position - rPositions[neighbor], m_periodicBox);
+                    float distance2 = glm::dot(distance, distance);
+                    float cutoff2 = radius2;
+                    if (m_pairwiseCutoff) {
+                        float cutoff = m_cpuRadii[i] + m_cpuRadii[neighbor] + 2.f * m_probeRadius;
+                        cutoff2 = cutoff * cutoff;
+                    }
+                    if (distance2 < cutoff2) function(thread, (uint)i, neighbor, distance2);
+                }
+            });
+        }
+    });
+}
+
+
+
+template<typename F>
+void NeighborhoodSearch::forEachSearchCell(glm::ivec3 cell, F function) const
+{
+    // without constant offsets the search cells are walked around the cell coordinates
+    bool periodic = m_periodicBox.x > 0.f || m_periodicBox.y > 0.f || m_periodicBox.z > 0.f;
+    if (m_hashed || m_cellOrder == CellOrder::Morton || periodic) {
+        for (int y = m_gridSearchMin.y; y <= m_gridSearchMax.y; y++) {
+            for (int z = m_gridSearchMin.z; z <= m_gridSearchMax.z; z++) {
+                for (int x = m_gridSearchMin.x; x <= m_gridSearchMax.x; x++) {
+                    glm::ivec3 searchCell = cell + glm::ivec3(x, y, z);
+                    bool inside = true;
+                    for (int a = 0; a < 3; a++) {
+                        if (m_periodicBox[a] > 0.f) {
+                            searchCell[a] = ((searchCell[a] % m_gridRes[a]) + m_gridRes[a]) % m_gridRes[a];
+                        } else if (!m_hashed && (searchCell[a] < 0 || searchCell[a] >= m_gridRes[a])) {
+                            inside = false; // hashed cells are not bound to the grid
+                        }
+                    }
+                    if (inside) function(cellIndex(searchCell), searchCell);
+                }
+            }
+        }
+        return;
+    }
+
+    uint startCell = cellIndex(cell) - m_gridAdjOff;
+    for (int searchCellIndex = 0; searchCellIndex < m_gridAdjCnt; searchCellIndex++) {
+        uint currentCell = startCell + m_gridAdj[searchCellIndex];
+        if (currentCell >= (uint)m_gridTotal) continue; // search cell is outside of the grid
+        function(currentCell, decodeCell(currentCell, m_gridRes, CELL_ORDER_LINEAR));
+    }
+}
+
+
+
+template<typename F>
+void NeighborhoodSearch::forEachHalfSearchCell(glm::ivec3 cell, F function) const
+{
+    // the half stencil needs the offsets, so the search cells are always walked
+    for (int y = m_gridSearchMin.y; y <= m_gridSearchMax.y; y++) {
+        for (int z = m_gridSearchMin.z; z <= m_gridSearchMax.z; z++) {
+            for (int x = m_gridSearchMin.x; x <= m_gridSearchMax.x; x++) {
+                glm::ivec3 offset = glm::ivec3(x, y, z);
+                glm::ivec3 searchCell = cell + offset;
+                bool inside = true;
+                for (int a = 0; a < 3; a++) {
+                    if (m_periodicBox[a] > 0.f) {
+                        searchCell[a] = ((searchCell[a] % m_gridRes[a]) + m_gridRes[a]) % m_gridRes[a];
+                    } else if (!m_hashed && (searchCell[a] < 0 || searchCell[a] >= m_gridRes[a])) {
+                        inside = false; // hashed cells are not bound to the grid
+                    }
+                }
+                if (!inside) continue;
+
+                int mode = halfStencilMode(offset, cell, searchCell, m_gridSearchMin, m_gridSearchMax, m_gridRes, m_periodicBox);
+                if (mode != HALF_STENCIL_SKIP) function(cellIndex(searchCell), searchCell, mode == HALF_STENCIL_OWN_CELL);
+            }
+        }
+    }
+}
+
+
+
+
+
+
+//-----------------------------------------------------//
+//                 RESOLUTION TUNING                   //
+//-----------------------------------------------------//
+glm::ivec3 NeighborhoodSearch::suggestResolution(uint numElements, glm::fvec3 min, glm::fvec3 max, float searchRadius, glm::vec3 periodicBox)
+{
+    glm::vec3 size = max - min;
+    for (int a = 0; a < 3; a++) {
+        if (periodicBox[a] > 0.f) size[a] = periodicBox[a];
+    }
+
+    /*
+     * cells as wide as the search radius need the fewest search cells. In dilute
+     * systems they hold hardly any particles, there cells are widened until they
+     * hold a few particles on average. Flat boxes count with the radius as thickness.
+     * The radius is the one the grid searches, with the largest pairwise cutoff and the skin
+     */
+    updateMaxElementRadius(numElements);
+    searchRadius = pairwiseSearchRadius(searchRadius) + m_requestedSkin;
+    glm::vec3 thickness = glm::max(size, glm::vec3(std::max(searchRadius, 1e-6f)));
+    float volume = thickness.x * thickness.y * thickness.z;
+    float densityWidth = std::cbrt(volume * TUNING_ELEMENTS_PER_CELL / std::max(1u, numElements));
+    float cellWidth = std::max(searchRadius, densityWidth);
+
+    // only morton codes limit the resolution
+    float maxResolution = (m_requestedCellOrder == CellOrder::Morton) ? (float)MORTON_MAX_RES : (float)std::numeric_limits<int>::max();
+    glm::ivec3 resolution;
+    for (int a = 0; a < 3; a++) {
+        resolution[a] = (int)std::min(maxResolution, std::floor(size[a] / cellWidth));
+        resolution[a] = std::max(1, resolution[a]);
+    }
+    return resolution;
+}
+
+
+
+glm::ivec3 NeighborhoodSearch::tuneResolution(GLuint* positionsSSBO, glm::fvec3 min, glm::fvec3 max, float searchRadius, int trialRuns, glm::vec3 periodicBox)
+{
+    if (m_backend != Backend::GPU) {
+        Logger::instance().print("Neighborhood search has been initialized for the CPU, use the host tuning instead", Logger::Mode::ERROR);
+        return m_gridRes;
+    }
+
+    Neighborhood neighborhood;
+    return tuneResolutionWith(min, max, searchRadius, trialRuns, periodicBox, [&]()
+    {
+        run(positionsSSBO, neighborhood);
+    });
+}
+glm::ivec3 NeighborhoodSearch::tuneResolution(const std::vector<glm::vec3>& rPositions, glm::fvec3 min, glm::fvec3 max, float searchRadius, int trialRuns, int threadCount, glm::vec3 periodicBox)
+{
+    if (m_backend != Backend::CPU) {
+        Logger::instance().print("Neighborhood search has been initialized for the GPU, use the SSBO tuning instead", Logger::Mode::ERROR);
+        return m_gridRes;
+    }
+
+    NeighborhoodCPU neighborhood;
+    return tuneResolutionWith(min, max, searchRadius, trialRuns, periodicBox, [&]()
+    {
+        run(rPositions, neighborhood, threadCount);
+    });
+}
+
+
+
+template<typename F>
+glm::ivec3 NeighborhoodSearch::tuneResolutionWith(glm::fvec3 min, glm::fvec3 max, float searchRadius, int trialRuns, glm::vec3 periodicBox, F runFunction)
+{
+    /*
+     * candidates scale the cell width of the suggestion, half widths trade
+     * more search cells for fewer particles per cell. The suggestion is sized
+     * for the skin the chosen resolution is used with
+     */
+    glm::ivec3 suggestion = suggestResolution(m_numElements, min, max, searchRadius, periodicBox);
+    const float scales[] = {0.5f, 1.f, 1.5f, 2.f};
+    std::vector<glm::ivec3> candidates;
+    for (float scale : scales) {
+        glm::ivec3 candidate = glm::max(glm::ivec3(1), glm::ivec3(glm::vec3(suggestion) / scale));
+        if (m_requestedCellOrder == CellOrder::Morton) candidate = glm::min(candidate, glm::ivec3(MORTON_MAX_RES));
+        if (std::find(candidates.begin(), candidates.end(), candidate) == candidates.end()) {
+            candidates.push_back(candidate);
+        }
+    }
+
+    // every trial has to build, skin caching would skip the builds
+    float requestedSkin = m_requestedSkin;
+    bool profiling = m_profiling;
+    m_requestedSkin = 0.f;
+    m_profiling = true;
+    trialRuns = std::max(1, trialRuns);
+
+    Logger::instance().print("Tuning grid resolution:"); Logger::instance().tabIn();
+    glm::ivec3 bestResolution = suggestion;
+    double bestTime = -1.0;
+    for (const glm::ivec3& rCandidate : candidates) {
+        update(m_numElements, min, max, rCandidate, searchRadius, periodicBox);
+        runFunction(); // warm up, buffers may have been resized
+        resetStageTimings();
+        for (int r = 0; r < trialRuns; r++) {
+            runFunction();
+        }
+        printStageTimings();
+
+        double time = getStageTimings().total;
+        if (bestTime < 0.0 || time < bestTime) {
+            bestTime = time;
+            bestResolution = rCandidate;
+        }
+    }
+
+    // keep the fastest resolution
+    m_requestedSkin = requestedSkin;
+    m_profiling = profiling;
+    update(m_numElements, min, max, bestResolution, searchRadius, periodicBox);
+    resetStageTimings();
+    resetRebuildStatistics();
+    Logger::instance().print("Chosen resolution " + std::to_string(bestResolution.x) + "x" + std::to_string(bestResolution.y) + "x"
+                             + std::to_string(bestResolution.z) + " with " + std::to_string(bestTime) + " ms per build");
+    Logger::instance().tabOut();
+    return bestResolution;
+}
+
+
+
+
+
+
+//-----------------------------------------------------//
+//                 NEAREST NEIGHBORS                   //
+//-----------------------------------------------------//
+void NeighborhoodSearch::findNearestNeighbors(int k, NearestNeighbors& nearestNeighbors)
+{
+    nearestNeighborsGPU(m_gpuBuffers.dp_pos, m_numElements, k, true, nearestNeighbors);
+}
+void NeighborhoodSearch::findNearestNeighbors(GLuint* queryPointsSSBO, int numberOfQueries, int k, NearestNeighbors& nearestNeighbors)
+{
+    nearestNeighborsGPU(queryPointsSSBO, numberOfQueries, k, false, nearestNeighbors);
+}
+void NeighborhoodSearch::findNearestNeighbors(const std::vector<glm::vec3>& rPositions, int k, NearestNeighborsCPU& nearestNeighbors, int threadCount)
+{
+    nearestNeighborsCPU(rPositions, rPositions.data(), m_numElements, k, true, nearestNeighbors, threadCount);
+}
+void NeighborhoodSearch::findNearestNeighbors(const std::vector<glm::vec3>& rPositions, const std::vector<glm::vec3>& rQueryPoints, int k, NearestNeighborsCPU& nearestNeighbors, int threadCount)
+{
+    nearestNeighborsCPU(rPositions, rQueryPoints.data(), (int)rQueryPoints.size(), k, false, nearestNeighbors, threadCount);
+}
+
+
+
+void NeighborhoodSearch::nearestNeighborsGPU(GLuint* queryPointsSSBO, int numberOfQueries, int k, bool excludeSelf, NearestNeighbors& nearestNeighbors)
+{
+    if (m_backend != Backend::GPU) {
+        Logger::instance().print("Neighborhood search has been initialized for the CPU, use the host nearest neighbors instead", Logger::Mode::ERROR);
+        return;
+    }
+    if (!m_structureValid) {
+        Logger::instance().print("Nearest neighbors need a run of the neighborhood search first", Logger::Mode::ERROR);
+        return;
+    }
+    if (k < 1 || k > KNN_MAX_K) {
+        Logger::instance().print("Nearest neighbors on the GPU support k from 1 to " + std::to_string(KNN_MAX_K), Logger::Mode::ERROR);
+        return;
+    }
+    if (m_skin > 0.f && needsRebuildGPU()) {
+        Logger::instance().print("Nearest neighbors need a run of the neighborhood search, particles moved more than half of the skin", Logger::Mode::ERROR);
+        return;
+    }
+
+    // results grow geometrically like the other buffers
+    uint numberOfResults = (uint)(numberOfQueries * k);
+    if (numberOfResults > m_knnCapacity) {
+        m_knnCapacity = std::max(numberOfResults, 2 * m_knnCapacity);
+        GPUHandler::resizeSSBO<uint> (m_gpuBuffers.dp_knnIndices,   m_knnCapacity);
+        GPUHandler::resizeSSBO<float>(m_gpuBuffers.dp_knnDistances, m_knnCapacity);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, *m_gpuBuffers.dp_pos);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, *m_gpuBuffers.dp_gridcnt);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, *m_gpuBuffers.dp_gridoff);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, *m_gpuBuffers.dp_undx);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, *queryPointsSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, *m_gpuBuffers.dp_knnIndices);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, *m_gpuBuffers.dp_knnDistances);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, buildPositionsGPU());
+
+    uint numBlocks, numThreads;
+    computeNumBlocks(std::max(1, numberOfQueries), BLOCK_SIZE, numBlocks, numThreads);
+    m_nearestNeighborsShader.use();
+    m_nearestNeighborsShader.update("qnum",              numberOfQueries);
+    m_nearestNeighborsShader.update("k",                 k);
+    m_nearestNeighborsShader.update("excludeSelf",       excludeSelf ? 1 : 0);
+    m_nearestNeighborsShader.update("numberOfElements",  m_numElements);
+    m_nearestNeighborsShader.update("gridRes",           m_gridRes);
+    m_nearestNeighborsShader.update("gridMin",           m_gridMin);
+    m_nearestNeighborsShader.update("gridDelta",         m_gridDelta);
+    m_nearestNeighborsShader.update("numberOfGridCells", m_gridTotal);
+    m_nearestNeighborsShader.update("cellOrder",         cellOrderDefine());
+    m_nearestNeighborsShader.update("periodicBox",       m_periodicBox);
+    m_nearestNeighborsShader.update("hashedShells",      hashedShellCount());
+    m_nearestNeighborsShader.update("halfSkin",          0.5f * m_skin);
+    glDispatchCompute(numBlocks, 1, 1);
+    glMemoryBarrier (GL_ALL_BARRIER_BITS);
+
+    for (GLuint binding = 0; binding <= 7; binding++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+
+    nearestNeighbors.dp_neighborIndices   = m_gpuBuffers.dp_knnIndices;
+    nearestNeighbors.dp_neighborDistances = m_gpuBuffers.dp_knnDistances;
+    nearestNeighbors.k                    = k;
+    nearestNeighbors.numberOfQueries      = numberOfQueries;
+}
+
+
+
+void NeighborhoodSearch::nearestNeighborsCPU(const std::vector<glm::vec3>& rPositions, const glm::vec3* pQueryPoints, int numberOfQueries, int k, bool excludeSelf, NearestNeighborsCPU& nearestNeighbors, int threadCount)
+{
+    if (m_backend != Backend::CPU) {
+        Logger::instance().print("Neighborhood search has been initialized for the GPU, use the SSBO nearest neighbors instead", Logger::Mode::ERROR);
+        return;
+    }
+    if (!m_structureValid) {
+        Logger::instance().print("Nearest neighbors need a run of the neighborhood search first", Logger::Mode::ERROR);
+        return;
+    }
+    if (rPositions.size() < (size_t)m_numElements) {
+        Logger::instance().print("Nearest neighbors got less positions than elements", Logger::Mode::ERROR);
+        return;
+    }
+    if (k < 1) {
+        Logger::instance().print("Nearest neighbors need a k of at least one", Logger::Mode::ERROR);
+        return;
+    }
+    threadCount = std::max(1, threadCount);
+    if (m_skin > 0.f && needsRebuildCPU(rPositions, threadCount)) {
+        Logger::instance().print("Nearest neighbors need a run of the neighborhood search, particles moved more than half of the skin", Logger::Mode::ERROR);
+        return;
+    }
+
+    m_cpuKnnIndices.resize((size_t)numberOfQueries * k);
+    m_cpuKnnDistances.resize((size_t)numberOfQueries * k);
+    parallelFor(numberOfQueries, threadCount, [&](int, int minIndex, int maxIndex)
+    {
+        for (int q = minIndex; q < maxIndex; q++) {
+            nearestNeighborsOfPoint(rPositions, pQueryPoints[q], excludeSelf ? q : -1, k,
+                                    m_cpuKnnIndices.data() + (size_t)q * k, m_cpuKnnDistances.data() + (size_t)q * k);
+        }
+    });
+
+    nearestNeighbors.p_neighborIndices   = m_cpuKnnIndices.data();
+    nearestNeighbors.p_neighborDistances = m_cpuKnnDistances.data();
+    nearestNeighbors.k                   = k;
+    nearestNeighbors.numberOfQueries     = numberOfQueries;
+}
+
+
+
+void NeighborhoodSearch::nearestNeighborsOfPoint(const std::vector<glm::vec3>& rPositions, glm::vec3 query, int excludeIndex, int k, uint* pIndices, float* pDistances) const
+{
+    // candidates are kept sorted by squared distance and index
+    int found = 0;
+    std::fill(pIndices, pIndices + k, (uint)GRID_UNDEF);
+    std::fill(pDistances, pDistances + k, std::numeric_limits<float>::infinity());
+    auto visitElement = [&](uint neighbor)
+    {
+        if ((int)neighbor == excludeIndex) return;
+
+        glm::vec3 distance = minimumImage(query - rPositions[neighbor], m_periodicBox);
+        float distance2 = glm::dot(distance, distance);
+        if (found == k && (distance2 > pDistances[k-1] || (distance2 == pDistances[k-1] && neighbor > pIndices[k-1]))) return;
+
+        // insert into the sorted candidates
+        int n = std::min(found, k-1);
+        while (n > 0 && (pDistances[n-1] > distance2 || (pDistances[n-1] == distance2 && pIndices[n-1] > neighbor))) {
+            pDistances[n] = pDistances[n-1];
+            pIndices[n] = pIndices[n-1];
+            n--;
+        }
+        pDistances[n] = distance2;
+        pIndices[n] = neighbor;
+        found = std::min(found + 1, k);
+    };
+
+    /*
+     * cell offsets per axis that lie inside the grid, periodic axes cover the box
+     * once. Open axes of a hashed grid are unbounded, there the shells stop once
+     * they hold as many cells as the table has slots and the elements left
+     * are visited one by one
+     */
+    glm::ivec3 cell = cellOfPosition(query, m_gridMin, m_gridDelta, m_gridRes, m_periodicBox);
+    glm::ivec3 minOffset, maxOffset;
+    int maxShell = 0;
+    int hashedShells = hashedShellCount();
+    bool bounded = true;
+    float cellWidth = std::numeric_limits<float>::max();
+    for (int a = 0; a < 3; a++) {
+        if (m_periodicBox[a] > 0.f) {
+            minOffset[a] = -(m_gridRes[a]-1)/2;
+            maxOffset[a] = minOffset[a] + m_gridRes[a] - 1;
+        } else if (m_hashed) {
+            minOffset[a] = -hashedShells;
+            maxOffset[a] =  hashedShells;
+            bounded = false;
+        } else {
+            minOffset[a] = -cell[a];
+            maxOffset[a] = m_gridRes[a] - 1 - cell[a];
+        }
+        maxShell = std::max(maxShell, std::max(-minOffset[a], maxOffset[a]));
+        cellWidth = std::min(cellWidth, 1.f / m_gridDelta[a]);
+    }
+
+    // the search stops early once every inserted element has been seen
+    int insertedElements = m_cpuGridOff[m_gridTotal-1] + m_cpuGridCnt[m_gridTotal-1];
+    int visitedElements = 0;
+    const std::vector<glm::vec3>& rBuildPositions = buildPositionsCPU(rPositions);
+
+    /*
+     * particles are in the cells of the last build, with a skin
+     * they may have come closer by half of it since then
+     */
+    float halfSkin = 0.5f * m_skin;
+    bool complete = false;
+
+    for (int shell = 0; shell <= maxShell && !complete; shell++) {
+        for (int y = -shell; y <= shell; y++) {
+            if (y < minOffset.y || y > maxOffset.y) continue;
+            for (int z = -shell; z <= shell; z++) {
+                if (z < minOffset.z || z > maxOffset.z) continue;
+
+                // inside the shell only the two outer cells of a row belong to it
+                bool outerRow = (std::abs(y) == shell || std::abs(z) == shell);
+                int step = outerRow ? 1 : std::max(1, 2 * shell);
+                for (int x = -shell; x <= shell; x += step) {
+                    if (x < minOffset.x || x > maxOffset.x) continue;
+
+                    glm::ivec3 searchCell = cell + glm::ivec3(x, y, z);
+                    for (int a = 0; a < 3; a++) {
+                        if (m_periodicBox[a] > 0.f) searchCell[a] = ((searchCell[a] % m_gridRes[a]) + m_gridRes[a]) % m_gridRes[a];
+                    }
+                    uint currentCell = cellIndex(searchCell);
+                    int cellStart = m_cpuGridOff[currentCell];
+                    int cellEnd = cellStart + m_cpuGridCnt[currentCell];
+                    for (int j = cellStart; j < cellEnd; j++) {
+                        uint neighbor = m_cpuOriginalIndex[j];
+
+                        // cells sharing a hash slot would otherwise be visited several times
+                        if (m_hashed && cellOfPosition(rBuildPositions[neighbor], m_gridMin, m_gridDelta, m_gridRes, m_periodicBox) != searchCell) continue;
+                        visitedElements++;
+                        visitElement(neighbor);
+                    }
+                }
+            }
+        }
+
+        // particles in unvisited cells are at least shell cell widths away
+        float reach = std::max(0.f, shell * cellWidth - halfSkin);
+        complete = (found == k && pDistances[k-1] <= reach * reach) || visitedElements >= insertedElements;
+    }
+
+    // elements beyond the last shell on open axes of a hashed grid
+    if (!complete && !bounded) {
+        for (int j = 0; j < insertedElements; j++) {
+            uint neighbor = m_cpuOriginalIndex[j];
+            glm::ivec3 offset = cellOfPosition(rBuildPositions[neighbor], m_gridMin, m_gridDelta, m_gridRes, m_periodicBox) - cell;
+            bool visited = true;
+            for (int a = 0; a < 3; a++) {
+                if (m_periodicBox[a] <= 0.f && std::abs(offset[a]) > hashedShells) visited = false; // periodic axes are covered
+            }
+            if (!visited) visitElement(neighbor);
+        }
+    }
+
+    for (int n = 0; n < found; n++) {
+        pDistances[n] = std::sqrt(pDistances[n]);
+    }
+}
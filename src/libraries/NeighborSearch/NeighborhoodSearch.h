@@ -9,6 +9,11 @@
 #include <math.h>
 #include <malloc.h>
 #include <string.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <vector>
 #include <ShaderTools/ShaderProgram.h>
 #include <Utils/Timer.h>
 
@@ -21,6 +26,51 @@
 
 class NeighborhoodSearch {
 public:
+    /*
+     * Backend the structures are built with. The CPU backend does not touch
+     * OpenGL at all and can therefore be used without a context.
+     */
+    enum class Backend
+    {
+        GPU, CPU
+    };
+
+    /*
+     * Order of the cell indices. Morton order keeps spatially close cells close
+     * in memory, which makes the walk over the search cells more cache friendly
+     */
+    enum class CellOrder
+    {
+        Linear, Morton
+    };
+
+    /*
+     * Storage of the cells. A dense grid stores every cell of the bounding box,
+     * a hashed grid maps the cells to a table sized by the number of elements,
+     * which suits sparse systems. Automatic hashes if the dense grid would be
+     * much larger than that table
+     */
+    enum class GridType
+    {
+        Dense, Hashed, Automatic
+    };
+
+    /*
+     * Search cells of the neighbor list. The full stencil lists every pair at both
+     * particles, the half stencil searches only one of two opposite cells and lists
+     * every unordered pair once, which halves the work of symmetric computations
+     */
+    enum class Stencil
+    {
+        Full, Half
+    };
+
+    /*
+     * called once per unordered pair within the search radius, i and j are original
+     * indices and thread is the index of the calling thread
+     */
+    typedef std::function<void(int thread, uint i, uint j, float distance2)> PairFunction;
+
     ~NeighborhoodSearch();
 
     /*
@@ -28,6 +78,7 @@ public:
      */
     int getNumberOfGridCells();
     glm::vec3 getGridSize();
+    glm::vec3 getPeriodicBox();
     glm::ivec3 getGridResolution();
     float getCellSize();
     void getGridMinMax(glm::vec3& min, glm::vec3& max);
@@ -38,21 +89,107 @@ public:
     int getNumberOfThreadsPerBlockForGridComputation();
     float getMaxSearchRadius();
     int getTotalGridNum();
+    Backend getBackend();
+    void setCellOrder(CellOrder cellOrder); // applied with the next init or update
+    CellOrder getCellOrder();
+    void setGridType(GridType gridType);    // applied with the next init or update
+    GridType getGridType();                 // type in use, dense or hashed
+    void setStencil(Stencil stencil);       // applied with the next neighbor list
+    Stencil getStencil();
+    void setDeterministic(bool deterministic); // applied with the next run, particles of a cell in original order
+    bool getDeterministic();
+    void setSkin(float skin);               // applied with the next init or update, 0 disables caching
+    float getSkin();
+    uint getRunCount();
+    uint getRebuildCount();
+    float getRebuildRate();                 // rebuilds per run
+    void resetRebuildStatistics();
 
     /*
      * neighbor search
      */
-    void init(uint numElements, glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius);
-    void update(uint numElements, glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius);
+    /*
+     * Axes with a positive periodic box length wrap around, the grid then
+     * spans exactly one box from min and max is ignored along that axis
+     */
+    void init(uint numElements, glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius, Backend backend = Backend::GPU, glm::vec3 periodicBox = glm::vec3(0.f));
+    void update(uint numElements, glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius, glm::vec3 periodicBox = glm::vec3(0.f));
     void run(GLuint* positionsSSBO, Neighborhood& neighborhood);
+    void run(const std::vector<glm::vec3>& rPositions, NeighborhoodCPU& neighborhood, int threadCount = 1);
+
+    /*
+     * Builds the grids of a block of frames at once. The positions hold the frames
+     * one after another, numberOfElements float4 each, and all frames use the grid of
+     * the last init or update. Launches and buffer resets are shared by the block,
+     * the single frame structure of the last run is replaced
+     */
+    void runBatch(GLuint* positionsSSBO, int numberOfFrames, NeighborhoodBatch& batch);
+
+    /*
+     * Pairwise cutoffs. With element radii particles i and j are neighbors if their
+     * distance is below r_i + r_j + 2 probeRadius, and the search cells are sized for
+     * the largest pair. The radii are indexed by original index, they are applied
+     * with the next init or update. The GPU buffer holds one float per element and
+     * stays owned by the caller
+     */
+    void setElementRadii(GLuint* radiiSSBO, float probeRadius);
+    void setElementRadii(const std::vector<float>& rRadii, float probeRadius);
+    void clearElementRadii();
+    float getMaxElementRadius();
+
+    /*
+     * Resolution tuning. A resolution with a component of zero or less lets init
+     * and update use the suggested resolution, which derives the cell size from the
+     * particle density and the radius the grid searches, that is the search radius or
+     * the largest pairwise cutoff plus the skin. Only morton order limits it to
+     * MORTON_MAX_RES. Tuning times a few builds for cell sizes around the suggestion,
+     * keeps the fastest and returns its resolution
+     */
+    glm::ivec3 suggestResolution(uint numElements, glm::fvec3 min, glm::fvec3 max, float searchRadius, glm::vec3 periodicBox = glm::vec3(0.f));
+    glm::ivec3 tuneResolution(GLuint* positionsSSBO, glm::fvec3 min, glm::fvec3 max, float searchRadius, int trialRuns = 3, glm::vec3 periodicBox = glm::vec3(0.f));
+    glm::ivec3 tuneResolution(const std::vector<glm::vec3>& rPositions, glm::fvec3 min, glm::fvec3 max, float searchRadius, int trialRuns = 3, int threadCount = 1, glm::vec3 periodicBox = glm::vec3(0.f));
+
+    /*
+     * Timings of the build stages, while profiling the GPU is synchronized after every stage
+     */
+    void setProfiling(bool profiling);
+    bool getProfiling();
+    StageTimings getStageTimings();
+    void resetStageTimings();
+    void printStageTimings();
+
+    /*
+     * Compact list of all neighbors within the search radius, built from the
+     * structures of the last run. The GPU version reads the positions buffer of
+     * that run, the CPU version the given positions
+     */
+    void buildNeighborList(NeighborList& neighborList);
+    void buildNeighborList(const std::vector<glm::vec3>& rPositions, NeighborListCPU& neighborList, int threadCount = 1);
+
+    /*
+     * Visits every unordered pair within the search radius once, using the half
+     * stencil on the structures of the last run. Pairs are split over the threads
+     * by their first particle, the function has to be safe for concurrent calls
+     */
+    void forEachPair(const std::vector<glm::vec3>& rPositions, PairFunction function, int threadCount = 1);
+
+    /*
+     * k nearest neighbors on the structures of the last run, either of every element
+     * without itself or of arbitrary query points. Cell shells around the query are
+     * searched until no unvisited cell can hold a nearer particle. With a skin the
+     * positions may not have moved more than half of it since the last build. Query
+     * points on the GPU are float4, k is limited to KNN_MAX_K there
+     */
+    void findNearestNeighbors(int k, NearestNeighbors& nearestNeighbors);
+    void findNearestNeighbors(GLuint* queryPointsSSBO, int numberOfQueries, int k, NearestNeighbors& nearestNeighbors);
+    void findNearestNeighbors(const std::vector<glm::vec3>& rPositions, int k, NearestNeighborsCPU& nearestNeighbors, int threadCount = 1);
+    void findNearestNeighbors(const std::vector<glm::vec3>& rPositions, const std::vector<glm::vec3>& rQueryPoints, int k, NearestNeighborsCPU& nearestNeighbors, int threadCount = 1);
 
 
 private:
     // grid parameters
-    uint*       m_grid;
-    uint*       m_gridCnt;
     int         m_gridSearch;
-    int         m_gridAdj[216];     // maximal size of the adjacency mask is 6x6x6
+    std::vector<int> m_gridAdj;     // adjacency mask, sized to cover the search radius
     int         m_gridAdjCnt;       // 3D search count =n^3 e.g. 2x2x2=8
     int         m_gridAdjOff;       // adjacency mask offset of the upper left cell
     glm::fvec3  m_gridMin;
@@ -60,30 +197,86 @@ private:
     glm::ivec3  m_gridRes;          // 3D grid resolution
     glm::fvec3  m_gridSize;         // 3D grid sizes
     glm::fvec3  m_gridDelta;        // delta translate from world space to cell space
+    glm::vec3   m_periodicBox;      // box length of periodic axes, zero for open axes
+    glm::ivec3  m_gridSearchMin;    // lowest search cell relative to the particle cell
+    glm::ivec3  m_gridSearchMax;    // highest search cell relative to the particle cell
     int         m_gridTotal;        // total number of cells in the grid
     Grid        m_gridDataGPU;
     float       m_cellSize;
     float       m_searchRadius;
     float       m_maxSearchRadius;
     int         m_numElements;      // number of particles
+    Backend     m_backend = Backend::GPU;
+    CellOrder   m_requestedCellOrder = CellOrder::Linear;
+    CellOrder   m_cellOrder = CellOrder::Linear;
+    GridType    m_requestedGridType = GridType::Automatic;
+    Stencil     m_stencil = Stencil::Full;
+    bool        m_deterministic = false;    // GPU build reorders the cells by original index
+    bool        m_hashed = false;   // cells are slots of a hash table, m_gridTotal is its size
+
+    // pairwise cutoffs
+    bool        m_pairwiseCutoff = false;
+    GLuint*     m_radiiSSBO = 0x0;
+    std::vector<float> m_cpuRadii;
+    float       m_probeRadius = 0.f;
+    float       m_maxElementRadius = 0.f;
+
+    // verlet skin
+    float       m_requestedSkin = 0.f;
+    float       m_skin = 0.f;               // structure is kept while no particle moved more than half of it
+    bool        m_structureValid = false;   // false until the first build after init or update
+    uint        m_runCount = 0;
+    uint        m_rebuildCount = 0;
+
+    // profiling
+    bool        m_profiling = false;
+    Timer       m_insertTimer;
+    Timer       m_scanTimer;
+    Timer       m_sortTimer;
 
     // blocksums parameters
-    uint        m_numLevelsAllocated;
-    GLuint**    m_scanBlockSumsInt;
+    uint        m_numLevelsAllocated = 0;
+    GLuint**    m_scanBlockSumsInt = 0x0;
 
     // gpu
-    GPUBuffers    m_gpuBuffers;
+    GPUBuffers    m_gpuBuffers = {};
+    uint          m_elementCapacity = 0;      // number of elements the buffers can hold
+    uint          m_cellCapacity = 0;         // number of cells the buffers can hold
+    uint          m_searchCellCapacity = 0;   // number of search cell offsets the buffer can hold
+    uint          m_scanCapacity = 0;         // number of values the block sums can scan
+    uint          m_neighborCapacity = 0;     // number of neighbors the neighbor list can hold
+    uint          m_knnCapacity = 0;          // number of nearest neighbors the query buffers can hold
     uint          m_numBlocks;
     uint          m_numThreads;
     uint          m_gridBlocks;
     uint          m_gridThreads;
 
+    // cpu
+    std::vector<uint>   m_cpuParticleCell;          // cell idx of the particle, sorted after the run
+    std::vector<uint>   m_cpuParticleCellIndex;     // insertion idx inside the cell, sorted after the run
+    std::vector<uint>   m_cpuGrid;                  // idx of the particle after sorting
+    std::vector<int>    m_cpuGridCnt;               // number of particles per cell
+    std::vector<int>    m_cpuGridOff;               // offset of every cell
+    std::vector<uint>   m_cpuOriginalIndex;         // get unsorted index from sorted index
+    std::vector<uint>   m_cpuTempCell;              // unsorted cell idx
+    std::vector<uint>   m_cpuTempCellIndex;         // unsorted insertion idx
+    std::vector<int>    m_cpuThreadGridCnt;         // cell counts per thread, thread-major
+    std::vector<glm::vec3> m_cpuRefPos;             // positions at the last build
+    std::vector<int>    m_cpuNeighborOff;           // offset of the neighbors of every element
+    std::vector<uint>   m_cpuNeighbors;             // original indices of all neighbors
+    std::vector<uint>   m_cpuKnnIndices;            // original indices of the nearest neighbors per query
+    std::vector<float>  m_cpuKnnDistances;          // distances of the nearest neighbors per query
+
     // compute shader
     ShaderProgram m_insertElementsShader;
     ShaderProgram m_prescanIntShader;
     ShaderProgram m_uniformAddIntShader;
     ShaderProgram m_fillTempDataShader;
     ShaderProgram m_countingSortShader;
+    ShaderProgram m_stableCellRankShader;
+    ShaderProgram m_maxDisplacementShader;
+    ShaderProgram m_neighborListShader;
+    ShaderProgram m_nearestNeighborsShader;
 
 
 
@@ -91,21 +284,33 @@ private:
      * init helper functions
      */
     void setupComputeShaders();
-    void allocateBuffers(uint numElements);
+    void reserveBuffers(uint numElements, uint numCells);
     void deallocateBuffers();
     void preallocBlockSumsInt(uint maxNumElements);
     void deallocBlockSumsInt();
-    void setupGrid(glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius);
-    void freeGrid();
+    void updateMaxElementRadius(uint numElements);
+    float pairwiseSearchRadius(float searchRadius) const;
+    void setupGrid(glm::fvec3 min, glm::fvec3 max, glm::ivec3 resolution, float searchRadius, glm::vec3 periodicBox);
     void calculateNumberOfBlocksAndThreads(uint numElements);
     void computeNumBlocks(int numElements, int maxThreads, uint& numBlocks, uint &numThreads);
+    uint cellIndex(glm::ivec3 cell) const;
+    int cellOrderDefine() const;
+    int hashedShellCount() const;
 
     /*
      * run helper functions
      */
-    void insertElementsInGridGPU();
+    void startStageTimer(Timer& rTimer);
+    void stopStageTimer(Timer& rTimer);
+    template<typename F>
+    glm::ivec3 tuneResolutionWith(glm::fvec3 min, glm::fvec3 max, float searchRadius, int trialRuns, glm::vec3 periodicBox, F runFunction);
+    bool needsRebuildGPU();
+    GLuint buildPositionsGPU() const;
+    bool needsRebuildCPU(const std::vector<glm::vec3>& rPositions, int threadCount);
+    const std::vector<glm::vec3>& buildPositionsCPU(const std::vector<glm::vec3>& rPositions) const;
+    void insertElementsInGridGPU(int numberOfFrames);
 
-    void prefixSumCellsGPU();
+    void prefixSumCellsGPU(int numberOfFrames);
     void prescanArrayRecursiveInt(GLuint* outArray, GLuint* inArray, int numElements, int level);
     void prescanInt(int numThreads, int numBlocks, int sharedMemSize, bool storeSum, bool isNP2, GLuint* outArray, GLuint* inArray, int level, int n, int blockIndex, int baseIndex);
     void uniformAddInt(int numThreads, int numBlocks, GLuint* outArray, int level, int n, int blockOffset, int baseIndex);
@@ -115,7 +320,35 @@ private:
     /*
      * sorting
      */
-    void countingSort();
+    void countingSort(int numberOfFrames);
+    void stableCellRanksGPU(int numberOfElements, int numberOfCells);
+    void describeNeighborhood(Neighborhood& neighborhood);
+
+    /*
+     * neighbor list
+     */
+    void neighborListPassGPU(int pass);
+
+    /*
+     * nearest neighbors
+     */
+    void nearestNeighborsGPU(GLuint* queryPointsSSBO, int numberOfQueries, int k, bool excludeSelf, NearestNeighbors& nearestNeighbors);
+    void nearestNeighborsCPU(const std::vector<glm::vec3>& rPositions, const glm::vec3* pQueryPoints, int numberOfQueries, int k, bool excludeSelf, NearestNeighborsCPU& nearestNeighbors, int threadCount);
+    void nearestNeighborsOfPoint(const std::vector<glm::vec3>& rPositions, glm::vec3 query, int excludeIndex, int k, uint* pIndices, float* pDistances) const;
+
+    /*
+     * cpu backend
+     */
+    void allocateHostBuffers(uint numElements);
+    void insertElementsInGridCPU(const std::vector<glm::vec3>& rPositions, int threadCount);
+    void prefixSumCellsCPU(int threadCount);
+    void countingSortCPU(int threadCount);
+    template<typename F>
+    void parallelFor(int count, int threadCount, F function);
+    template<typename F>
+    void forEachSearchCell(glm::ivec3 cell, F function) const;
+    template<typename F>
+    void forEachHalfSearchCell(glm::ivec3 cell, F function) const;
 };
 
 
@@ -6,25 +6,75 @@
 #define OPENGL_FRAMEWORK_NEIGHBORHOODSEARCHDEFINES_H
 
 // project includes
+#include <cmath>
 #include <glm/glm.hpp>
 
 
 
 typedef unsigned int uint;
 
+/*
+ * Cell orders, the integer values are also used by the shaders
+ */
+#define CELL_ORDER_LINEAR 0     // (y * resZ + z) * resX + x
+#define CELL_ORDER_MORTON 1     // z-order curve, bits of x, y and z interleaved
+#define CELL_ORDER_HASHED 2     // spatial hash of the cell coordinates, see hashCell
+#define MORTON_MAX_RES    1024  // 10 bits per axis
+#define HASH_AUTO_RATIO   8     // automatic selection hashes if the dense grid has this many cells per hash slot
+#define TUNING_ELEMENTS_PER_CELL 4  // suggested resolutions aim for at least this many elements per cell
+#define KNN_MAX_K         32    // largest k of the GPU nearest neighbor query, also set in nearestNeighbors.comp
+
+/*
+ * Passes of the neighbor list shader
+ */
+#define NEIGHBOR_LIST_COUNT 0   // count the neighbors of every particle
+#define NEIGHBOR_LIST_FILL  1   // write the neighbors at the scanned offsets
+
+/*
+ * Stages of the stable cell rank shader, a radix sort of the particles by cell
+ */
+#define STABLE_RANK_INIT  0     // pair every cell with the original index
+#define STABLE_RANK_FLAGS 1     // flag the pairs whose current bit of the cell is zero
+#define STABLE_RANK_SPLIT 2     // move the flagged pairs in front of the others, keeping their order
+#define STABLE_RANK_WRITE 3     // rank of every particle inside its cell
+
+/*
+ * Search cells of the half stencil, see halfStencilMode. The values are also used by halfStencil.glsl
+ */
+#define HALF_STENCIL_SKIP     0 // the pair is found from the other cell
+#define HALF_STENCIL_ALL      1 // every particle of the search cell forms a pair
+#define HALF_STENCIL_OWN_CELL 2 // the own cell, only particles with a larger original index form a pair
+
 struct GPUBuffers {
     // particle and grid buffers
-    GLuint* dp_pos;         // float4   - particle position
+    GLuint* dp_pos;         // float4   - particle position, provided by the caller
+    GLuint* dp_sortedPos;   // float4   - particle position after sorting
     GLuint* dp_gcell;       // uint     - cell idx the particle is in
     GLuint* dp_gndx;        // uint     - insertion idx of the particle inside the cell
     GLuint* dp_grid;        // uint     - idx of the particle after sorting
     GLuint* dp_gridcnt;     // int      - number of particles per cell
     GLuint* dp_gridoff;     // int      - offset of every cell
     GLuint* dp_undx;        // uint     - get unsorted index from sorted index
+    GLuint* dp_gridadj;     // int      - offsets of the search cells
     // temporary buffers
     GLuint* dp_tempPos;     // float4   - temporary particle position
     GLuint* dp_tempGcell;   // uint     - temporary cell idx
     GLuint* dp_tempGndx;    // uint     - temporary insertion idx
+    // verlet skin
+    GLuint* dp_refPos;      // float4   - particle position at the last build
+    GLuint* dp_displacement;// uint     - bits of the maximal squared displacement since the last build
+    // neighbor list
+    GLuint* dp_neighborCnt; // int      - number of neighbors per particle
+    GLuint* dp_neighborOff; // int      - offset of the neighbors of every particle
+    GLuint* dp_neighbors;   // uint     - original indices of all neighbors
+    // nearest neighbors
+    GLuint* dp_knnIndices;  // uint     - original indices of the k nearest neighbors per query
+    GLuint* dp_knnDistances;// float    - distances of the k nearest neighbors per query
+    // deterministic order
+    GLuint* dp_rankPairs;   // uint2    - cell and original index during the stable sort
+    GLuint* dp_rankPairsTemp;// uint2   - target of every split
+    GLuint* dp_rankFlags;   // int      - 1 if the current bit of the cell is zero
+    GLuint* dp_rankOff;     // int      - scanned flags, the last offset is the number of zeros
 };
 
 /*
@@ -38,6 +88,7 @@ struct GPUBuffers {
  *      for (int searchCellIndex = 0; searchCellIndex < numberOfSearchCells; searchCellIndex++)
  *      {
  *          uint currentCell = startCell + searchCellOffsets[cellIdx];
+ *          if (currentCell >= numberOfGridCells) continue; // stencil reaches over the grid border
  *          ... (steps 4 to 6)
  *      }
  * 4. get the start position of the current cell within the grid data structure with
@@ -50,6 +101,22 @@ struct GPUBuffers {
  *          uint j = grid[cellIndex];
  *          ... (compare particles i and j)
  *      }
+ *    With CELL_ORDER_MORTON or a periodic axis the search cells cannot be reached by
+ *    constant offsets. Decode the cell instead and visit the search cells around it
+ *      glm::ivec3 c = decodeCell(cell, gridResolution, cellOrder);
+ *      for every d in [searchCellMin, searchCellMax]
+ *          glm::ivec3 s = c + d, wrapped on periodic axes, skipped if outside on open axes
+ *          uint currentCell = encodeCell(s, gridResolution, cellOrder, numberOfGridCells);
+ *    Distances on periodic axes have to follow the minimum image convention, see
+ *    minimumImage below
+ *    With pairwiseCutoff particles i and j are neighbors if their distance is below
+ *    elementRadii[i] + elementRadii[j] + 2 probeRadius, searchRadius is the largest cutoff
+ *    With CELL_ORDER_HASHED the cells are slots of a hash table and cannot be decoded.
+ *    The cell coordinates are computed from the position with cellOfPosition, and
+ *    search cells outside the grid bounds are visited as well. Different cells may
+ *    share a slot, so particles j of a slot belong to the search cell only if
+ *    cellOfPosition of j equals it. With a skin the structure is kept while particles
+ *    move, the cells then have to be computed from the positions of the last build
  * 7. if you want to access your data you have to be careful, since the particles within
  *    the grid structure are sorted by the grid cell index they are in. To get the index
  *    you were using just use:
@@ -62,8 +129,10 @@ struct Neighborhood {
     GLuint* dp_particleCell;            // uint     cell index the particle is in
     GLuint* dp_particleCellIndex;       // uint     insertion index of the particle inside the cell
     GLuint* dp_grid;                    // uint     index of the particle after sorting
+    GLuint* dp_sortedPositions;         // float4   positions of the last build after sorting
     GLuint* dp_gridCellCounts;          // int      number of particles that are in the respective cell
     GLuint* dp_gridCellOffsets;         // int      total offset of the starting point of the respective cell
+    GLuint* dp_searchCellOffsets;       // int      same as p_searchCellOffsets for shaders, any length
     // CPU
     int*     p_searchCellOffsets;       // int[]    stores the offsets for all cells that have to be searched
     int        startCellOffset;         // int      since  the particle is always in the center of the search cells
@@ -71,6 +140,117 @@ struct Neighborhood {
                                         //          search cells
     int        numberOfSearchCells;     // int      number of cells within the search radius
     float      searchRadius;            // float    adjusted search radius
+    float      coveredSearchRadius;     // float    radius that is guaranteed to be covered by the search cells
+    int        cellOrder;               // int      CELL_ORDER_LINEAR, CELL_ORDER_MORTON or CELL_ORDER_HASHED
+    glm::ivec3 gridResolution;          // ivec3    number of cells per axis
+    int        numberOfGridCells;       // int      number of valid entries in the cell arrays, buffers may be larger
+    glm::ivec3 searchCellMin;           // ivec3    lowest search cell relative to the particle cell per axis
+    glm::ivec3 searchCellMax;           // ivec3    highest search cell relative to the particle cell per axis
+    glm::vec3  periodicBox;             // vec3     box length of periodic axes, zero for open axes
+    glm::vec3  gridMin;                 // vec3     origin of the cell with coordinates zero
+    glm::vec3  gridDelta;               // vec3     translates from world space to cell space
+    GLuint*    dp_elementRadii;         // float    radius of every particle by original index, 0x0 without pairwise cutoffs
+    int        pairwiseCutoff;          // int      1 if pairs are tested against r_i + r_j + 2 probeRadius
+    float      probeRadius;             // float    probe radius of the pairwise cutoffs
+};
+
+/*
+ * Grids of a block of frames built at once. The neighborhood buffers hold all
+ * frames one after another, everything else describes a single frame:
+ *      cells of frame f        f * cellsPerFrame ... (f+1) * cellsPerFrame - 1
+ *      particles of frame f    f * elementsPerFrame ... (f+1) * elementsPerFrame - 1
+ * Particle cells and original indices refer to the whole block, so particle i of
+ * frame f has the original index f * elementsPerFrame + i and its search cells
+ * are found by adding f * cellsPerFrame to the cell offsets.
+ */
+struct NeighborhoodBatch {
+    Neighborhood neighborhood;          // buffers of the whole block, grid description of a single frame
+    int          numberOfFrames;        // int      frames in the block
+    int          elementsPerFrame;      // int      particles per frame
+    int          cellsPerFrame;         // int      cells per frame, equal to neighborhood.numberOfGridCells
+};
+
+/*
+ * Host-side counterpart of the neighborhood, filled by the CPU backend.
+ * The arrays have exactly the same semantics as the GPU buffers above, so
+ * the usage described there applies one to one. They are owned by the
+ * NeighborhoodSearch object and stay valid until its next run or update.
+ */
+struct NeighborhoodCPU {
+    uint*   p_particleOriginalIndex;    // uint     particles original index before the counting sort
+    uint*   p_particleCell;             // uint     cell index the particle is in
+    uint*   p_particleCellIndex;        // uint     insertion index of the particle inside the cell
+    uint*   p_grid;                     // uint     index of the particle after sorting
+    int*    p_gridCellCounts;           // int      number of particles that are in the respective cell
+    int*    p_gridCellOffsets;          // int      total offset of the starting point of the respective cell
+    int*    p_searchCellOffsets;        // int[]    stores the offsets for all cells that have to be searched
+    int     startCellOffset;            // int      offset of the cell with the lowest index within the search cells
+    int     numberOfSearchCells;        // int      number of cells within the search radius
+    float   searchRadius;               // float    adjusted search radius
+    float   coveredSearchRadius;        // float    radius that is guaranteed to be covered by the search cells
+    int     cellOrder;                  // int      CELL_ORDER_LINEAR, CELL_ORDER_MORTON or CELL_ORDER_HASHED
+    glm::ivec3 gridResolution;          // ivec3    number of cells per axis
+    int        numberOfGridCells;       // int      number of valid entries in the cell arrays, buffers may be larger
+    glm::ivec3 searchCellMin;           // ivec3    lowest search cell relative to the particle cell per axis
+    glm::ivec3 searchCellMax;           // ivec3    highest search cell relative to the particle cell per axis
+    glm::vec3  periodicBox;             // vec3     box length of periodic axes, zero for open axes
+    glm::vec3  gridMin;                 // vec3     origin of the cell with coordinates zero
+    glm::vec3  gridDelta;               // vec3     translates from world space to cell space
+    const float* p_elementRadii;        // float    radius of every particle by original index, 0x0 without pairwise cutoffs
+    int        pairwiseCutoff;          // int      1 if pairs are tested against r_i + r_j + 2 probeRadius
+    float      probeRadius;             // float    probe radius of the pairwise cutoffs
+};
+
+/*
+ * Compact neighbor list (CSR) of all particles, indexed by original index.
+ * The neighbors of particle i are
+ *      for (int k = neighborOffsets[i]; k < neighborOffsets[i+1]; k++)
+ *      {
+ *          uint j = neighborIndices[k]; // original index
+ *      }
+ * Every pair closer than the search radius, or the pairwise cutoff if element
+ * radii are set, is stored in both directions, the particle itself is not. Particles outside the grid have no neighbors.
+ * With the half stencil every pair is stored once, at the particle whose search found it.
+ */
+struct NeighborList {
+    GLuint* dp_neighborOffsets;         // int      numberOfElements+1 offsets into the neighbor indices
+    GLuint* dp_neighborIndices;         // uint     original indices of the neighbors
+    int     numberOfNeighbors;          // int      number of valid entries in the neighbor indices
+    bool    halfStencil;                // bool     every pair is listed once, at only one of its particles
+};
+struct NeighborListCPU {
+    int*    p_neighborOffsets;          // int      numberOfElements+1 offsets into the neighbor indices
+    uint*   p_neighborIndices;          // uint     original indices of the neighbors
+    int     numberOfNeighbors;          // int      number of valid entries in the neighbor indices
+    bool    halfStencil;                // bool     every pair is listed once, at only one of its particles
+};
+
+/*
+ * k nearest neighbors of every query, stored query after query. The neighbors
+ * of query q are at q*k to q*k+k-1, nearest first and original indices. Queries
+ * with less than k particles in reach are filled up with GRID_UNDEF
+ */
+struct NearestNeighbors {
+    GLuint* dp_neighborIndices;         // uint     original indices of the neighbors
+    GLuint* dp_neighborDistances;       // float    distances of the neighbors
+    int     k;                          // int      neighbors per query
+    int     numberOfQueries;            // int      number of queries
+};
+struct NearestNeighborsCPU {
+    uint*   p_neighborIndices;          // uint     original indices of the neighbors
+    float*  p_neighborDistances;        // float    distances of the neighbors
+    int     k;                          // int      neighbors per query
+    int     numberOfQueries;            // int      number of queries
+};
+
+/*
+ * Average durations of the build stages in ms
+ */
+struct StageTimings {
+    double insert;      // insertion of the elements into the cells
+    double scan;        // prefix sum over the cell counts
+    double sort;        // counting sort
+    double total;       // all stages of a build
 };
 
 struct Grid {
@@ -80,6 +260,116 @@ struct Grid {
 };
 
 
+/*
+ * Morton code helpers, spread the lower 10 bits of a value to every third bit
+ * and back
+ */
+inline uint mortonSpreadBits(uint v)
+{
+    v &= 0x000003ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v <<  8)) & 0x0300f00f;
+    v = (v | (v <<  4)) & 0x030c30c3;
+    v = (v | (v <<  2)) & 0x09249249;
+    return v;
+}
+inline uint mortonCompactBits(uint v)
+{
+    v &= 0x09249249;
+    v = (v | (v >>  2)) & 0x030c30c3;
+    v = (v | (v >>  4)) & 0x0300f00f;
+    v = (v | (v >>  8)) & 0x030000ff;
+    v = (v | (v >> 16)) & 0x000003ff;
+    return v;
+}
+inline uint mortonEncode(glm::ivec3 cell)
+{
+    return mortonSpreadBits((uint)cell.x) | (mortonSpreadBits((uint)cell.y) << 1) | (mortonSpreadBits((uint)cell.z) << 2);
+}
+inline glm::ivec3 mortonDecode(uint code)
+{
+    return glm::ivec3(mortonCompactBits(code), mortonCompactBits(code >> 1), mortonCompactBits(code >> 2));
+}
+
+
+/*
+ * Hash table slot of integer cell coordinates, the number of slots is a power of two
+ */
+inline uint hashCell(glm::ivec3 cell, int numberOfSlots)
+{
+    return (((uint)cell.x * 73856093u) ^ ((uint)cell.y * 19349663u) ^ ((uint)cell.z * 83492791u)) & (uint)(numberOfSlots - 1);
+}
+
+
+/*
+ * Cell index of integer cell coordinates and back, hashed cells cannot be decoded
+ */
+inline uint encodeCell(glm::ivec3 cell, glm::ivec3 resolution, int cellOrder, int numberOfGridCells)
+{
+    if (cellOrder == CELL_ORDER_HASHED) return hashCell(cell, numberOfGridCells);
+    if (cellOrder == CELL_ORDER_MORTON) return mortonEncode(cell);
+    return (uint)((cell.y * resolution.z + cell.z) * resolution.x + cell.x);
+}
+inline glm::ivec3 decodeCell(uint cell, glm::ivec3 resolution, int cellOrder)
+{
+    if (cellOrder == CELL_ORDER_MORTON) return mortonDecode(cell);
+    int x = (int)cell % resolution.x;
+    int z = ((int)cell / resolution.x) % resolution.z;
+    int y = (int)cell / (resolution.x * resolution.z);
+    return glm::ivec3(x, y, z);
+}
+
+/*
+ * Integer coordinates of the cell containing the position, wrapped on periodic axes
+ */
+inline glm::ivec3 cellOfPosition(glm::vec3 position, glm::vec3 gridMin, glm::vec3 gridDelta, glm::ivec3 resolution, glm::vec3 periodicBox)
+{
+    glm::ivec3 cell = glm::ivec3(glm::floor((position - gridMin) * gridDelta));
+    for (int a = 0; a < 3; a++) {
+        if (periodicBox[a] > 0.f) cell[a] = ((cell[a] % resolution[a]) + resolution[a]) % resolution[a];
+    }
+    return cell;
+}
+
+/*
+ * Shortest connection between two particles on periodic axes
+ */
+inline glm::vec3 minimumImage(glm::vec3 distance, glm::vec3 periodicBox)
+{
+    for (int a = 0; a < 3; a++) {
+        if (periodicBox[a] > 0.f) {
+            distance[a] -= periodicBox[a] * std::round(distance[a] / periodicBox[a]);
+        }
+    }
+    return distance;
+}
+
+/*
+ * Half stencil. Of the offsets o and -o between two cells only one is searched,
+ * so every unordered pair of particles is visited once. On periodic axes -o is
+ * wrapped into the search range, an offset equal to its own negation visits the
+ * cell pair only from the cell with smaller coordinates. Offsets and cells are
+ * compared lexicographically, the cell coordinates are wrapped
+ */
+inline int halfStencilMode(glm::ivec3 offset, glm::ivec3 cell, glm::ivec3 searchCell,
+                           glm::ivec3 searchCellMin, glm::ivec3 searchCellMax, glm::ivec3 resolution, glm::vec3 periodicBox)
+{
+    glm::ivec3 negatedOffset = -offset;
+    for (int a = 0; a < 3; a++) {
+        if (periodicBox[a] <= 0.f) continue;
+        if (negatedOffset[a] > searchCellMax[a]) negatedOffset[a] -= resolution[a];
+        if (negatedOffset[a] < searchCellMin[a]) negatedOffset[a] += resolution[a];
+    }
+    for (int a = 0; a < 3; a++) {
+        if (offset[a] != negatedOffset[a]) return (offset[a] > negatedOffset[a]) ? HALF_STENCIL_ALL : HALF_STENCIL_SKIP;
+    }
+    if (offset == glm::ivec3(0)) return HALF_STENCIL_OWN_CELL;
+    for (int a = 0; a < 3; a++) {
+        if (searchCell[a] != cell[a]) return (searchCell[a] > cell[a]) ? HALF_STENCIL_ALL : HALF_STENCIL_SKIP;
+    }
+    return HALF_STENCIL_SKIP;
+}
+
 #define GRID_UNDEF 4294967295
 #define BLOCK_SIZE 256
 #define NUM_BANKS  16    // if changed here, it also must be changed in prescanInt.comp
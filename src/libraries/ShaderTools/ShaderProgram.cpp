@@ -441,6 +441,19 @@ string ShaderProgram::loadShaderSource(string filename) {
     if(fileIn.is_open()){
         while(!fileIn.eof()){
             getline(fileIn, line);
+
+            // #include "file" is replaced by the file, relative to the including one
+            size_t directive = line.find_first_not_of(" \t");
+            if (directive != string::npos && line.compare(directive, 8, "#include") == 0) {
+                size_t first = line.find('"', directive);
+                size_t last = line.find('"', first + 1);
+                if (first != string::npos && last != string::npos) {
+                    string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+                    shaderSrc += loadShaderSource(directory + line.substr(first + 1, last - first - 1));
+                    continue;
+                }
+            }
+
             line += "\n";
             shaderSrc += line;
         }
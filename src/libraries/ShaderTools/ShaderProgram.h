@@ -304,7 +304,8 @@ protected:
 	virtual void attachShader(std::string filename);
 	void attachShader(GLenum shaderType, std::string filename);
 	/**
-	 * @brief Loads a shader source code file from disk
+	 * @brief Loads a shader source code file from disk, lines with
+	 *        #include "file" are replaced by that file
 	 * 
 	 * @param filename Filepath to the shader code file
 	 * @return A sring containing the shader code
@@ -45,6 +45,53 @@ public:
         glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
     }
 
+    // Fill with size elements, read from memory owned by someone else
+    void fill(const T* pData, int size, GLenum access)
+    {
+        mSize = size;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(T) * mSize, mSize > 0 ? pData : 0, access);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Allocate size elements without initializing them
+    void allocate(int size, GLenum access)
+    {
+        mSize = size;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(T) * mSize, NULL, access);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Overwrite count elements beginning at offset
+    void update(int offset, const T* pData, int count)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(T) * offset, sizeof(T) * count, pData);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Move count elements from source to target offset within buffer. Overlapping ranges are copied in chunks of
+    // their distance, beginning at the end the chunks move away from
+    void move(int source, int target, int count)
+    {
+        int distance = glm::abs(target - source);
+        if(distance == 0 || count <= 0)
+        {
+            return;
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, mBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+        for(int i = 0; i < count; i += distance)
+        {
+            int chunk = glm::min(distance, count - i);
+            int offset = (target < source) ? i : count - i - chunk;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sizeof(T) * (source + offset), sizeof(T) * (target + offset), sizeof(T) * chunk);
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
     // Bind
     void bind(GLuint slot) const
     {
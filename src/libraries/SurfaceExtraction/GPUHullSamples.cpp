@@ -39,7 +39,138 @@ void GPUHullSamples::compute(
     mStartFrame = startFrame;
     mAtomCount = mpGPUProtein->getAtomCount();
     mLocalFrameCount = pGPUSurfaces->size(); // not over complete animation but calculated surfaces!
-    mSampleCount = sampleCountPerAtom;
+    mAdaptive = false;
+
+    // Each atom gets the same count of samples
+    classify(
+        pGPUSurfaces,
+        std::vector<GLuint>(mAtomCount, (GLuint)sampleCountPerAtom),
+        probeRadius,
+        sampleSeed,
+        progressCallback);
+}
+
+void GPUHullSamples::computeAdaptive(
+    GPUProtein const * pGPUProtein,
+    std::vector<std::unique_ptr<GPUSurface> > const * pGPUSurfaces,
+    int startFrame,
+    float probeRadius,
+    int sampleBudget,
+    int pilotSampleCountPerAtom,
+    int maxSampleCountPerAtom,
+    unsigned int sampleSeed,
+    std::function<void(float)> progressCallback)
+{
+    // Fill members
+    mpGPUProtein = pGPUProtein;
+    mStartFrame = startFrame;
+    mAtomCount = mpGPUProtein->getAtomCount();
+    mLocalFrameCount = pGPUSurfaces->size(); // not over complete animation but calculated surfaces!
+
+    // Pilot count may not exceed what the budget allows for each atom
+    int pilotCount = glm::min(pilotSampleCountPerAtom, mAtomCount > 0 ? sampleBudget / mAtomCount : 0);
+    pilotCount = glm::max(pilotCount, 1);
+    maxSampleCountPerAtom = glm::max(maxSampleCountPerAtom, pilotCount);
+
+    // ### PILOT RUN ###
+
+    // Classify pilot samples, first half of progress
+    classify(
+        pGPUSurfaces,
+        std::vector<GLuint>(mAtomCount, (GLuint)pilotCount),
+        probeRadius,
+        sampleSeed,
+        [&](float progress)
+        {
+            if(progressCallback != NULL) { progressCallback(0.5f * progress); }
+        });
+
+    // Atoms which are at surface in at least one frame. Other atoms have no exposed fraction at all
+    std::vector<bool> everSurface(mAtomCount, false);
+    for(const auto& rupGPUSurface : *pGPUSurfaces)
+    {
+        for(GLuint a : rupGPUSurface->getSurfaceIndices(0))
+        {
+            everSurface.at(a) = true;
+        }
+    }
+
+    // ### ESTIMATION OF DEVIATION ###
+
+    // Standard deviation of a single sample's classification, averaged over frames. The smoothed estimate
+    // keeps atoms whose pilot samples were all internal or all surface from being starved
+    std::vector<float> deviations(mAtomCount, 0.f);
+    float deviationSum = 0.f;
+    for(int a = 0; a < mAtomCount; a++)
+    {
+        if(!everSurface.at(a)) { continue; }
+        float deviation = 0.f;
+        for(int i = 0; i < mLocalFrameCount; i++)
+        {
+            float p = ((float)getSurfaceSampleCount(i + mStartFrame, (GLuint)a) + 0.5f) / ((float)pilotCount + 1.f);
+            deviation += glm::sqrt(p * (1.f - p));
+        }
+        deviations.at(a) = deviation / (float)glm::max(mLocalFrameCount, 1);
+        deviationSum += deviations.at(a);
+    }
+
+    // ### ALLOCATION OF BUDGET ###
+
+    // Every atom keeps the pilot count, the remaining budget is distributed proportional to deviation
+    std::vector<GLuint> sampleCounts(mAtomCount, (GLuint)pilotCount);
+    int remainingBudget = sampleBudget - (pilotCount * mAtomCount);
+    std::vector<bool> saturated(mAtomCount, false);
+    while(remainingBudget > 0 && deviationSum > 0.f)
+    {
+        // Distribute remaining budget over atoms which are not saturated
+        int distributed = 0;
+        float nextDeviationSum = 0.f;
+        for(int a = 0; a < mAtomCount; a++)
+        {
+            if(saturated.at(a) || deviations.at(a) <= 0.f) { continue; }
+            int share = (int)(((float)remainingBudget * deviations.at(a)) / deviationSum);
+            int count = glm::min((int)sampleCounts.at(a) + share, maxSampleCountPerAtom);
+            distributed += count - (int)sampleCounts.at(a);
+            sampleCounts.at(a) = (GLuint)count;
+            if(count == maxSampleCountPerAtom)
+            {
+                saturated.at(a) = true;
+            }
+            else
+            {
+                nextDeviationSum += deviations.at(a);
+            }
+        }
+
+        // Stop when nothing can be distributed anymore (only rounding leftovers)
+        remainingBudget -= distributed;
+        deviationSum = nextDeviationSum;
+        if(distributed == 0) { break; }
+    }
+
+    // ### FINAL RUN ###
+
+    // Classify with adaptive counts, second half of progress
+    classify(
+        pGPUSurfaces,
+        sampleCounts,
+        probeRadius,
+        sampleSeed,
+        [&](float progress)
+        {
+            if(progressCallback != NULL) { progressCallback(0.5f + 0.5f * progress); }
+        });
+    mAdaptive = true;
+}
+
+void GPUHullSamples::classify(
+    std::vector<std::unique_ptr<GPUSurface> > const * pGPUSurfaces,
+    const std::vector<GLuint>& rSampleCountsPerAtom,
+    float probeRadius,
+    unsigned int sampleSeed,
+    std::function<void(float)> progressCallback)
+{
+    // Fill members
     mIntegerCountPerSample = (int)glm::ceil((float)mLocalFrameCount / 32.f); // each unsigned int holds 32 bits
 
     // Initialize progress with zero
@@ -48,13 +179,40 @@ void GPUHullSamples::compute(
         progressCallback(0);
     }
 
+    // ### SAMPLE OFFSETS ###
+
+    // Prefix sum over sample counts of atoms, maximum is used for drawing
+    mSampleOffsets.clear();
+    mSampleOffsets.reserve(mAtomCount + 1);
+    mSampleOffsets.push_back(0);
+    mSampleCount = 0;
+    for(GLuint count : rSampleCountsPerAtom)
+    {
+        mSampleOffsets.push_back(mSampleOffsets.back() + count);
+        mSampleCount = glm::max(mSampleCount, (int)count);
+    }
+    int sampleCount = (int)mSampleOffsets.back();
+    bool uniformSampling = (sampleCount == mSampleCount * mAtomCount);
+
+    // Map each sample to its atom for drawing
+    std::vector<GLuint> sampleAtomIndices;
+    sampleAtomIndices.reserve(sampleCount);
+    for(int i = 0; i < mAtomCount; i++)
+    {
+        sampleAtomIndices.insert(sampleAtomIndices.end(), rSampleCountsPerAtom.at(i), (GLuint)i);
+    }
+
+    // Copy offsets and mapping to GPU
+    mSampleOffsetsBuffer.fill(mSampleOffsets, GL_STATIC_DRAW);
+    mSampleAtomIndicesBuffer.fill(sampleAtomIndices, GL_STATIC_DRAW);
+
     // ### RELATIVE POSITIONS ###
 
     // Create vector with relative positions
     // This is unchanged during all frames since the position
     // is saved relative to atom's center
     mSamplesRelativePosition.clear();
-    mSamplesRelativePosition.reserve(mAtomCount * mSampleCount);
+    mSamplesRelativePosition.reserve(sampleCount);
     std::srand(sampleSeed); // initialize random generator with seed
 
     // Go over atoms and generate relative position
@@ -62,7 +220,7 @@ void GPUHullSamples::compute(
     {
         // Create as many samples as desired
         float atomExtRadius = mpGPUProtein->getRadii()->at(i) + probeRadius;
-        for(int j = 0; j < mSampleCount; j++)
+        for(int j = 0; j < (int)rSampleCountsPerAtom.at(i); j++)
         {
             // Generate samples (http://mathworld.wolfram.com/SpherePointPicking.html)
             float u = (float)((double)std::rand() / (double)RAND_MAX);
@@ -87,7 +245,7 @@ void GPUHullSamples::compute(
     // ### SURFACE CLASSIFICATION ###
 
     // Decide how many unsigned integers are necessary to hold surface information on all frames for one sample of one atom
-    int globalIntergerCount = mIntegerCountPerSample * mAtomCount * mSampleCount; // frames are in integerCountPerSample
+    int globalIntergerCount = mIntegerCountPerSample * sampleCount; // frames are in integerCountPerSample
 
     // Initialize classification with zeros
     mupClassification = std::unique_ptr<GPUTextureBuffer>(new GPUTextureBuffer(std::vector<GLuint>(globalIntergerCount, 0)));
@@ -99,33 +257,52 @@ void GPUHullSamples::compute(
     // For each GPUSurface take surface atoms and calculate for their samples whether they are at surface or not
     mupComputeProgram->use();
     mupComputeProgram->update("atomCount", mAtomCount);
-    mupComputeProgram->update("sampleCount", mSampleCount);
+    mupComputeProgram->update("sampleCount", uniformSampling ? mSampleCount : 0);
     mupComputeProgram->update("integerCountPerSample", mIntegerCountPerSample);
     mupComputeProgram->update("probeRadius", probeRadius);
     mpGPUProtein->bind(1, 2); // bind radii and trajectory buffers
     mSamplesRelativePositionBuffer.bind(3); // bind relative position of samples
     mupClassification->bindAsImage(4, GPUAccess::READ_WRITE);
     surfaceSampleCounter.bind(5);
+    mSampleOffsetsBuffer.bind(6); // bind offsets of atoms' samples
     for(int i = 0; i < pGPUSurfaces->size(); i++)
     {
         // Reset counter of surface samples
         surfaceSampleCounter.reset();
 
         // Update values
-        mupComputeProgram->update("frame", i + mStartFrame); // frame in global terms
+        mupComputeProgram->update("frame", mpGPUProtein->makeResident(i + mStartFrame)); // frame in global terms, within trajectory SSBO
         mupComputeProgram->update("localFrame", i);
         mupComputeProgram->update("inputAtomCount", pGPUSurfaces->at(i)->getCountOfSurfaceAtoms(0)); // count of input atoms
 
+        // Count of invocations, which is the count of samples of all surface atoms
+        int invocationCount = pGPUSurfaces->at(i)->getCountOfSurfaceAtoms(0) * mSampleCount;
+        if(!uniformSampling)
+        {
+            // Prefix sum over sample counts of surface atoms, so invocations map to samples without surplus
+            std::vector<GLuint> surfaceSampleOffsets(1, 0);
+            for(GLuint a : pGPUSurfaces->at(i)->getSurfaceIndices(0))
+            {
+                surfaceSampleOffsets.push_back(surfaceSampleOffsets.back() + rSampleCountsPerAtom.at(a));
+            }
+            mSurfaceSampleOffsetsBuffer.fill(surfaceSampleOffsets, GL_DYNAMIC_DRAW);
+            mSurfaceSampleOffsetsBuffer.bind(7); // bind offsets of surface atoms' samples
+            invocationCount = (int)surfaceSampleOffsets.back();
+        }
+
         // Bind surface indices buffer of that frame
         pGPUSurfaces->at(i)->bindSurfaceIndices(0, 0); // bind indices of surface atoms at that frame
 
-        // Dispatch
-        glDispatchCompute(
-            ((pGPUSurfaces->at(i)->getCountOfSurfaceAtoms(0) * mSampleCount) / 64) + 1,
-            1,
-            1);
-        glMemoryBarrier(GL_ALL_BARRIER_BITS);
-        glFinish(); // memory barrier does not do the job
+        // Dispatch, unless there is no sample to classify
+        if(invocationCount > 0)
+        {
+            glDispatchCompute(
+                (invocationCount / 64) + 1,
+                1,
+                1);
+            glMemoryBarrier(GL_ALL_BARRIER_BITS);
+            glFinish(); // memory barrier does not do the job
+        }
 
         // Push back count of surface atoms
         mSurfaceSampleCount.push_back(surfaceSampleCounter.read());
@@ -140,6 +317,26 @@ void GPUHullSamples::compute(
     // Read image with classification back to member
     mClassification = mupClassification->read(mupClassification->getSize());
 
+    // Average exposed fraction of atoms per frame, which is the ratio of surface samples for uniform sampling
+    mSurfaceAmount = std::vector<float>(mLocalFrameCount, 0.f);
+    for(int i = 0; i < mLocalFrameCount && uniformSampling; i++)
+    {
+        mSurfaceAmount.at(i) = sampleCount > 0 ? (float)mSurfaceSampleCount.at(i) / (float)sampleCount : 0.f;
+    }
+    for(int i = 0; i < mLocalFrameCount && !uniformSampling; i++)
+    {
+        float amount = 0.f;
+        for(int a = 0; a < mAtomCount; a++)
+        {
+            int count = getSampleCountOfAtom((GLuint)a);
+            if(count > 0)
+            {
+                amount += (float)getSurfaceSampleCount(i + mStartFrame, (GLuint)a) / (float)count;
+            }
+        }
+        mSurfaceAmount.at(i) = mAtomCount > 0 ? amount / (float)mAtomCount : 0.f;
+    }
+
     // Finih progress
     if(progressCallback != NULL)
     {
@@ -168,13 +365,13 @@ void GPUHullSamples::drawSamples(
         mpGPUProtein->bind(0, 1);
         mSamplesRelativePositionBuffer.bind(2);
         mupClassification->bindAsImage(3, GPUAccess::READ_ONLY);
+        mSampleAtomIndicesBuffer.bind(4);
 
         // Update uniform values
         mupShaderProgram->update("view", rViewMatrix);
         mupShaderProgram->update("projection", rProjectionMatrix);
         mupShaderProgram->update("clippingPlane", clippingPlane);
-        mupShaderProgram->update("sampleCount", mSampleCount);
-        mupShaderProgram->update("frame", frame),
+        mupShaderProgram->update("frame", mpGPUProtein->makeResident(frame)),
         mupShaderProgram->update("atomCount", mAtomCount);
         mupShaderProgram->update("integerCountPerSample", mIntegerCountPerSample);
         mupShaderProgram->update("localFrame", frame - mStartFrame);
@@ -183,7 +380,7 @@ void GPUHullSamples::drawSamples(
 
         // Bind vertex array object and draw samples
         glBindVertexArray(mVAO);
-        glDrawArrays(GL_POINTS, 0, mAtomCount * mSampleCount);
+        glDrawArrays(GL_POINTS, 0, getProteinSampleCount());
 
         // Unbind vertex array object
         glBindVertexArray(0);
@@ -192,32 +389,13 @@ void GPUHullSamples::drawSamples(
 
 int GPUHullSamples::getSurfaceSampleCount(int frame, std::set<GLuint> atomIndices) const
 {
-    // Calculate local frame
-    int localFrame = frame - mStartFrame;
-
     // Result
     int surfaceSampleCount = 0;
 
     // Go over atoms where count of surface samples should be got
     for(GLuint a : atomIndices)
     {
-        // Go over samples of that atom
-        for(int j = 0; j < mSampleCount; j++)
-        {
-            // Calculate indices to look up classification
-            int uintIndex =
-                (a * mSampleCount * mIntegerCountPerSample) // offset for current atom's samples
-                + (j *  mIntegerCountPerSample) // offset for current sample's slot
-                + (localFrame / 32); // offset for unsigned int which has to be read
-            int bitIndex = localFrame - (32 * int(localFrame / 32)); // bit index within unsigned integer
-
-            // Fetch classification
-            if(((mClassification.at(uintIndex) >> bitIndex) & 1) > 0)
-            {
-                // Increment count of found surface samples
-                surfaceSampleCount++;
-            }
-        }
+        surfaceSampleCount += getSurfaceSampleCount(frame, a);
     }
 
     return surfaceSampleCount;
@@ -225,10 +403,33 @@ int GPUHullSamples::getSurfaceSampleCount(int frame, std::set<GLuint> atomIndice
 
 int GPUHullSamples::getSurfaceSampleCount(int frame, GLuint atomIndex) const
 {
-    // Delegate to other method
-    std::set<GLuint> atomSet;
-    atomSet.insert(atomIndex);
-    return getSurfaceSampleCount(frame, atomSet);
+    // Calculate local frame
+    int localFrame = frame - mStartFrame;
+
+    // Result
+    int surfaceSampleCount = 0;
+
+    // Go over samples of that atom
+    int sampleOffset = (int)mSampleOffsets.at(atomIndex);
+    int sampleCount = getSampleCountOfAtom(atomIndex);
+    for(int j = 0; j < sampleCount; j++)
+    {
+        // Calculate indices to look up classification
+        int uintIndex =
+            (sampleOffset * mIntegerCountPerSample) // offset for current atom's samples
+            + (j *  mIntegerCountPerSample) // offset for current sample's slot
+            + (localFrame / 32); // offset for unsigned int which has to be read
+        int bitIndex = localFrame - (32 * int(localFrame / 32)); // bit index within unsigned integer
+
+        // Fetch classification
+        if(((mClassification.at(uintIndex) >> bitIndex) & 1) > 0)
+        {
+            // Increment count of found surface samples
+            surfaceSampleCount++;
+        }
+    }
+
+    return surfaceSampleCount;
 }
 
 int GPUHullSamples::getSurfaceSampleCount(int frame) const
@@ -240,3 +441,18 @@ int GPUHullSamples::getSampleCount(int atomCount) const
 {
     return mSampleCount * atomCount;
 }
+
+int GPUHullSamples::getSampleCountOfAtom(GLuint atomIndex) const
+{
+    return (int)(mSampleOffsets.at(atomIndex + 1) - mSampleOffsets.at(atomIndex));
+}
+
+int GPUHullSamples::getSampleCount(std::set<GLuint> atomIndices) const
+{
+    int sampleCount = 0;
+    for(GLuint a : atomIndices)
+    {
+        sampleCount += getSampleCountOfAtom(a);
+    }
+    return sampleCount;
+}
@@ -41,6 +41,20 @@ public:
         unsigned int sampleSeed,
         std::function<void(float)> progressCallback = NULL);
 
+    // Adaptive computation. Spends a global budget of samples on the atoms whose
+    // exposed fraction has the highest variance, estimated by a pilot run with
+    // pilotSampleCountPerAtom samples per atom. End frame determined by count of surfaces
+    void computeAdaptive(
+        GPUProtein const * pGPUProtein,
+        std::vector<std::unique_ptr<GPUSurface> > const * pGPUSurfaces,
+        int startFrame,
+        float probeRadius,
+        int sampleBudget, // count of samples over all atoms
+        int pilotSampleCountPerAtom,
+        int maxSampleCountPerAtom,
+        unsigned int sampleSeed,
+        std::function<void(float)> progressCallback = NULL);
+
     // Draw the computed samples
     void drawSamples(
         int frame, // absolute frame
@@ -52,7 +66,7 @@ public:
         float clippingPlane) const;
 
     // Get count of samples in one frame (will stay same for all frames)
-    int getProteinSampleCount() const { return mAtomCount * mSampleCount; }
+    int getProteinSampleCount() const { return mSampleOffsets.empty() ? 0 : (int)mSampleOffsets.back(); }
 
     // Get count of all surface samples over all processed frames
     std::vector<GLuint> getSurfaceSampleCount() const { return mSurfaceSampleCount; }
@@ -66,11 +80,31 @@ public:
     // Get count of surface samples in one specific frame
     int getSurfaceSampleCount(int frame) const;
 
-    // Get count of samples for a given count of atoms
+    // Get count of samples for a given count of atoms (only meaningful for uniform sampling)
     int getSampleCount(int atomCount = 1) const;
 
+    // Get count of samples of one atom
+    int getSampleCountOfAtom(GLuint atomIndex) const;
+
+    // Get count of samples of a certain atom group
+    int getSampleCount(std::set<GLuint> atomIndices) const;
+
+    // Get amount of surface over all processed frames, averaged over atoms' exposed fractions [0,1]
+    std::vector<float> getSurfaceAmount() const { return mSurfaceAmount; }
+
+    // Get whether samples were distributed adaptively
+    bool isAdaptive() const { return mAdaptive; }
+
 private:
 
+    // Generate samples for given count per atom and classify them for all surfaces
+    void classify(
+        std::vector<std::unique_ptr<GPUSurface> > const * pGPUSurfaces,
+        const std::vector<GLuint>& rSampleCountsPerAtom,
+        float probeRadius,
+        unsigned int sampleSeed,
+        std::function<void(float)> progressCallback);
+
     // Remember start frame of computation
     int mStartFrame;
 
@@ -80,9 +114,24 @@ private:
     // Count of frames (defined by count of given calculated surfaces)
     int mLocalFrameCount;
 
-    // Count of samples
+    // Count of samples (maximum count of samples per atom when sampled adaptively)
     int mSampleCount;
 
+    // Offsets of atoms' samples, prefix sum of sample counts per atom (atom count plus one)
+    std::vector<GLuint> mSampleOffsets;
+
+    // SSBO with offsets of atoms' samples
+    GPUBuffer<GLuint> mSampleOffsetsBuffer;
+
+    // SSBO with index of atom for each sample (used for drawing)
+    GPUBuffer<GLuint> mSampleAtomIndicesBuffer;
+
+    // SSBO with prefix sum of sample counts of surface atoms in the classified frame (used for dispatching adaptive samples)
+    GPUBuffer<GLuint> mSurfaceSampleOffsetsBuffer;
+
+    // Whether samples were distributed adaptively
+    bool mAdaptive = false;
+
     // Count of unsigned integers necessary for each sample
     int mIntegerCountPerSample;
 
@@ -109,6 +158,9 @@ private:
     // Vector for count of surface samples
     std::vector<GLuint> mSurfaceSampleCount;
 
+    // Vector for amount of surface, averaged over atoms' exposed fractions
+    std::vector<float> mSurfaceAmount;
+
     // Copy of classification results
     std::vector<GLuint> mClassification;
 
@@ -5,31 +5,71 @@
 #include "GPUProtein.h"
 #include "Molecule/MDtrajLoader/Data/Protein.h"
 #include "Molecule/MDtrajLoader/Data/AtomLUT.h"
+#include "Molecule/MDtrajLoader/Trajectory/FrameProvider.h"
+#include "Utils/Logger.h"
 
 // TODO: Testing
 #include <iostream>
 
+// Budget of trajectory SSBO when frames are queried on demand
+const size_t residentTrajectoryBytes = 512 * 1024 * 1024;
+
 GPUProtein::GPUProtein(Protein * const pProtein)
 {
-    // Create structures for CPU
-    int atomCount  = pProtein->getAtoms()->size();
-    int frameCount = pProtein->getAtomAt(0)->getCountOfFrames(); // TODO: what if no atoms in protein?
-    mspRadii = std::shared_ptr<std::vector<float> >(new std::vector<float>);
-    mspRadii->reserve(atomCount);
+    // Positions are not copied but shared with protein
+    mspTrajectory = pProtein->getTrajectory();
+    int atomCount  = mspTrajectory->getNumberOfAtoms();
+    int frameCount = mspTrajectory->getNumberOfFrames();
+
+    // Reserve space in other vectors (which are all assumed to be empty)
+    mCentersOfMass.reserve(frameCount);
 
-    // Already size trajectory vector
-    mspTrajectory = std::shared_ptr<
-            std::vector<
-                std::vector<glm::vec3> > >(
-                    new std::vector<std::vector<glm::vec3> >);
-    mspTrajectory->resize(frameCount);
-    for(int i = 0; i < frameCount; i++)
+    // Fill radii, elements and aminoacids on CPU
+    initTopology(pProtein);
+
+    // Calculate centers of frames
+    for(int i = 0; i < frameCount; i++) // go over frames
     {
-        mspTrajectory->at(i).resize(atomCount);
+        const glm::vec3* pPositions = mspTrajectory->getFrame(i);
+        glm::vec3 accPosition(0, 0, 0);
+        for(int j = 0; j < atomCount; j++) // go over atoms
+        {
+            // Accumulate position
+            accPosition += pPositions[j];
+        }
+
+        // Save center
+        mCentersOfMass.push_back(accPosition / atomCount);
     }
 
+    // Init SSBOs
+    initSSBOs(atomCount, frameCount);
+}
+
+GPUProtein::GPUProtein(Protein * const pProtein, std::shared_ptr<FrameProvider> spFrames)
+{
+    // Frames are queried on demand, only the topology is taken from protein
+    mspFrames = spFrames;
+    initTopology(pProtein);
+
+    // Trajectory SSBO holds as many frames as fit into budget, for small trajectories that are all
+    int atomCount = getAtomCount();
+    int frameBudget = (int)(residentTrajectoryBytes / (sizeof(glm::vec3) * glm::max(atomCount, 1)));
+    mResidentCapacity = glm::clamp(frameBudget, 1, glm::max(getFrameCount(), 1));
+    mTrajectoryBuffer.allocate(mResidentCapacity * atomCount, GL_DYNAMIC_DRAW);
+
+    // Init SSBOs and upload first window of frames
+    initSSBOs(atomCount, 0);
+    makeResident(0);
+}
+
+void GPUProtein::initTopology(Protein * const pProtein)
+{
+    int atomCount = pProtein->getAtoms()->size();
+    mspRadii = std::shared_ptr<std::vector<float> >(new std::vector<float>);
+    mspRadii->reserve(atomCount);
+
     // Reserve space in other vectors (which are all assumed to be empty)
-    mCentersOfMass.reserve(frameCount);
     mElementNames.reserve(atomCount);
     mAminoAcidsNames.reserve(atomCount);
 
@@ -63,26 +103,6 @@ GPUProtein::GPUProtein(Protein * const pProtein)
         mMaxCoordinates.z = mMaxCoordinates.z < position.z ? position.z : mMaxCoordinates.z;
     }
 
-    // Fill trajectory on CPU
-    for(int i = 0; i < frameCount; i++) // go over frames
-    {
-        glm::vec3 accPosition(0, 0, 0);
-        for(int j = 0; j < atomCount; j++) // go over atoms
-        {
-            // Position of that atom in that frame
-            glm::vec3 position = pProtein->getAtoms()->at(j)->getPositionAtFrame(i);
-
-            // Collect trajectory (already correctly sized)
-            mspTrajectory->at(i).at(j) = position;
-
-            // Accumulate position
-            accPosition += position;
-        }
-
-        // Save center
-        mCentersOfMass.push_back(accPosition / atomCount);
-    }
-
     // Extract amino acids (here should be const pointers :( )
     std::vector<std::string>* pAminoAcids = pProtein->getAminoNames();
 
@@ -101,9 +121,6 @@ GPUProtein::GPUProtein(Protein * const pProtein)
 
         mAminoAcids.push_back(AminoAcid(name, minIndex, maxIndex));
     }
-
-    // Init SSBOs
-    initSSBOs(atomCount, frameCount);
 }
 
 GPUProtein::GPUProtein(const std::vector<glm::vec4>& rAtoms)
@@ -112,12 +129,7 @@ GPUProtein::GPUProtein(const std::vector<glm::vec4>& rAtoms)
     int atomCount  = rAtoms.size();
     mspRadii = std::shared_ptr<std::vector<float> >(new std::vector<float>);
     mspRadii->resize(atomCount);
-    mspTrajectory = std::shared_ptr<
-            std::vector<
-                std::vector<glm::vec3> > >(
-                    new std::vector<std::vector<glm::vec3> >);
-    mspTrajectory->resize(1);
-    mspTrajectory->at(0).resize(atomCount);
+    std::shared_ptr<Trajectory> spTrajectory = std::make_shared<Trajectory>(atomCount, 1);
 
     // Fill structures for CPU
     for(int i = 0; i < atomCount; i++)
@@ -126,8 +138,9 @@ GPUProtein::GPUProtein(const std::vector<glm::vec4>& rAtoms)
         mspRadii->at(i) = rAtoms.at(i).w;
 
         // Collect trajectory
-        mspTrajectory->at(0).at(i) = glm::vec3(rAtoms.at(i).x, rAtoms.at(i).y, rAtoms.at(i).z);
+        spTrajectory->setPosition(0, i, glm::vec3(rAtoms.at(i).x, rAtoms.at(i).y, rAtoms.at(i).z));
     }
+    mspTrajectory = spTrajectory;
 
     // TODO: Elements and aminoacids are not filled here
 
@@ -171,24 +184,153 @@ std::shared_ptr<const std::vector<float> > GPUProtein::getRadii() const
     return mspRadii;
 }
 
-std::shared_ptr<const std::vector<std::vector<glm::vec3> > > GPUProtein::getTrajectory() const
+std::shared_ptr<const Trajectory> GPUProtein::getTrajectory() const
 {
     return mspTrajectory;
 }
 
-void GPUProtein::initSSBOs(int atomCount, int frameCount)
+int GPUProtein::getFrameCount() const
 {
-    // For copying it to OpenGL, store it linear
-    std::vector<glm::vec3> linearTrajectory;
-    linearTrajectory.reserve(frameCount * atomCount);
-    for(int i = 0; i < frameCount; i++)
+    return mspFrames ? mspFrames->getNumberOfFrames() : mspTrajectory->getNumberOfFrames();
+}
+
+TrajectoryFrame GPUProtein::getFrame(int frame) const
+{
+    if(mspFrames)
+    {
+        return mspFrames->getFrame(frame);
+    }
+
+    // Share ownership with whole trajectory
+    if(frame < 0 || frame >= mspTrajectory->getNumberOfFrames())
+    {
+        return TrajectoryFrame();
+    }
+    return TrajectoryFrame(mspTrajectory->getFrame(frame), mspTrajectory->getNumberOfAtoms(), mspTrajectory);
+}
+
+int GPUProtein::makeResident(int frame, int radius) const
+{
+    // All frames are in the SSBO
+    if(!mspFrames)
+    {
+        return frame;
+    }
+
+    // Nothing to do if frames are already in the window
+    int firstFrame = glm::max(0, frame - radius);
+    int lastFrame = glm::min(getFrameCount() - 1, frame + radius);
+    if(firstFrame >= mResidentFirstFrame && lastFrame < mResidentFirstFrame + mResidentFrameCount)
+    {
+        return frame - mResidentFirstFrame;
+    }
+
+    // Grow SSBO if window is too small for frames, which drops the frames in it
+    int atomCount = getAtomCount();
+    if(lastFrame - firstFrame + 1 > mResidentCapacity)
+    {
+        mResidentCapacity = lastFrame - firstFrame + 1;
+        mTrajectoryBuffer.allocate(mResidentCapacity * atomCount, GL_DYNAMIC_DRAW);
+        mResidentFrameCount = 0;
+    }
+
+    // Window is extended at its end while the frames fit into it. Otherwise it starts at the frames when moving
+    // forward and ends half of it behind them when moving backward, so it is not moved for every frame
+    int oldFirstFrame = mResidentFirstFrame;
+    int oldEndFrame = mResidentFirstFrame + mResidentFrameCount;
+    int newFirstFrame = firstFrame;
+    if(firstFrame >= oldFirstFrame && lastFrame < oldFirstFrame + mResidentCapacity)
+    {
+        newFirstFrame = oldFirstFrame;
+    }
+    else if(firstFrame < oldFirstFrame)
+    {
+        newFirstFrame = glm::max(0, lastFrame + 1 - glm::max(lastFrame - firstFrame + 1, mResidentCapacity / 2));
+    }
+
+    // Frames of old window that stay in new window are moved within SSBO, only the others are uploaded
+    int keptFirstFrame = glm::max(newFirstFrame, oldFirstFrame);
+    int keptEndFrame = glm::min(oldEndFrame, newFirstFrame + mResidentCapacity);
+    int newEndFrame = lastFrame + 1;
+    if(keptFirstFrame < keptEndFrame)
+    {
+        mTrajectoryBuffer.move((keptFirstFrame - oldFirstFrame) * atomCount, (keptFirstFrame - newFirstFrame) * atomCount, (keptEndFrame - keptFirstFrame) * atomCount);
+        newEndFrame = glm::max(newEndFrame, keptEndFrame);
+    }
+    else
     {
-        linearTrajectory.insert(linearTrajectory.end(), mspTrajectory->at(i).begin(), mspTrajectory->at(i).end());
+        keptFirstFrame = keptEndFrame = newEndFrame;
     }
+    mResidentFirstFrame = newFirstFrame;
+    mResidentFrameCount = newEndFrame - newFirstFrame;
 
-    // Create structures of radii and trajectory on GPU
+    // Upload exposed frames in front of and behind kept ones. They are prefetched once, so querying them does not
+    // schedule frames after each of them. Frames which can not be decoded are zeroed instead of showing stale data
+    std::vector<glm::vec3> zeros;
+    auto upload = [&](int first, int end)
+    {
+        mspFrames->prefetch(first, end - first);
+        for(int i = first; i < end; i++)
+        {
+            auto positions = mspFrames->getFrame(i, false);
+            if(positions && positions.size() == atomCount)
+            {
+                mTrajectoryBuffer.update((i - newFirstFrame) * atomCount, positions.data(), atomCount);
+            }
+            else
+            {
+                Logger::instance().print("Frame " + std::to_string(i) + " could not be uploaded and is zeroed", Logger::Mode::ERROR);
+                zeros.resize(atomCount);
+                mTrajectoryBuffer.update((i - newFirstFrame) * atomCount, zeros.data(), atomCount);
+            }
+        }
+    };
+    upload(newFirstFrame, keptFirstFrame);
+    upload(keptEndFrame, newEndFrame);
+
+    // Decode frames following window while this one is used
+    mspFrames->prefetch(newEndFrame, mResidentCapacity);
+
+    return frame - mResidentFirstFrame;
+}
+
+int GPUProtein::getResidentFrameCount() const
+{
+    return mspFrames ? mResidentFrameCount : getFrameCount();
+}
+
+glm::vec3 GPUProtein::getCenterOfMass(int frame) const
+{
+    if(!mspFrames)
+    {
+        return mCentersOfMass.at(frame);
+    }
+
+    // Calculate center from frame queried on demand
+    auto positions = mspFrames->getFrame(frame);
+    glm::vec3 accPosition(0, 0, 0);
+    if(positions.size() == 0)
+    {
+        return accPosition;
+    }
+    for(const glm::vec3& rPosition : positions)
+    {
+        accPosition += rPosition;
+    }
+    return accPosition / (float)positions.size();
+}
+
+void GPUProtein::initSSBOs(int atomCount, int frameCount)
+{
+    // Create structure of radii on GPU
     mRadiiBuffer.fill(*mspRadii.get(), GL_STATIC_DRAW);
-    mTrajectoryBuffer.fill(linearTrajectory, GL_STATIC_DRAW);
+
+    // Create structure of trajectory on GPU, unless frames are uploaded on demand
+    if(!mspFrames)
+    {
+        // Frames are already stored linear, so they are copied to OpenGL as they are
+        mTrajectoryBuffer.fill(mspTrajectory->getFrame(0), frameCount * atomCount, GL_STATIC_DRAW);
+    }
 
     // Get atom lookup
     AtomLUT lut;
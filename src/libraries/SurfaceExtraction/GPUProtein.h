@@ -8,6 +8,7 @@
 #define GPU_PROTEIN_H
 
 #include "SurfaceExtraction/GPUBuffer.h"
+#include "Molecule/MDtrajLoader/Data/Trajectory.h"
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <vector>
@@ -15,6 +16,7 @@
 
 // Forward declaration
 class Protein;
+class FrameProvider;
 
 class GPUProtein
 {
@@ -36,7 +38,8 @@ public:
     };
 
     // Constructors
-    GPUProtein(Protein * const pProtein);
+    GPUProtein(Protein * const pProtein); // shares trajectory of protein
+    GPUProtein(Protein * const pProtein, std::shared_ptr<FrameProvider> spFrames); // topology of protein, frames queried on demand
     GPUProtein(const std::vector<glm::vec4>& rAtoms); // vec3 center + float radius
 
     // Destructor
@@ -61,16 +64,26 @@ public:
     int getAtomCount() const { return mspRadii->size(); }
 
     // Get count of frames available in trajectory
-    int getFrameCount() const { return mspTrajectory->size(); }
+    int getFrameCount() const;
 
     // Get shared pointer to atom radii
     std::shared_ptr<const std::vector<float> > getRadii() const;
 
-    // Get shared pointer to trajectory (position per atom per frame)
-    std::shared_ptr<const std::vector<std::vector<glm::vec3> > > getTrajectory() const;
+    // Get shared pointer to trajectory (position per atom per frame). Empty if frames are queried on demand
+    std::shared_ptr<const Trajectory> getTrajectory() const;
+
+    // Get positions of atoms in one frame, which share ownership of their memory
+    TrajectoryFrame getFrame(int frame) const;
+
+    // Make frames from frame - radius to frame + radius available in trajectory SSBO. Returns index of
+    // frame within the SSBO, which replaces the frame for shaders together with the resident frame count
+    int makeResident(int frame, int radius = 0) const;
+
+    // Get count of frames in trajectory SSBO
+    int getResidentFrameCount() const;
 
     // Get center of protein at specific frame
-    glm::vec3 getCenterOfMass(int frame) const { return mCentersOfMass.at(frame); }
+    glm::vec3 getCenterOfMass(int frame) const;
 
     // Get element
     std::string getElementName(int atomIndex) const { return mElementNames.at(atomIndex); }
@@ -89,20 +102,31 @@ public:
 
 private:
 
+    // Fill radii, elements, aminoacids and initial coordinates on CPU
+    void initTopology(Protein * const pProtein);
+
     // Initialize SSBOs
     void initSSBOs(int atomCount, int frameCount);
 
     // Vector of radii
     std::shared_ptr<std::vector<float> > mspRadii;
 
-    // Vector of trajectory (outer is for frames, inner for atoms in each frame)
-    std::shared_ptr<std::vector<std::vector<glm::vec3> > > mspTrajectory;
+    // Trajectory with all frames one after another, shared with protein
+    std::shared_ptr<const Trajectory> mspTrajectory;
 
     // SSBO of radii
     GPUBuffer<float> mRadiiBuffer;
 
-    // SSBO of trajectory
-    GPUBuffer<glm::vec3> mTrajectoryBuffer;
+    // Provider of frames if they are queried on demand
+    std::shared_ptr<FrameProvider> mspFrames;
+
+    // SSBO of trajectory, holds only a window of frames if they are queried on demand
+    mutable GPUBuffer<glm::vec3> mTrajectoryBuffer;
+
+    // Window of frames in trajectory SSBO and count of frames it can hold
+    mutable int mResidentFirstFrame = 0;
+    mutable int mResidentFrameCount = 0;
+    mutable int mResidentCapacity = 0;
 
     // Vector which holds the center of mass for each frame (ok, mass is not yet taken into account)
     std::vector<glm::vec3> mCentersOfMass;
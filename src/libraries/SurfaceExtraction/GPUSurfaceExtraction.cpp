@@ -59,6 +59,12 @@ std::unique_ptr<GPUSurface> GPUSurfaceExtraction::calculateSurface(
         surfaceIndicesSubvectors.resize(CPUThreadCount); // one vector for each thread
         std::vector<std::thread> threads;
 
+        // Positions and radii read by all threads
+        auto spRadii = pGPUProtein->getRadii();
+        auto positions = pGPUProtein->getFrame(frame);
+        const TrajectoryFrame& rPositions = positions;
+        const std::vector<float>& rRadii = *spRadii.get();
+
          // Do it as often as indicated
         bool firstRun = true;
         while(firstRun || (extractLayers && (inputCount > 0)))
@@ -86,7 +92,7 @@ std::unique_ptr<GPUSurface> GPUSurfaceExtraction::calculateSurface(
                 int count = inputCount / CPUThreadCount;
                 int offset = count * i;
                 threads.push_back(
-                    std::thread([inputCount, probeRadius, frame, &pGPUProtein]( // decide what to capture
+                    std::thread([inputCount, probeRadius, &rPositions, &rRadii]( // decide what to capture
                         int minIndex,
                         int maxIndex,
                         const std::vector<unsigned int>& rInputIndices,
@@ -101,8 +107,8 @@ std::unique_ptr<GPUSurface> GPUSurfaceExtraction::calculateSurface(
                         for(int a = minIndex; a <= maxIndex; a++)
                         {
                             threadCPUSurfaceExtraction.execute(
-                                pGPUProtein,
-                                frame,
+                                rPositions,
+                                rRadii,
                                 a,
                                 inputCount,
                                 probeRadius,
@@ -160,8 +166,8 @@ std::unique_ptr<GPUSurface> GPUSurfaceExtraction::calculateSurface(
         // Probe radius
         mupComputeProgram->update("probeRadius", probeRadius);
 
-        // Current frame
-        mupComputeProgram->update("frame", frame);
+        // Current frame, within the frames which are available in the trajectory SSBO
+        mupComputeProgram->update("frame", pGPUProtein->makeResident(frame));
 
         // Atom count
         mupComputeProgram->update("atomCount", pGPUProtein->getAtomCount());
@@ -241,8 +247,8 @@ std::unique_ptr<GPUSurface> GPUSurfaceExtraction::calculateSurface(
 
 // ## Execution function
 void GPUSurfaceExtraction::CPUSurfaceExtraction::execute(
-    GPUProtein const * pGPUProtein,
-    int frame,
+    const TrajectoryFrame& rPositions,
+    const std::vector<float>& rRadii,
     int executionIndex,
     int inputCount,
     float probeRadius,
@@ -275,11 +281,11 @@ void GPUSurfaceExtraction::CPUSurfaceExtraction::execute(
     bool endpointSurvivesCut = false;
 
     // Own center
-    glm::vec3 atomCenter = pGPUProtein->getTrajectory()->at(frame).at(atomIndex);
+    glm::vec3 atomCenter = rPositions.at(atomIndex);
     /* if(mLogging) { std::cout << "Atom center: " << atomCenter.x << ", " << atomCenter.y << ", " << atomCenter.z << std::endl; } */
 
     // Own extended radius
-    float atomExtRadius = pGPUProtein->getRadii()->at(atomIndex) + probeRadius;
+    float atomExtRadius = rRadii.at(atomIndex) + probeRadius;
     /* if(mLogging) { std::cout << "Atom extended radius: " << atomExtRadius << std::endl; } */
 
     // ### BUILD UP OF CUTTING FACE LIST ###
@@ -296,8 +302,8 @@ void GPUSurfaceExtraction::CPUSurfaceExtraction::execute(
         // ### OTHER'S VALUES ###
 
         // Get values from other atom
-        glm::vec3 otherAtomCenter = pGPUProtein->getTrajectory()->at(frame).at(otherAtomIndex);
-        float otherAtomExtRadius = pGPUProtein->getRadii()->at(otherAtomIndex) + probeRadius;
+        glm::vec3 otherAtomCenter = rPositions.at(otherAtomIndex);
+        float otherAtomExtRadius = rRadii.at(otherAtomIndex) + probeRadius;
 
         // ### INTERSECTION TEST ###
 
@@ -33,17 +33,16 @@ public:
         bool useCPU = false,
         int CPUThreadCount = 1) const;
 
-private:
-
     // More for debugging and performance purposes, therefore member of GPUSurfaceExtraction
+    // Does not need OpenGL, so it is also used for headless validation
     // Face is defined by vec4(Normal, Distance from origin)
     class CPUSurfaceExtraction
     {
     public:
 
         void execute(
-            GPUProtein const * pGPUProtein,
-            int frame,
+            const TrajectoryFrame& rPositions, // positions of atoms in processed frame
+            const std::vector<float>& rRadii,
             int executionIndex,
             int inputCount,
             float probeRadius,
@@ -95,6 +94,8 @@ private:
         int mCuttingFaceIndices[mNeighborsMaxCount]; // Indices of cutting faces which are not cut away by other
     };
 
+private:
+
     // Shader program for computation
     std::unique_ptr<ShaderProgram> mupComputeProgram;
 
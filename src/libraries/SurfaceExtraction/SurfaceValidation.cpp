@@ -5,6 +5,12 @@
 #include "SurfaceValidation.h"
 #include "SurfaceExtraction/GPUProtein.h"
 #include "SurfaceExtraction/GPUSurface.h"
+#include "SurfaceExtraction/GPUSurfaceExtraction.h"
+#include <thread>
+#include <limits>
+#include <atomic>
+#include <mutex>
+#include <sstream>
 
 SurfaceValidation::SurfaceValidation()
 {
@@ -54,155 +60,363 @@ void SurfaceValidation::validate(
     unsigned int sampleSeed,
     int samplesPerAtomCount,
     std::string& rInformation,
-    std::vector<GLuint> rMaybeIncorrectSurfaceAtomIndices)
+    std::vector<GLuint> rMaybeIncorrectSurfaceAtomIndices,
+    int threadCount)
 {
     // Clear references
     rInformation.clear();
     rMaybeIncorrectSurfaceAtomIndices.clear();
 
-    // Read data back from OpenGL buffers
-    std::vector<GLuint> inputIndices = pGPUSurface->getInputIndices(layer);
-    std::vector<GLuint> internalIndices = pGPUSurface->getInternalIndices(layer);
-    std::vector<GLuint> surfaceIndices = pGPUSurface->getSurfaceIndices(layer);
-
-    // Seed
-    std::srand(sampleSeed);
+    // Get shared pointer to radii and positions in frame
+    auto spRadii = pGPUProtein->getRadii();
+    auto positions = pGPUProtein->getFrame(frame);
 
     // Vectors of samples
     std::vector<glm::vec3> internalSamples;
     std::vector<glm::vec3> surfaceSamples;
 
-    // Count cases of failure
-    int internalSampleFailures = 0;
-    int surfaceAtomsFailures = 0;
+    // Validate with data read back from OpenGL buffers
+    LayerResult result = validateLayer(
+        positions,
+        *spRadii.get(),
+        pGPUSurface->getInputIndices(layer),
+        pGPUSurface->getInternalIndices(layer),
+        pGPUSurface->getSurfaceIndices(layer),
+        probeRadius,
+        sampleSeed,
+        samplesPerAtomCount,
+        threadCount,
+        &internalSamples,
+        &surfaceSamples);
+
+    // Check, whether all atoms are internal or surface
+    if(!result.unclassifiedAtomIndices.empty())
+    {
+        rInformation =
+            "Atom "
+            + std::to_string(result.unclassifiedAtomIndices.front())
+            + " neither classified as internal nor as surface.\nSurface extraction algorithm has failed.";
+        return;
+    }
+    rMaybeIncorrectSurfaceAtomIndices = result.maybeIncorrectSurfaceAtomIndices;
 
-    // Get shared pointer to radii and trajectory
-    auto spRadii = pGPUProtein->getRadii();
-    auto spTrajectory = pGPUProtein->getTrajectory();
+    // Fill vertex buffer with vertices
+    glBindBuffer(GL_ARRAY_BUFFER, mInternalVBO);
+    glBufferData(GL_ARRAY_BUFFER, internalSamples.size() * sizeof(glm::vec3), internalSamples.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mSurfaceVBO);
+    glBufferData(GL_ARRAY_BUFFER, surfaceSamples.size() * sizeof(glm::vec3), surfaceSamples.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Remember about complete count of samples for drawing
+    mInternalSampleCount = internalSamples.size();
+    mSurfaceSampleCount = surfaceSamples.size();
+
+    // Draw output of test to GUI
+    rInformation = "Wrong classification as internal for " + std::to_string(result.internalSampleFailures) + " samples.\n";
+    rInformation += "Maybe wrong classification as surface for " + std::to_string(result.maybeIncorrectSurfaceAtomIndices.size()) + " atoms.";
+}
 
-    // Go over atoms (using indices from input indices buffer)
-    for(unsigned int i : inputIndices) // using results from algorithm here. Not so good for independent test but necessary for validating layers
+SurfaceValidation::LayerResult SurfaceValidation::validateLayer(
+    const TrajectoryFrame& rPositions,
+    const std::vector<float>& rRadii,
+    const std::vector<GLuint>& rInputIndices,
+    const std::vector<GLuint>& rInternalIndices,
+    const std::vector<GLuint>& rSurfaceIndices,
+    float probeRadius,
+    unsigned int sampleSeed,
+    int samplesPerAtomCount,
+    int threadCount,
+    std::vector<glm::vec3>* pInternalSamples,
+    std::vector<glm::vec3>* pSurfaceSamples)
+{
+    // Result
+    LayerResult result;
+    result.inputAtomCount = (int)rInputIndices.size();
+    result.internalAtomCount = (int)rInternalIndices.size();
+    result.surfaceAtomCount = (int)rSurfaceIndices.size();
+
+    // Membership of atoms (0 = not classified, 1 = internal, 2 = surface)
+    std::vector<unsigned char> classification(rPositions.size(), 0);
+    for(GLuint i : rInternalIndices) { classification.at(i) = 1; }
+    for(GLuint i : rSurfaceIndices) { classification.at(i) |= 2; }
+
+    // Only validate classified atoms (using results from algorithm here. Not so good for independent test but necessary for validating layers)
+    std::vector<GLuint> classifiedIndices;
+    classifiedIndices.reserve(rInputIndices.size());
+    for(GLuint i : rInputIndices)
     {
-        // Check, whether atom is internal or surface (would be faster to iterate over those structures, but this way the test is more testier)
-        bool found = false;
-        bool internalAtom = false;
-        for(auto& rIndex : internalIndices)
+        if(classification.at(i) == 0)
         {
-            if(rIndex == i)
-            {
-                found = true;
-                internalAtom = true;
-                break;
-            }
+            result.unclassifiedAtomIndices.push_back(i);
+        }
+        else
+        {
+            classifiedIndices.push_back(i);
         }
-        if(!found)
+    }
+
+    // Grid over input atoms for testing samples
+    AtomGrid grid(rPositions, rRadii, rInputIndices, probeRadius);
+
+    // Results of each thread, combined in order of threads afterwards
+    threadCount = glm::max(1, threadCount);
+    bool collectSamples = (pInternalSamples != NULL) || (pSurfaceSamples != NULL);
+    std::vector<std::vector<glm::vec3> > internalSamplesSubvectors(threadCount);
+    std::vector<std::vector<glm::vec3> > surfaceSamplesSubvectors(threadCount);
+    std::vector<LayerResult> threadResults(threadCount);
+    std::vector<std::thread> threads;
+
+    // Launch threads
+    int classifiedCount = (int)classifiedIndices.size();
+    for(int t = 0; t < threadCount; t++)
+    {
+        // Calculate min and max index
+        int count = classifiedCount / threadCount;
+        int offset = count * t;
+        int maxIndex = (t == (threadCount - 1)) ? classifiedCount - 1 : (offset + count - 1);
+        threads.push_back(std::thread([&, t, offset, maxIndex]()
         {
-            for(auto& rIndex : surfaceIndices)
+            LayerResult& rThreadResult = threadResults[t];
+            for(int a = offset; a <= maxIndex; a++)
             {
-                if(rIndex == i)
+                // Get position and radius for that atom
+                GLuint i = classifiedIndices.at(a);
+                bool internalAtom = (classification.at(i) == 1);
+                glm::vec3 atomCenter = rPositions.at(i);
+                float atomExtRadius = rRadii.at(i) + probeRadius;
+
+                // Count samples which are classified as internal for that atom
+                int atomInternalSampleCount = 0;
+
+                // Do some samples per atom
+                for(int j = 0; j < samplesPerAtomCount; j++)
+                {
+                    // Generate samples (http://mathworld.wolfram.com/SpherePointPicking.html)
+                    float u = random(sampleSeed, i, (GLuint)j, 0);
+                    float v = random(sampleSeed, i, (GLuint)j, 1);
+                    float theta = 2.f * glm::pi<float>() * u;
+                    float phi = glm::acos(2.f * v - 1);
+
+                    // Generate sample point
+                    glm::vec3 samplePosition(
+                        atomExtRadius * glm::sin(phi) * glm::cos(theta),
+                        atomExtRadius * glm::cos(phi),
+                        atomExtRadius * glm::sin(phi) * glm::sin(theta));
+                    samplePosition += atomCenter;
+
+                    // Test, whether sample is inside in at least one other atom
+                    if(grid.inside(samplePosition, i))
+                    {
+                        // Count to check whether atom was classified as surface and all samples are inside
+                        atomInternalSampleCount++;
+
+                        // Push back to vector
+                        if(collectSamples) { internalSamplesSubvectors[t].push_back(samplePosition); }
+                    }
+                    else
+                    {
+                        // If sample was created by internal atom and is not classified as internal in test, something went terribly wrong
+                        if(internalAtom)
+                        {
+                            // Sample is not inside any other atom's extended hull but should be
+                            rThreadResult.internalSampleFailures++;
+                        }
+
+                        // Push back to vector
+                        if(collectSamples) { surfaceSamplesSubvectors[t].push_back(samplePosition); }
+                    }
+                }
+
+                // Internal atom with samples outside of other atoms is classified wrong
+                if(internalAtom && (atomInternalSampleCount < samplesPerAtomCount))
+                {
+                    rThreadResult.incorrectInternalAtomIndices.push_back(i);
+                }
+
+                // If all samples are classified internal and the atom was classified as surface by the algorithm something MAY have went wront
+                if((atomInternalSampleCount == samplesPerAtomCount) && !internalAtom)
                 {
-                    found = true;
-                    internalAtom = false;
-                    break;
+                    rThreadResult.maybeIncorrectSurfaceAtomIndices.push_back(i);
                 }
             }
+        }));
+    }
+
+    // Join threads and collect results
+    for(int t = 0; t < threadCount; t++)
+    {
+        threads[t].join();
+        if(pInternalSamples != NULL)
+        {
+            pInternalSamples->insert(pInternalSamples->end(), internalSamplesSubvectors[t].begin(), internalSamplesSubvectors[t].end());
         }
-        if(!found)
+        if(pSurfaceSamples != NULL)
         {
-            rInformation =
-                "Atom "
-                + std::to_string(i)
-                + " neither classified as internal nor as surface.\nSurface extraction algorithm has failed.";
-            return;
+            pSurfaceSamples->insert(pSurfaceSamples->end(), surfaceSamplesSubvectors[t].begin(), surfaceSamplesSubvectors[t].end());
         }
+        const LayerResult& rThreadResult = threadResults[t];
+        result.internalSampleFailures += rThreadResult.internalSampleFailures;
+        result.incorrectInternalAtomIndices.insert(
+            result.incorrectInternalAtomIndices.end(),
+            rThreadResult.incorrectInternalAtomIndices.begin(),
+            rThreadResult.incorrectInternalAtomIndices.end());
+        result.maybeIncorrectSurfaceAtomIndices.insert(
+            result.maybeIncorrectSurfaceAtomIndices.end(),
+            rThreadResult.maybeIncorrectSurfaceAtomIndices.begin(),
+            rThreadResult.maybeIncorrectSurfaceAtomIndices.end());
+    }
+    result.sampleCount = classifiedCount * samplesPerAtomCount;
 
-        // Get position and radius for that atom
-        glm::vec3 atomCenter = spTrajectory->at(frame).at(i);
-        float atomExtRadius = spRadii->at(i) + probeRadius;
-
-        // Count samples which are classified as internal for that atom
-        int atomInternalSampleCount = 0;
+    return result;
+}
 
-        // Do some samples per atom
-        for(int j = 0; j < samplesPerAtomCount; j++)
+std::vector<SurfaceValidation::LayerResult> SurfaceValidation::validateTrajectory(
+    const Trajectory& rTrajectory,
+    const std::vector<float>& rRadii,
+    int startFrame,
+    int endFrame,
+    float probeRadius,
+    unsigned int sampleSeed,
+    int samplesPerAtomCount,
+    int threadCount,
+    std::function<void(float)> progressCallback)
+{
+    // Results per frame, each with results per layer
+    int frameCount = glm::max(endFrame - startFrame + 1, 0);
+    std::vector<std::vector<LayerResult> > frameResults(frameCount);
+
+    // Frames are fetched by threads one after another
+    std::atomic<int> nextFrame(0);
+    std::atomic<int> doneFrameCount(0);
+    std::mutex progressMutex;
+    threadCount = glm::max(1, glm::min(threadCount, frameCount));
+    std::vector<std::thread> threads;
+    for(int t = 0; t < threadCount; t++)
+    {
+        threads.push_back(std::thread([&]()
         {
-            // Generate samples (http://mathworld.wolfram.com/SpherePointPicking.html)
-            float u = (float)((double)std::rand() / (double)RAND_MAX);
-            float v = (float)((double)std::rand() / (double)RAND_MAX);
-            float theta = 2.f * glm::pi<float>() * u;
-            float phi = glm::acos(2.f * v - 1);
-
-            // Generate sample point
-            glm::vec3 samplePosition(
-                atomExtRadius * glm::sin(phi) * glm::cos(theta),
-                atomExtRadius * glm::cos(phi),
-                atomExtRadius * glm::sin(phi) * glm::sin(theta));
-            samplePosition += atomCenter;
-
-            // Go over all atoms and test, whether sample is inside in at least one
-            bool inside = false;
-            for(unsigned int k : inputIndices)
+            GPUSurfaceExtraction::CPUSurfaceExtraction extraction;
+            int localFrame;
+            while((localFrame = nextFrame++) < frameCount)
             {
-                // Test not against atom that generated sample
-                if(k == i) { continue; };
+                int frame = startFrame + localFrame;
+                TrajectoryFrame positions(rTrajectory.getFrame(frame), rTrajectory.getNumberOfAtoms());
+
+                // First input are all atoms
+                std::vector<GLuint> inputIndices;
+                inputIndices.reserve(positions.size());
+                for(GLuint i = 0; i < (GLuint)positions.size(); i++) { inputIndices.push_back(i); }
 
-                // Actual test
-                glm::vec3 otherAtomCenter = spTrajectory->at(frame).at(k);
-                float otherAtomRadius = spRadii->at(k) + probeRadius;
-                if(glm::distance(samplePosition, otherAtomCenter) <= (otherAtomRadius))
+                // Extract and validate layers until no internal atoms are left
+                int layer = 0;
+                while(!inputIndices.empty())
                 {
-                    inside = true;
-                    break;
+                    std::vector<GLuint> internalIndices;
+                    std::vector<GLuint> surfaceIndices;
+                    for(int a = 0; a < (int)inputIndices.size(); a++)
+                    {
+                        extraction.execute(
+                            positions,
+                            rRadii,
+                            a,
+                            (int)inputIndices.size(),
+                            probeRadius,
+                            inputIndices,
+                            internalIndices,
+                            surfaceIndices);
+                    }
+
+                    // Validate that layer
+                    LayerResult result = validateLayer(
+                        positions,
+                        rRadii,
+                        inputIndices,
+                        internalIndices,
+                        surfaceIndices,
+                        probeRadius,
+                        sampleSeed,
+                        samplesPerAtomCount);
+                    result.frame = frame;
+                    result.layer = layer;
+                    frameResults.at(localFrame).push_back(result);
+
+                    // Internal atoms are input of next layer. Stop if no progress is made
+                    if(internalIndices.size() == inputIndices.size()) { break; }
+                    inputIndices = internalIndices;
+                    layer++;
                 }
-            }
-
-            // Check result
-            if(inside)
-            {
-                // Count to check whether atom was classified as surface and all samples are inside
-                atomInternalSampleCount++;
 
-                // Push back to vector
-                internalSamples.push_back(samplePosition);
-            }
-            else
-            {
-                // If sample was created by internal atom and is not classified as internal in test, something went terribly wrong
-                if(internalAtom)
+                // Report progress
+                int done = ++doneFrameCount;
+                if(progressCallback != NULL)
                 {
-                    // Sample is not inside any other atom's extended hull but should be
-                    internalSampleFailures++;
+                    std::lock_guard<std::mutex> lock(progressMutex);
+                    progressCallback((float)done / (float)frameCount);
                 }
-
-                // Push back to vector
-                surfaceSamples.push_back(samplePosition);
             }
-        }
-
-        // If all samples are classified internal and the atom was classified as surface by the algorithm something MAY have went wront
-        if((atomInternalSampleCount == samplesPerAtomCount) && !internalAtom)
-        {
-            rMaybeIncorrectSurfaceAtomIndices.push_back(i);
-            surfaceAtomsFailures++;
-        }
+        }));
     }
 
-    // Fill vertex buffer with vertices
-    glBindBuffer(GL_ARRAY_BUFFER, mInternalVBO);
-    glBufferData(GL_ARRAY_BUFFER, internalSamples.size() * sizeof(glm::vec3), internalSamples.data(), GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Join threads
+    for(auto& rThread : threads)
+    {
+        rThread.join();
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, mSurfaceVBO);
-    glBufferData(GL_ARRAY_BUFFER, surfaceSamples.size() * sizeof(glm::vec3), surfaceSamples.data(), GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Flatten results in order of frames
+    std::vector<LayerResult> results;
+    for(auto& rResults : frameResults)
+    {
+        results.insert(results.end(), rResults.begin(), rResults.end());
+    }
+    return results;
+}
 
-    // Remember about complete count of samples for drawing
-    mInternalSampleCount = internalSamples.size();
-    mSurfaceSampleCount = surfaceSamples.size();
+std::string SurfaceValidation::createReport(const std::vector<LayerResult>& rResults)
+{
+    std::stringstream stream;
+    stream << "frame,layer,inputAtoms,internalAtoms,surfaceAtoms,samples,failedSamples,sampleFailureRate,"
+           << "incorrectInternalAtoms,maybeIncorrectSurfaceAtoms,unclassifiedAtoms\n";
+    for(const LayerResult& rResult : rResults)
+    {
+        // Write indices of atoms separated by spaces
+        auto indices = [&](const std::vector<GLuint>& rIndices)
+        {
+            for(int i = 0; i < (int)rIndices.size(); i++)
+            {
+                stream << (i > 0 ? " " : "") << rIndices.at(i);
+            }
+        };
+
+        // One line per frame and layer
+        stream
+            << rResult.frame << ","
+            << rResult.layer << ","
+            << rResult.inputAtomCount << ","
+            << rResult.internalAtomCount << ","
+            << rResult.surfaceAtomCount << ","
+            << rResult.sampleCount << ","
+            << rResult.internalSampleFailures << ","
+            << (rResult.sampleCount > 0 ? (float)rResult.internalSampleFailures / (float)rResult.sampleCount : 0.f) << ",";
+        indices(rResult.incorrectInternalAtomIndices); stream << ",";
+        indices(rResult.maybeIncorrectSurfaceAtomIndices); stream << ",";
+        indices(rResult.unclassifiedAtomIndices); stream << "\n";
+    }
+    return stream.str();
+}
 
-    // Draw output of test to GUI
-    rInformation = "Wrong classification as internal for " + std::to_string(internalSampleFailures) + " samples.\n";
-    rInformation += "Maybe wrong classification as surface for " + std::to_string(surfaceAtomsFailures) + " atoms.";
+bool SurfaceValidation::failed(const std::vector<LayerResult>& rResults)
+{
+    for(const LayerResult& rResult : rResults)
+    {
+        if(!rResult.incorrectInternalAtomIndices.empty() || !rResult.unclassifiedAtomIndices.empty())
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 void SurfaceValidation::drawSamples(
@@ -242,3 +456,121 @@ void SurfaceValidation::drawSamples(
         glBindVertexArray(0);
     }
 }
+
+SurfaceValidation::AtomGrid::AtomGrid(
+    const TrajectoryFrame& rPositions,
+    const std::vector<float>& rRadii,
+    const std::vector<GLuint>& rIndices,
+    float probeRadius)
+{
+    // Bounding box and largest extended radius
+    mMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+    float maxExtRadius = 0.f;
+    for(GLuint i : rIndices)
+    {
+        mMin = glm::min(mMin, rPositions.at(i));
+        max = glm::max(max, rPositions.at(i));
+        maxExtRadius = glm::max(maxExtRadius, rRadii.at(i) + probeRadius);
+    }
+    if(rIndices.empty())
+    {
+        mMin = glm::vec3(0);
+        max = glm::vec3(0);
+    }
+
+    // Cells must cover largest extended radius. Coarsen for sparse input to limit count of cells
+    mCellSize = glm::max(maxExtRadius, 0.001f);
+    glm::vec3 extent = max - mMin;
+    while(true)
+    {
+        mResolution = glm::ivec3(extent / mCellSize) + glm::ivec3(1);
+        if((float)mResolution.x * (float)mResolution.y * (float)mResolution.z <= (float)(8 * rIndices.size() + 64)) { break; }
+        mCellSize *= 2.f;
+    }
+    int cellCount = mResolution.x * mResolution.y * mResolution.z;
+
+    // Count atoms per cell
+    std::vector<GLuint> cells;
+    cells.reserve(rIndices.size());
+    mCellOffsets = std::vector<GLuint>(cellCount + 1, 0);
+    for(GLuint i : rIndices)
+    {
+        glm::ivec3 cell = cellOf(rPositions.at(i));
+        GLuint cellIndex = (GLuint)((cell.z * mResolution.y + cell.y) * mResolution.x + cell.x);
+        cells.push_back(cellIndex);
+        mCellOffsets.at(cellIndex + 1)++;
+    }
+
+    // Prefix sum over counts
+    for(int c = 0; c < cellCount; c++)
+    {
+        mCellOffsets.at(c + 1) += mCellOffsets.at(c);
+    }
+
+    // Counting sort of atoms into cells
+    std::vector<GLuint> insertPositions(mCellOffsets.begin(), mCellOffsets.end() - 1);
+    mAtoms.resize(rIndices.size());
+    mAtomIndices.resize(rIndices.size());
+    for(int k = 0; k < (int)rIndices.size(); k++)
+    {
+        GLuint i = rIndices.at(k);
+        GLuint position = insertPositions.at(cells.at(k))++;
+        mAtoms.at(position) = glm::vec4(rPositions.at(i), rRadii.at(i) + probeRadius);
+        mAtomIndices.at(position) = i;
+    }
+}
+
+bool SurfaceValidation::AtomGrid::inside(glm::vec3 point, GLuint excludedIndex) const
+{
+    // Go over neighbor cells
+    glm::ivec3 cell = cellOf(point);
+    for(int z = glm::max(cell.z - 1, 0); z <= glm::min(cell.z + 1, mResolution.z - 1); z++)
+    {
+        for(int y = glm::max(cell.y - 1, 0); y <= glm::min(cell.y + 1, mResolution.y - 1); y++)
+        {
+            for(int x = glm::max(cell.x - 1, 0); x <= glm::min(cell.x + 1, mResolution.x - 1); x++)
+            {
+                // Go over atoms in cell
+                int cellIndex = (z * mResolution.y + y) * mResolution.x + x;
+                for(GLuint k = mCellOffsets[cellIndex]; k < mCellOffsets[cellIndex + 1]; k++)
+                {
+                    // Test not against atom that generated sample
+                    if(mAtomIndices[k] == excludedIndex) { continue; }
+
+                    // Actual test
+                    const glm::vec4& rAtom = mAtoms[k];
+                    if(glm::distance(point, glm::vec3(rAtom.x, rAtom.y, rAtom.z)) <= rAtom.w)
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+glm::ivec3 SurfaceValidation::AtomGrid::cellOf(glm::vec3 point) const
+{
+    return glm::clamp(
+        glm::ivec3(glm::floor((point - mMin) / mCellSize)),
+        glm::ivec3(0),
+        mResolution - glm::ivec3(1));
+}
+
+float SurfaceValidation::random(unsigned int seed, GLuint atomIndex, GLuint sampleIndex, GLuint dimension)
+{
+    // Mix key with seed through splitmix64 finalizer (http://xorshift.di.unimi.it/splitmix64.c)
+    std::uint64_t key =
+        ((std::uint64_t)atomIndex << 32)
+        ^ ((std::uint64_t)sampleIndex << 1)
+        ^ (std::uint64_t)dimension;
+    std::uint64_t z = key + 0x9E3779B97F4A7C15ull * ((std::uint64_t)seed + 1);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z = z ^ (z >> 31);
+
+    // Use upper 24 bits for float in [0,1]
+    return (float)(z >> 40) / (float)((1u << 24) - 1);
+}
@@ -8,9 +8,14 @@
 #define SURFACE_EXTRACTION_H
 
 #include "ShaderTools/ShaderProgram.h"
+#include "Molecule/MDtrajLoader/Data/Trajectory.h"
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
 
 // Forward declaration
 class GPUProtein;
@@ -20,13 +25,29 @@ class SurfaceValidation
 {
 public:
 
+    // Result of validating one layer of one frame
+    struct LayerResult
+    {
+        int frame = 0;
+        int layer = 0;
+        int inputAtomCount = 0;
+        int internalAtomCount = 0;
+        int surfaceAtomCount = 0;
+        int sampleCount = 0;
+        int internalSampleFailures = 0; // samples of internal atoms which are not inside any other atom
+        std::vector<GLuint> unclassifiedAtomIndices; // neither internal nor surface
+        std::vector<GLuint> incorrectInternalAtomIndices; // internal atoms with at least one sample outside
+        std::vector<GLuint> maybeIncorrectSurfaceAtomIndices; // surface atoms with all samples inside
+    };
+
     // Constructor
     SurfaceValidation();
 
     // Destructor
     virtual ~SurfaceValidation();
 
-    // Validation. rInformation is filled with information string about validation
+    // Validation. rInformation is filled with information string about validation.
+    // Samples are generated per atom and sample index, so result does not depend on thread count
     void validate(
         GPUProtein const * pGPUProtein,
         GPUSurface const * pGPUSurface,
@@ -36,7 +57,8 @@ public:
         unsigned int sampleSeed,
         int samplesPerAtomCount,
         std::string& rInformation,
-        std::vector<GLuint> rMaybeIncorrectSurfaceAtomIndices);
+        std::vector<GLuint> rMaybeIncorrectSurfaceAtomIndices,
+        int threadCount = 1);
 
     // Draw sample points (internal sample means sample that was cut away by atom)
     void drawSamples(
@@ -49,8 +71,79 @@ public:
         bool drawInternalSamples = true,
         bool drawSurfaceSamples = true) const;
 
+    // Validation of one layer without OpenGL. Optionally collects the samples
+    static LayerResult validateLayer(
+        const TrajectoryFrame& rPositions, // positions of atoms in validated frame
+        const std::vector<float>& rRadii,
+        const std::vector<GLuint>& rInputIndices,
+        const std::vector<GLuint>& rInternalIndices,
+        const std::vector<GLuint>& rSurfaceIndices,
+        float probeRadius,
+        unsigned int sampleSeed,
+        int samplesPerAtomCount,
+        int threadCount = 1,
+        std::vector<glm::vec3>* pInternalSamples = NULL,
+        std::vector<glm::vec3>* pSurfaceSamples = NULL);
+
+    // Headless validation of all layers in frames [startFrame, endFrame]. Layers are extracted
+    // with the CPU implementation and frames are distributed over threads. Returns results
+    // ordered by frame and layer
+    static std::vector<LayerResult> validateTrajectory(
+        const Trajectory& rTrajectory,
+        const std::vector<float>& rRadii,
+        int startFrame,
+        int endFrame,
+        float probeRadius,
+        unsigned int sampleSeed,
+        int samplesPerAtomCount,
+        int threadCount,
+        std::function<void(float)> progressCallback = NULL);
+
+    // Compact report in CSV format with one line per frame and layer
+    static std::string createReport(const std::vector<LayerResult>& rResults);
+
+    // Whether any atom was classified wrong or not at all (possibly wrong surface atoms do not count)
+    static bool failed(const std::vector<LayerResult>& rResults);
+
 private:
 
+    // Uniform grid over extended hulls of atoms. Cells are at least as large
+    // as the biggest extended radius, so direct neighbor cells cover all candidates
+    class AtomGrid
+    {
+    public:
+
+        // Constructor
+        AtomGrid(
+            const TrajectoryFrame& rPositions,
+            const std::vector<float>& rRadii,
+            const std::vector<GLuint>& rIndices,
+            float probeRadius);
+
+        // Test whether point is inside extended hull of any atom but excluded one
+        bool inside(glm::vec3 point, GLuint excludedIndex) const;
+
+    private:
+
+        // Cell coordinates of point, clamped to grid
+        glm::ivec3 cellOf(glm::vec3 point) const;
+
+        // Extended atoms sorted by cell (center + extended radius)
+        std::vector<glm::vec4> mAtoms;
+        std::vector<GLuint> mAtomIndices;
+
+        // Offsets of cells into sorted atoms (cell count plus one)
+        std::vector<GLuint> mCellOffsets;
+
+        // Grid layout
+        glm::vec3 mMin;
+        float mCellSize;
+        glm::ivec3 mResolution;
+    };
+
+    // Counter-based random number in [0,1] keyed by seed, atom, sample and dimension
+    static float random(unsigned int seed, GLuint atomIndex, GLuint sampleIndex, GLuint dimension);
+
     // VBO for samples which were validated as surface
     GLuint mInternalVBO;
 
@@ -0,0 +1,44 @@
+//============================================================================
+// Distributed under the MIT License. Author: Adrian Derstroff
+//============================================================================
+
+/*
+ * Half stencil for symmetric pair computations, include it after the uniforms
+ * gridRes, searchCellMin, searchCellMax and periodicBox have been declared.
+ * Every unordered pair of particles is visited exactly once:
+ *
+ *      for every offset d in [searchCellMin, searchCellMax]
+ *          ivec3 s = c + d, wrapped on periodic axes, skipped if outside on open axes
+ *          int mode = halfStencilMode(d, c, s);
+ *          if (mode == HALF_STENCIL_SKIP) continue;
+ *          for every particle j in s
+ *              if (mode == HALF_STENCIL_OWN_CELL && j <= i) continue;
+ *              ... // pair i, j
+ */
+
+#define HALF_STENCIL_SKIP     0 // the pair is found from the other cell
+#define HALF_STENCIL_ALL      1 // every particle of the search cell forms a pair
+#define HALF_STENCIL_OWN_CELL 2 // the own cell, only particles with a larger original index form a pair
+
+/*
+ * Of the offsets o and -o only one is searched. On periodic axes -o is wrapped
+ * into the search range, an offset equal to its own negation visits the cell
+ * pair only from the cell with smaller coordinates
+ */
+int halfStencilMode(ivec3 offset, ivec3 cell, ivec3 searchCell)
+{
+    ivec3 negatedOffset = -offset;
+    for (int a = 0; a < 3; a++) {
+        if (periodicBox[a] <= 0.0) continue;
+        if (negatedOffset[a] > searchCellMax[a]) negatedOffset[a] -= gridRes[a];
+        if (negatedOffset[a] < searchCellMin[a]) negatedOffset[a] += gridRes[a];
+    }
+    for (int a = 0; a < 3; a++) {
+        if (offset[a] != negatedOffset[a]) return (offset[a] > negatedOffset[a]) ? HALF_STENCIL_ALL : HALF_STENCIL_SKIP;
+    }
+    if (offset == ivec3(0)) return HALF_STENCIL_OWN_CELL;
+    for (int a = 0; a < 3; a++) {
+        if (searchCell[a] != cell[a]) return (searchCell[a] > cell[a]) ? HALF_STENCIL_ALL : HALF_STENCIL_SKIP;
+    }
+    return HALF_STENCIL_SKIP;
+}
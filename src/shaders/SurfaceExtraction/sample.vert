@@ -28,8 +28,13 @@ layout(std430, binding = 2) restrict readonly buffer RelativePositionBuffer
 // ## Image buffer with classification
 layout(binding = 3, r32ui) restrict readonly uniform uimageBuffer Classification;
 
+// ## Index of atom for each sample SSBO
+layout(std430, binding = 4) restrict readonly buffer SampleAtomIndexBuffer
+{
+   uint sampleAtomIndices[];
+};
+
 // ## Uniforms
-uniform int sampleCount;
 uniform int frame;
 uniform int atomCount;
 uniform int integerCountPerSample;
@@ -40,15 +45,12 @@ uniform vec3 surfaceColor;
 // Main function
 void main()
 {
-    // Extract index of atom
-    int atomIndex = int(gl_VertexID) / sampleCount;
-
-    // Extract index of sample
-    int sampleIndex = int(gl_VertexID) - (atomIndex * sampleCount);
+    // Extract index of atom (samples of an atom are stored consecutively)
+    int atomIndex = int(sampleAtomIndices[gl_VertexID]);
 
     // Calculate position
     Position atomPosition = trajectory[(frame*atomCount) + atomIndex];
-    Position relativeSamplePosition = relativePosition[(atomIndex * sampleCount) + sampleIndex];
+    Position relativeSamplePosition = relativePosition[gl_VertexID];
     gl_Position = vec4(
         atomPosition.x + relativeSamplePosition.x,
         atomPosition.y + relativeSamplePosition.y,
@@ -57,8 +59,7 @@ void main()
 
     // Calculate indices to look up classification
     int uintIndex =
-        (atomIndex * sampleCount * integerCountPerSample) // offset for current atom's samples
-        + (sampleIndex *  integerCountPerSample) // offset for current sample's slot
+        (int(gl_VertexID) * integerCountPerSample) // offset for current sample's slot
         + (localFrame / 32); // offset for unsigned int which has to be read
     int bitIndex = localFrame - (32 * int(localFrame / 32)); // bit index within unsigned integer
 